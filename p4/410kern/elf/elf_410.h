@@ -20,6 +20,7 @@ typedef struct simple_elf {
   unsigned long e_rodatoff;    /* offset of rodata segment in file */
   unsigned long e_rodatlen;    /* length of rodata segment in bytes */
   unsigned long e_rodatstart;  /* start of rodata segment in virtual memory*/
+  unsigned long e_bssstart;    /* start of bss segment in virtual memory */
   unsigned long e_bsslen;      /* length of bss  segment in bytes */
 } simple_elf_t;
 
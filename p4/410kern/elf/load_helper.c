@@ -172,7 +172,8 @@ elf_load_helper( simple_elf_t *se_hdr, const char *fname )
              * This section header is for the bss segment
              */
 
-            se_hdr->e_bsslen = elf_sec_hdrs[i].sh_size;
+            se_hdr->e_bssstart = elf_sec_hdrs[i].sh_addr;
+            se_hdr->e_bsslen   = elf_sec_hdrs[i].sh_size;
         }
 	else if (strcmp( ".symtab", &(shstrtab[ str_idx ])) != 0 &&
 		 strcmp( ".strtab", &(shstrtab[ str_idx ])) != 0 &&
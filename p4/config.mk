@@ -50,7 +50,8 @@ STUDENTTESTS += autostack sleep ls_test fault_and_die malloc_test
 STUDENTTESTS += agility_drill cvar_test cyclone join_specific_test
 STUDENTTESTS += juggle mandelbrot startle thr_exit_join racer evil_user
 STUDENTTESTS += mycho metacho zfod_test dividezero float swexn_sleepers
-STUDENTTESTS += thread_fail
+STUDENTTESTS += thread_fail nanos_test fpu_test top rt_test cow_test zfod_pages
+STUDENTTESTS += stack_grow fault_storm shm_test
 
 ###########################################################################
 # Object files for your thread library
@@ -74,6 +75,9 @@ SYSCALL_OBJS += wait.o task_vanish.o yield.o gettid.o deschedule.o make_runnable
 SYSCALL_OBJS += get_ticks.o new_pages.o remove_pages.o getchar.o readline.o
 SYSCALL_OBJS += set_term_color.o set_cursor_pos.o get_cursor_pos.o ls.o
 SYSCALL_OBJS += halt.o misbehave.o swexn.o
+SYSCALL_OBJS += get_nanos.o sleep_nanos.o futex_wait.o futex_wake.o
+SYSCALL_OBJS += sched_stats.o rt_reserve.o rt_next.o spawn.o
+SYSCALL_OBJS += shm_create.o shm_map.o kern_stats.o
 
 ###########################################################################
 # Parts of your kernel
@@ -89,20 +93,23 @@ SYSCALL_OBJS += halt.o misbehave.o swexn.o
 KCORE_OBJS = core/kernel.o core/loader.o 
 KCORE_OBJS += core/context_switch.o core/mode_switch.o core/process.o
 KCORE_OBJS += core/thread.o core/scheduler.o core/stub.o core/global.o
+KCORE_OBJS += core/fpu.o core/fpu_asm.o
 
 KDRIVER_OBJS = driver/console.o driver/keyboard.o driver/timer.o
 
 KUTIL_OBJS = util/mutex.o util/cond.o util/vstring.o util/asm_helper.o
-KUTIL_OBJS += util/hashtable.o util/heap.o util/debug.o util/atomic.o
-KUTIL_OBJS += util/malloc_wrappers.o
+KUTIL_OBJS += util/hashtable.o util/wheel.o util/debug.o util/atomic.o
+KUTIL_OBJS += util/malloc_wrappers.o util/rwlock.o
 
 KSYSCALL_OBJS = syscall/memman.o syscall/misc.o syscall/lifecycle.o 
-KSYSCALL_OBJS += syscall/threadman.o syscall/swexn.o
+KSYSCALL_OBJS += syscall/threadman.o syscall/swexn.o syscall/futex.o
+KSYSCALL_OBJS += syscall/shm.o
 
 KHANDLER_OBJS = handlers/handler.o handlers/handler_wrappers.o handlers/fault_handlers.o
 KHANDLER_OBJS += handlers/swexn_handler.o
 
 KMM_OBJS = mm/mm.o mm/kvm.o mm/mm_asm.o mm/region.o mm/pagefault.o 
+KMM_OBJS += mm/pagecache.o mm/frame.o mm/tlb.o
 
 KERNEL_OBJS = $(KCORE_OBJS) $(KDRIVER_OBJS) $(KUTIL_OBJS) 
 KERNEL_OBJS += $(KSYSCALL_OBJS) $(KMM_OBJS) $(KHANDLER_OBJS)
@@ -123,7 +130,7 @@ KERNEL_OBJS += $(KSYSCALL_OBJS) $(KMM_OBJS) $(KHANDLER_OBJS)
 # or init unless you are writing your own, and don't do that unless
 # you have a really good reason to do so.
 #
-410REQPROGS = idle init shell
+410REQPROGS = idle
 
 ###########################################################################
 # Mandatory programs whose source is provided by you
@@ -138,5 +145,5 @@ KERNEL_OBJS += $(KSYSCALL_OBJS) $(KMM_OBJS) $(KHANDLER_OBJS)
 # kernel in, or else your tweaked version will run and the test harness
 # won't.
 #
-STUDENTREQPROGS =
+STUDENTREQPROGS = init shell
 
@@ -0,0 +1,146 @@
+/** 
+* @file fpu.c
+* @brief Lazy saving and restoring of FPU and SSE state.
+*
+*  The FPU registers are only saved and restored when a thread actually 
+*  uses them. On every context switch we set CR0.TS unless the new thread
+*  already owns the FPU, so the first floating point or SSE instruction 
+*  another thread executes raises a device not available fault. The fault
+*  saves the owner's registers, loads the faulting thread's registers and
+*  makes it the owner. 
+*
+*  A thread gets its save area the first time it uses the FPU, so threads 
+*  that never use floating point never pay for it.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#include <fpu.h>
+#include <thread.h>
+#include <mutex.h>
+#include <malloc.h>
+#include <string.h>
+#include <ecodes.h>
+#include <cr.h>
+#include <assert.h>
+#include <debug.h>
+
+/** @brief The thread whose state is in the FPU registers, or NULL. */
+static tcb_t *fpu_owner = NULL;
+
+/** @brief A save area holding the initial FPU state, copied into every 
+ * new save area. */
+static char fpu_clean_state[FPU_STATE_SIZE] 
+   __attribute__((aligned(FPU_STATE_ALIGN)));
+
+/** 
+* @brief Enable the FPU and fxsave/fxrstor, and record the initial FPU
+*  state. Leaves CR0.TS set, so the first use of the FPU faults.
+*/
+void fpu_init()
+{
+   set_cr0((get_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+   set_cr4(get_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+   
+   fpu_clts();
+   fpu_reset();
+   fpu_save(fpu_clean_state);
+   set_cr0(get_cr0() | CR0_TS);
+}
+
+/** 
+* @brief Prepare the FPU for a context switch. The new thread can use the 
+*  FPU directly if it still owns it, and otherwise faults on first use.
+*  Interrupts must be disabled.
+*
+* @param tcb The thread we are switching to.
+*/
+void fpu_switch(tcb_t *tcb)
+{
+   uint32_t cr0 = get_cr0();
+   if (tcb == fpu_owner) {
+      if (cr0 & CR0_TS) fpu_clts();
+   }
+   else if (!(cr0 & CR0_TS)) {
+      set_cr0(cr0 | CR0_TS);
+   }
+}
+
+/** 
+* @brief Give the FPU to the invoking thread, after it faulted trying to 
+*  use it. Allocates the thread's save area on first use.
+*
+* @return ESUCCESS on success, 
+*         ENOMEM if we could not allocate a save area.
+*/
+int fpu_claim()
+{
+   tcb_t *tcb = get_tcb();
+
+   if (!tcb->fpu_state) {
+      void *state = smemalign(FPU_STATE_ALIGN, FPU_STATE_SIZE);
+      if (!state) return ENOMEM;
+      memcpy(state, fpu_clean_state, FPU_STATE_SIZE);
+      tcb->fpu_state = state;
+      debug_print("fpu", "Allocated fpu state %p for %p", state, tcb);
+   }
+
+   /* Nobody can take the FPU while we are swapping owners. */
+   quick_lock();
+   fpu_clts();
+   if (fpu_owner != tcb) {
+      if (fpu_owner) fpu_save(fpu_owner->fpu_state);
+      fpu_restore(tcb->fpu_state);
+      fpu_owner = tcb;
+   }
+   quick_unlock();
+   return ESUCCESS;
+}
+
+/** 
+* @brief Give a child the FPU state of its parent, for fork.
+*
+* @param parent The invoking thread.
+* @param child The new thread.
+*
+* @return ESUCCESS on success, 
+*         ENOMEM if we could not allocate a save area.
+*/
+int fpu_copy(tcb_t *parent, tcb_t *child)
+{
+   assert(parent == get_tcb());
+   if (!parent->fpu_state) return ESUCCESS;
+
+   child->fpu_state = smemalign(FPU_STATE_ALIGN, FPU_STATE_SIZE);
+   if (!child->fpu_state) return ENOMEM;
+
+   /* If we own the FPU, the live registers are newer than our save area.
+    * Since we own it, CR0.TS is clear. */
+   quick_lock();
+   if (fpu_owner == parent) fpu_save(parent->fpu_state);
+   quick_unlock();
+
+   memcpy(child->fpu_state, parent->fpu_state, FPU_STATE_SIZE);
+   return ESUCCESS;
+}
+
+/** 
+* @brief Throw away a thread's FPU state, when it dies or execs.
+*
+* @param tcb The thread.
+*/
+void fpu_release(tcb_t *tcb)
+{
+   quick_lock();
+   if (fpu_owner == tcb) {
+      fpu_owner = NULL;
+      set_cr0(get_cr0() | CR0_TS);
+   }
+   quick_unlock();
+
+   if (tcb->fpu_state) {
+      sfree(tcb->fpu_state, FPU_STATE_SIZE);
+      tcb->fpu_state = NULL;
+   }
+}
@@ -15,13 +15,15 @@
 #include <page.h>
 #include <lifecycle.h>
 #include <mutex.h>
+#include <rwlock.h>
+#include <scheduler.h>
 #include <cond.h>
 #include <mm.h>
 #include <types.h>
+#include <string.h>
 
 static pcb_t _global_pcb;
 static tcb_t* _global_tcb;
-static mutex_t _global_list_lock;
 
 /** 
 * @brief Initializes a global PCB that generally stands in
@@ -31,6 +33,7 @@ static mutex_t _global_list_lock;
 void global_thread_init()
 {
    void* kstack;
+   int i;
    /* Give the "global process" a pcb and tcb. */
    _global_pcb.pid = -1;
    _global_pcb.parent = NULL;
@@ -40,20 +43,20 @@ void global_thread_init()
    _global_pcb.vanishing = FALSE;
    _global_pcb.regions = NULL;
    mutex_init(&_global_pcb.directory_lock);
-   mutex_init(&_global_pcb.region_lock);
+   rwlock_init(&_global_pcb.region_lock);
+   rwlock_init(&_global_pcb.new_pages_lock);
    mutex_init(&_global_pcb.status_lock);
    mutex_init(&_global_pcb.waiter_lock);
    mutex_init(&_global_pcb.check_waiter_lock);
    mutex_init(&_global_pcb.child_lock);
    mutex_init(&_global_pcb.swexn_lock);
+   for(i = 0; i < PCB_TABLE_LOCKS; i++)
+      mutex_init(&_global_pcb.table_locks[i]);
    
    cond_init(&_global_pcb.wait_signal);
    cond_init(&_global_pcb.vanish_signal);
 
    _global_pcb.sanity_constant = PCB_SANITY_CONSTANT;
-
-   LIST_INIT_NONEMPTY(&_global_pcb, global_node);
-   mutex_init(&_global_list_lock);
    
    kstack = mm_new_kp_page() + PAGE_SIZE;
    assert(kstack - PAGE_SIZE != NULL);
@@ -64,7 +67,19 @@ void global_thread_init()
    _global_tcb->pcb = &_global_pcb;
    _global_tcb->tid = -1;
    _global_tcb->wakeup = 0;
-   _global_tcb->sleep_index = 0;
+   _global_tcb->sleep_slot = NULL;
+   _global_tcb->fpu_state = NULL;
+   _global_tcb->level = 0;
+   _global_tcb->quantum_used = 0;
+   _global_tcb->donated = SCHEDULER_LEVELS;
+   _global_tcb->blocked_on = NULL;
+   _global_tcb->held = NULL;
+   _global_tcb->last_region = NULL;
+   _global_tcb->rt_period = 0;
+   _global_tcb->rt_util = 0;
+   memset(&_global_tcb->times, 0, sizeof(sched_times_t));
+   _global_tcb->sched_state = SCHED_RUNNING;
+   _global_tcb->state_since = 0;
    _global_tcb->sanity_constant = TCB_SANITY_CONSTANT;
    _global_tcb->dir_p = _global_pcb.dir_p;
    cond_init(&_global_tcb->swexn_signal);
@@ -90,44 +105,3 @@ inline tcb_t* global_tcb() {
    return _global_tcb; 
 }
 
-/** 
-* @brief Return the global list lock - e.g. 
-*   the lock for the list in each PCB's global_node.
-* 
-* @return The lock.
-*/
-inline mutex_t* global_list_lock()
-{
-   return &_global_list_lock;
-}
-
-/** 
-* @brief Remove the PCB from the global list. 
-* 
-* @param pcb The PCB to remove. 
-*/
-void global_list_remove(pcb_t* pcb)
-{
-   pcb_t* global = &_global_pcb;
-   
-   mutex_lock(&_global_list_lock);
-   LIST_REMOVE(global, pcb, global_node); 
-   mutex_unlock(&_global_list_lock);
-}
-
-/** 
-* @brief Add a PCB to the global list. 
-* 
-* @param pcb The PCB to add.
-*/
-void global_list_add(pcb_t* pcb)
-{
-   pcb_t* global = &_global_pcb;
-   
-   mutex_lock(&_global_list_lock);
-   LIST_INSERT_AFTER(global, pcb, global_node); 
-   mutex_unlock(&_global_list_lock);
-}
-
-
-
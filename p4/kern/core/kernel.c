@@ -47,6 +47,10 @@
 #include <lifecycle.h>
 #include <mutex.h>
 #include <threadman.h>
+#include <fpu.h>
+#include <futex.h>
+#include <shm.h>
+#include <pagecache.h>
 
 /*
  * state for kernel memory allocation.
@@ -96,9 +100,13 @@ int kernel_main(mbinfo_t *mbinfo, int argc, char **argv, char **envp)
    scheduler_init();
    lifecycle_init();
    memman_init();
+   futex_init();
+   shm_init();
+   pagecache_init();
    thread_init();
    
    handler_install();
+   fpu_init();
    clear_console();
    
    mm_init();
@@ -37,6 +37,7 @@
 #include <mutex.h>
 #include <macros.h>
 #include <pagefault.h>
+#include <common_kern.h>
 
 /**
  * Copies data from a file into a buffer.
@@ -141,71 +142,131 @@ static void initialize_region(const char *file, unsigned long offset,
    memset((char *)start + len, 0, end - start - len);
 }
 
+/**
+ * @brief Copy the part of one section that lies in [start, end) into dst.
+ *
+ * @param file The executable to read from.
+ * @param offset The offset of the section in the file.
+ * @param sec_start The virtual address of the section.
+ * @param sec_len The length of the section in bytes.
+ * @param dst The buffer that holds [start, end).
+ * @param start The first virtual address in dst.
+ * @param end The virtual address after the last in dst.
+ */
+static void copy_section(const char *file, unsigned long offset, 
+      unsigned long sec_start, unsigned long sec_len, char *dst, 
+      unsigned long start, unsigned long end)
+{
+   unsigned long lo = (start > sec_start) ? start : sec_start;
+   unsigned long hi = (end < sec_start + sec_len) ? end : sec_start + sec_len;
+   
+   if(lo < hi)
+      getbytes(file, offset + (lo - sec_start), hi - lo, dst + (lo - start));
+}
+
+/**
+ * @brief Read the text and rodata of an executable that lie in the virtual
+ * range [start, end) into dst. Bytes in neither section are zeroed.
+ *
+ * @param elf The elf header of the executable.
+ * @param dst The buffer to fill, of end - start bytes.
+ * @param start The first virtual address to read.
+ * @param end The virtual address after the last to read.
+ */
+void read_text_range(const simple_elf_t *elf, char *dst, 
+      unsigned long start, unsigned long end)
+{
+   memset(dst, 0, end - start);
+   copy_section(elf->e_fname, elf->e_txtoff, elf->e_txtstart, 
+      elf->e_txtlen, dst, start, end);
+   copy_section(elf->e_fname, elf->e_rodatoff, elf->e_rodatstart, 
+      elf->e_rodatlen, dst, start, end);
+}
+
 /**
  * @brief Initialize memory for a user with the appropriate contents.
  *
  * @param file The executable to initialize from.
- * @param elf An elf header for the executable.
+ * @param elf An elf header for the executable, checked by get_elf.
  * @param pcb The pcb of the process.
  *
- * @return ESUCCESS if initialization was successful, EFAIL otherwise.
+ * @return ESUCCESS if initialization was successful, ENOVM or ENOMEM if 
+ *  the kernel ran out of memory.
  */
 int initialize_memory(const char *file, simple_elf_t elf, pcb_t* pcb) 
 {
-   // Allocate text region. 
-   if(allocate_region(
+   int err;
+
+   /* Allocate data region first, so that a page it shares with rodata is
+    *  framed and writable. */
+   if((err = allocate_region(
+         (char*)elf.e_datstart, (char*)elf.e_datstart + elf.e_datlen,
+         PTENT_RW | PTENT_USER,  dat_fault, pcb)) < 0) 
+      goto fail_init_mem;
+   
+   /* Allocate text and rodata regions. Their pages are read in from the 
+    *  page cache by txt_fault and rodata_fault on first access. */
+   if((err = allocate_region(
          (char*)elf.e_txtstart, (char *)elf.e_txtstart + elf.e_txtlen, 
-         PTENT_RO | PTENT_USER, txt_fault, pcb) < 0) 
+         PTENT_RO | PTENT_USER | PTENT_FILE, txt_fault, pcb)) < 0) 
       goto fail_init_mem;
       
-   // Allocate rodata region.
-   if(allocate_region(
+   if((err = allocate_region(
          (char*)elf.e_rodatstart, (char *)elf.e_rodatstart + elf.e_rodatlen, 
-         PTENT_RO | PTENT_USER, rodata_fault, pcb) < 0) 
+         PTENT_RO | PTENT_USER | PTENT_FILE, rodata_fault, pcb)) < 0) 
       goto fail_init_mem;
    
-   // Allocate data region.
-   if(allocate_region(
-         (char*)elf.e_datstart, (char*)elf.e_datstart + elf.e_datlen,
-         PTENT_RW | PTENT_USER,  dat_fault, pcb) < 0) 
+   /* Allocate bss region, with the bounds the section headers give. Any
+    *  page it shares with data is framed already, and the rest are zero 
+    *  filled on demand. */
+   if(elf.e_bsslen > 0 && (err = allocate_region(
+         (char*)elf.e_bssstart, (char*)elf.e_bssstart + elf.e_bsslen, 
+         PTENT_RW | PTENT_USER | PTENT_ZFOD, bss_fault, pcb)) < 0) 
       goto fail_init_mem;
    
-   /* Allocate bss region. Despite what the spec says, this is not the
-       very next byte after the dat section. It must be aligned... 
-       It is not always 32 byte aligned as in mandelbrot, 
-       Or 4 byte aligned as in cho_variant...
-   
-       Since we want to pass both of these tests. Our only recourse
-        is to turn ZFOD off.  Frowny. Face. 
-    */
-
-   char *bss_start = (char*)(elf.e_datstart + elf.e_datlen);
-   if(allocate_region(
-         bss_start, bss_start + elf.e_bsslen, 
-         PTENT_RW | PTENT_USER /*| PTENT_ZFOD*/, bss_fault, pcb) < 0) 
+   /* Frame the top of the stack, where we copy the arguments. */
+   if((err = mm_alloc(pcb, (char*)USER_STACK_BASE - PAGE_SIZE, PAGE_SIZE, 
+         PTENT_RW | PTENT_USER)) < 0)
       goto fail_init_mem;
       
-   // Allocate stack region (same for all processes).
-   if(allocate_region(
-      USER_STACK_BASE - PAGE_SIZE, USER_STACK_BASE, 
-      PTENT_RW | PTENT_USER, stack_fault, pcb) < 0)
+   // Allocate stack region (same for all processes), which grows on fault.
+   if((err = allocate_stack_region(pcb)) < 0)
       goto fail_init_mem;
-      
-   initialize_region(file, elf.e_txtoff, elf.e_txtlen, 
-      elf.e_txtstart, elf.e_rodatstart);
-      
-   initialize_region(file, elf.e_rodatoff, elf.e_rodatlen, 
-      elf.e_rodatstart, elf.e_datstart);
    
+   pcb->elf = elf;
+   
+   /* New frames are zeroed, so bss needs nothing, and we must not write 
+    *  through to the ZFOD frame. */
    initialize_region(file, elf.e_datoff, elf.e_datlen, elf.e_datstart, 
-      elf.e_datstart + elf.e_datlen + elf.e_bsslen);
+      elf.e_datstart + elf.e_datlen);
+
+   /* Text or rodata on the first page of data was framed along with it. */
+   if(PAGE_OFFSET(elf.e_datstart) != 0)
+      read_text_range(&elf, (char*)PAGE_OF(elf.e_datstart), 
+         PAGE_OF(elf.e_datstart), elf.e_datstart);
          
    return ESUCCESS;
 
 fail_init_mem:
    free_region_list(pcb);
    mm_free_user_space(pcb);
-   return EFAIL;
+   return err;
+}
+
+/**
+ * @brief Checks that a section of an executable lies in user memory, below
+ *  the top page of the stack.
+ *
+ * @param start The address of the section.
+ * @param len The length of the section.
+ *
+ * @return True if the section fits.
+ */
+static boolean_t section_fits(unsigned long start, unsigned long len)
+{
+   unsigned long top = USER_STACK_BASE - PAGE_SIZE;
+   return len == 0 || 
+      (start >= USER_MEM_START && start < top && len <= top - start);
 }
 
 /** 
@@ -214,15 +275,35 @@ fail_init_mem:
 * @param exec The name of the executable. 
 * @param elf_hdr The returned elf header. 
 * 
-* @return A negative integer on error, zero on success. 
+* @return A negative integer on error, zero on success. EFAIL if a 
+*  section of the executable does not fit in user memory.
 */
 int get_elf(char *exec, simple_elf_t *elf_hdr) {
-   int err;
+   int i, err;
    if ((err = elf_check_header(exec)) != ELF_SUCCESS) {
       return err;
    }
 
-   return elf_load_helper(elf_hdr, exec);
+   if ((err = elf_load_helper(elf_hdr, exec)) != ELF_SUCCESS) {
+      return err;
+   }
+
+   if (!section_fits(elf_hdr->e_txtstart, elf_hdr->e_txtlen) ||
+         !section_fits(elf_hdr->e_datstart, elf_hdr->e_datlen) ||
+         !section_fits(elf_hdr->e_rodatstart, elf_hdr->e_rodatlen) ||
+         !section_fits(elf_hdr->e_bssstart, elf_hdr->e_bsslen)) {
+      return EFAIL;
+   }
+
+   /* Name the executable by its table of contents entry, which outlives 
+    *  exec's copy of the name and identifies it in the page cache. */
+   for (i = 0; i < exec2obj_userapp_count; i++) {
+      if (strcmp(exec2obj_userapp_TOC[i].execname, exec) == 0) {
+         elf_hdr->e_fname = exec2obj_userapp_TOC[i].execname;
+         break;
+      }
+   }
+   return ELF_SUCCESS;
 }
 
 
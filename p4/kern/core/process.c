@@ -14,8 +14,10 @@
 #include <atomic.h>
 #include <page.h>
 #include <region.h>
+#include <shm.h>
 #include <thread.h>
 #include <mutex.h>
+#include <rwlock.h>
 #include <global_thread.h>
 #include <cond.h>
 #include <kvm.h>
@@ -42,21 +44,25 @@ pcb_t *init_process;
 */
 void free_process_resources(pcb_t* pcb, boolean_t vanishing)
 {
+   int i;
    assert(pcb);
    assert(pcb->thread_count == 0);
    assert(pcb->sanity_constant == PCB_SANITY_CONSTANT);
    
    free_region_list(pcb);
+   shm_release(pcb);
    mm_free_address_space(pcb);
    
    mutex_destroy(&pcb->directory_lock);
-   mutex_destroy(&pcb->region_lock);
+   rwlock_destroy(&pcb->region_lock);
    mutex_destroy(&pcb->status_lock);
    mutex_destroy(&pcb->waiter_lock);
    mutex_destroy(&pcb->check_waiter_lock);
    mutex_destroy(&pcb->child_lock);
    mutex_destroy(&pcb->swexn_lock);
-   mutex_destroy(&pcb->new_pages_lock);
+   rwlock_destroy(&pcb->new_pages_lock);
+   for(i = 0; i < PCB_TABLE_LOCKS; i++)
+      mutex_destroy(&pcb->table_locks[i]);
    cond_destroy(&pcb->wait_signal);
    cond_destroy(&pcb->vanish_signal);
    sfree(pcb, sizeof(pcb_t));
@@ -90,13 +96,13 @@ pcb_t* get_pcb()
 pcb_t* initialize_process(boolean_t first_process) 
 {
    pcb_t* pcb;
+   int i;
    
    if((pcb = (pcb_t*) scalloc(1, sizeof(pcb_t))) < 0) 
       goto fail_pcb;
 
    LIST_INIT_EMPTY(pcb->children);
    LIST_INIT_EMPTY(pcb->swexn_list);
-   LIST_INIT_NODE(pcb, global_node);
    LIST_INIT_NODE(pcb, child_node);
    
    if(kvm_new_directory(pcb) < 0) 
@@ -126,13 +132,15 @@ pcb_t* initialize_process(boolean_t first_process)
    pcb->sanity_constant = PCB_SANITY_CONSTANT;
    
    mutex_init(&pcb->directory_lock);
-   mutex_init(&pcb->region_lock);
+   rwlock_init(&pcb->region_lock);
    mutex_init(&pcb->status_lock);
    mutex_init(&pcb->waiter_lock);
    mutex_init(&pcb->check_waiter_lock);
    mutex_init(&pcb->child_lock);
    mutex_init(&pcb->swexn_lock);
-   mutex_init(&pcb->new_pages_lock);
+   rwlock_init(&pcb->new_pages_lock);
+   for(i = 0; i < PCB_TABLE_LOCKS; i++)
+      mutex_init(&pcb->table_locks[i]);
 
    cond_init(&pcb->wait_signal);
    cond_init(&pcb->vanish_signal);
@@ -15,22 +15,57 @@
 #include <timer.h>
 #include <loader.h>
 #include <string.h>
-#include <heap.h>
+#include <wheel.h>
+#include <fpu.h>
 #include <global_thread.h>
 #include <debug.h>
 #include <mutex.h>
 #include <lifecycle.h>
 #include <malloc.h>
 #include <ecodes.h>
+#include <asm.h>
+#include <stdint.h>
 
 #define INIT_PROGRAM "init"
 
 /**
- * @brief Circular queue of runnable threads. 
- *  Always points to a runnable thread if there is one, often but not
- *  always our current thread. 
+ * @brief Multi-level feedback queue of runnable threads, one circular 
+ *  queue per priority level with level 0 the highest priority. 
+ *
+ *  Each queue points at the thread that will run last at that level, 
+ *  which is usually the thread that ran most recently, so the next thread
+ *  to run at a level is always LIST_NEXT of the queue pointer. 
  */
-static tcb_t *runnable = NULL;
+static tcb_t *runnable[SCHEDULER_LEVELS];
+
+/**
+ * @brief Runnable real time threads in order of deadline, earliest first.
+ *    They run ahead of every best effort level.
+ */
+static tcb_t *rt_ready = NULL;
+
+/** @brief The total utilization of admitted real time threads, in units 
+ * of 1/SCHEDULER_RT_SCALE. */
+static unsigned long rt_total = 0;
+
+/** @brief The number of runnable threads in each level of the queue. */
+static int level_count[SCHEDULER_LEVELS];
+
+/** @brief The time of the last priority boost. */
+static unsigned long last_boost = 0;
+
+/** @brief The number of switches in a row that ran a sibling of the
+ * previous thread ahead of its turn. */
+static int sibling_streak = 0;
+
+/** @brief Context switch cost counters. */
+static switch_stats_t switch_stats;
+
+/** @brief The TSC when the last context switch started. */
+static uint64_t switch_start;
+
+/** @brief True iff the next context switch is a preemption by the timer. */
+static boolean_t preempting = FALSE;
 
 /**
  * @brief Circular queue of descheduled threads.
@@ -42,15 +77,9 @@ static tcb_t *runnable = NULL;
 static tcb_t *descheduled = NULL;
 
 /** 
-* @brief A min-heap keying on the time the sleeper will run next.
+* @brief A timing wheel keying on the time the sleeper will run next.
 */
-static sleep_heap_t sleepers;
-
-/**
- * @brief A mutual exclusion lock ensuring that only one thread at a time
- * tries to double the size of the sleep heap.
- */
-static mutex_t sleep_double_lock;
+static timer_wheel_t sleepers;
 
 /**
  * @brief The number of blocked_threads.
@@ -58,15 +87,311 @@ static mutex_t sleep_double_lock;
 static int blocked_count = 0;
 
 static void scheduler_switch(tcb_t *old_tcb, tcb_t *new_tcb);
+static int runqueue_level(tcb_t *tcb);
+static void rt_insert(tcb_t *tcb, boolean_t front);
+static void scheduler_park(tcb_t *tcb, unsigned long wakeup, long ticks);
+static void scheduler_throttle(tcb_t *tcb);
+static void runqueue_insert(tcb_t *tcb, boolean_t front);
+static void runqueue_remove(tcb_t *tcb);
+static int runqueue_top(void);
+static void scheduler_promote(tcb_t *tcb);
+static void scheduler_boost(void);
+static void scheduler_wake(unsigned long time);
+static tcb_t *scheduler_pick(tcb_t *tcb, int level);
+static void scheduler_account(tcb_t *tcb, int state, uint64_t now);
 
 /** 
 * @brief Initialize the scheduler.
 */
 void scheduler_init()
 {
-   heap_init(&sleepers);
-   mutex_init(&sleep_double_lock);
-   LIST_INIT_EMPTY(runnable);   
+   int level;
+   wheel_init(&sleepers, get_time());
+   for (level = 0; level < SCHEDULER_LEVELS; level++) {
+      LIST_INIT_EMPTY(runnable[level]);
+      level_count[level] = 0;
+   }
+   memset(&switch_stats, 0, sizeof(switch_stats_t));
+}
+
+/**
+ * @brief Get the level a thread is queued at, which is the higher of its 
+ *    own level and any priority donated to it.
+ *
+ * @param tcb The thread.
+ *
+ * @return The thread's effective priority level.
+ */
+static int runqueue_level(tcb_t *tcb)
+{
+   return tcb->donated < tcb->level ? tcb->donated : tcb->level;
+}
+
+/**
+ * @brief Add a real time thread to the deadline ordered queue. If its 
+ *    period has ended since it last ran, it is released first: its budget
+ *    is replenished and its deadline moves to the end of the current 
+ *    period. Interrupts must be disabled.
+ *
+ * @param tcb The real time thread to add.
+ * @param front True if the thread should run ahead of threads with the
+ * same deadline.
+ */
+static void rt_insert(tcb_t *tcb, boolean_t front)
+{
+   unsigned long now = get_time();
+   tcb_t *iter;
+
+   if ((long)(now - tcb->rt_deadline) >= 0) {
+      do {
+         tcb->rt_deadline += tcb->rt_period;
+      } while ((long)(now - tcb->rt_deadline) >= 0);
+      tcb->rt_used = 0;
+   }
+
+   LIST_FORALL(rt_ready, iter, scheduler_node) {
+      long diff = (long)(tcb->rt_deadline - iter->rt_deadline);
+      if (diff < 0 || (diff == 0 && front)) break;
+   }
+   if (iter == NULL) {
+      LIST_INSERT_BEFORE(rt_ready, tcb, scheduler_node);
+   }
+   else {
+      LIST_INSERT_BEFORE(iter, tcb, scheduler_node);
+      if (iter == rt_ready) rt_ready = tcb;
+   }
+}
+
+/**
+ * @brief Add a thread to the queue for its priority level. 
+ *    Interrupts must be disabled.
+ *
+ * @param tcb The thread to add.
+ * @param front True if the thread should run next at its level, false if
+ * it should run after every other thread at its level.
+ */
+static void runqueue_insert(tcb_t *tcb, boolean_t front)
+{
+   quick_assert_locked();
+   int level = runqueue_level(tcb);
+   if (tcb->rt_period) {
+      rt_insert(tcb, front);
+      return;
+   }
+   LIST_INSERT_AFTER(runnable[level], tcb, scheduler_node);
+   if (!front) {
+      runnable[level] = tcb;
+   }
+   level_count[level]++;
+}
+
+/**
+ * @brief Remove a thread from the queue for its priority level. If the
+ *    thread was last in line, the thread before it becomes last, so the
+ *    rotation order of the rest of the level is preserved.
+ *    Interrupts must be disabled.
+ *
+ * @param tcb The thread to remove.
+ */
+static void runqueue_remove(tcb_t *tcb)
+{
+   quick_assert_locked();
+   int level = runqueue_level(tcb);
+   if (!LIST_CONTAINS(tcb, scheduler_node)) return;
+   if (tcb->rt_period) {
+      LIST_REMOVE(rt_ready, tcb, scheduler_node);
+      return;
+   }
+   if (runnable[level] == tcb) {
+      runnable[level] = LIST_PREV(tcb, scheduler_node);
+   }
+   LIST_REMOVE(runnable[level], tcb, scheduler_node);
+   level_count[level]--;
+}
+
+/**
+ * @brief Find the highest priority level with a runnable thread.
+ *
+ * @return SCHEDULER_RT_LEVEL if a real time thread is runnable, otherwise
+ * the highest non-empty level, or SCHEDULER_LEVELS if no thread is 
+ * runnable.
+ */
+static int runqueue_top()
+{
+   int level;
+   if (rt_ready) return SCHEDULER_RT_LEVEL;
+   for (level = 0; level < SCHEDULER_LEVELS; level++) {
+      if (runnable[level]) break;
+   }
+   return level;
+}
+
+/**
+ * @brief Raise the priority of a thread that gave up the processor before 
+ *    using its whole quantum. The thread must not be in the run queue.
+ *
+ * @param tcb The thread to promote.
+ */
+static void scheduler_promote(tcb_t *tcb)
+{
+   assert(!LIST_CONTAINS(tcb, scheduler_node));
+   if (tcb->level > 0) tcb->level--;
+   tcb->quantum_used = 0;
+}
+
+/**
+ * @brief Move every runnable thread to the highest priority level, so 
+ *    that threads demoted by a CPU bound burst can not starve.
+ */
+static void scheduler_boost()
+{
+   int level;
+   tcb_t *tcb;
+   debug_print("scheduler", "Boosting all runnable threads");
+   for (level = 1; level < SCHEDULER_LEVELS; level++) {
+      while (runnable[level]) {
+         tcb = LIST_NEXT(runnable[level], scheduler_node);
+         runqueue_remove(tcb);
+         tcb->level = 0;
+         tcb->quantum_used = 0;
+         runqueue_insert(tcb, FALSE);
+      }
+   }
+}
+
+/**
+ * @brief Get the times of a thread's process.
+ *
+ * @param tcb The thread.
+ *
+ * @return The process's times, or NULL if the thread has outlived its
+ *    process.
+ */
+static sched_times_t *process_times(tcb_t *tcb)
+{
+   if (tcb->pcb == global_pcb() && tcb != global_tcb()) return NULL;
+   return &tcb->pcb->times;
+}
+
+/**
+ * @brief Charge the time a thread spent in its current state to that 
+ *    state, for both the thread and its process, and move it to a new 
+ *    state. Interrupts must be disabled.
+ *
+ * @param tcb The thread changing state.
+ * @param state The state it is entering.
+ * @param now The current time in nanoseconds.
+ */
+static void scheduler_account(tcb_t *tcb, int state, uint64_t now)
+{
+   uint64_t elapsed = now - tcb->state_since;
+   sched_times_t *times = &tcb->times;
+   sched_times_t *ptimes = process_times(tcb);
+
+   switch (tcb->sched_state) {
+      case SCHED_RUNNING:
+         times->run_ns += elapsed;
+         if (ptimes) ptimes->run_ns += elapsed;
+         break;
+      case SCHED_READY:
+         times->ready_ns += elapsed;
+         if (ptimes) ptimes->ready_ns += elapsed;
+         break;
+      case SCHED_BLOCKED:
+         times->blocked_ns += elapsed;
+         if (ptimes) ptimes->blocked_ns += elapsed;
+         break;
+      case SCHED_SLEEPING:
+         times->sleep_ns += elapsed;
+         if (ptimes) ptimes->sleep_ns += elapsed;
+         break;
+   }
+   tcb->sched_state = state;
+   tcb->state_since = now;
+}
+
+/**
+ * @brief Charge the time the last thread of a process has spent in its 
+ *    current state to the process, and move the thread to the global pcb 
+ *    so that the process can be freed. Its time from here on is charged 
+ *    to the thread alone.
+ *
+ * @param tcb The vanishing thread.
+ */
+void scheduler_orphan(tcb_t *tcb)
+{
+   quick_lock();
+   scheduler_account(tcb, tcb->sched_state, timer_nanos());
+   tcb->pcb = global_pcb();
+   quick_unlock();
+}
+
+/**
+ * @brief Get a thread's scheduling statistics, charging the time it has
+ *    spent in its current state so far.
+ *
+ * @param tcb The thread to query. The caller must prevent it from exiting.
+ * @param stats The record to fill in.
+ */
+void scheduler_thread_stats(tcb_t *tcb, sched_stats_t *stats)
+{
+   quick_lock();
+   scheduler_account(tcb, tcb->sched_state, timer_nanos());
+   stats->tid = tcb->tid;
+   stats->pid = tcb->pcb->pid;
+   stats->level = runqueue_level(tcb);
+   stats->state = tcb->sched_state;
+   memcpy(&stats->thread, &tcb->times, sizeof(sched_times_t));
+   memcpy(&stats->process, &tcb->pcb->times, sizeof(sched_times_t));
+   quick_unlock();
+}
+
+/**
+ * @brief Get the number of runnable threads at a given priority level.
+ *
+ * @param level The level to query.
+ *
+ * @return The number of threads in the queue for level, or EARGS if level
+ * is not a valid level.
+ */
+int scheduler_level_count(int level)
+{
+   if (level < 0 || level >= SCHEDULER_LEVELS) return EARGS;
+   return level_count[level];
+}
+
+/**
+ * @brief Get the priority level a thread is currently scheduled at,
+ *    including any priority donated to it.
+ *
+ * @param tcb The thread to query.
+ *
+ * @return The thread's effective level, 0 being the highest.
+ */
+int scheduler_priority(tcb_t *tcb)
+{
+   /* Real time threads donate the highest best effort level. */
+   return tcb->rt_period ? 0 : runqueue_level(tcb);
+}
+
+/**
+ * @brief Set the priority donated to a thread by the waiters on its 
+ *    mutexes, moving it to its new effective level if it is runnable. 
+ *    Interrupts must be disabled.
+ *
+ * @param tcb The thread receiving (or losing) the donation.
+ * @param level The donated level, or SCHEDULER_LEVELS to clear it.
+ */
+void scheduler_donate(tcb_t *tcb, int level)
+{
+   quick_assert_locked();
+   int old_level = runqueue_level(tcb);
+   boolean_t queued = LIST_CONTAINS(tcb, scheduler_node) && !tcb->blocked 
+      && !tcb->descheduled && tcb->wakeup == 0;
+
+   if (queued) runqueue_remove(tcb);
+   tcb->donated = level;
+   if (queued) runqueue_insert(tcb, runqueue_level(tcb) < old_level);
 }
 
 /**
@@ -81,7 +406,11 @@ void scheduler_register(tcb_t* tcb)
          tcb, tcb->tid);
    
    quick_lock();
-   LIST_INSERT_BEFORE(runnable, tcb, scheduler_node);
+   tcb->level = 0;
+   tcb->quantum_used = 0;
+   tcb->sched_state = SCHED_READY;
+   tcb->state_since = timer_nanos();
+   runqueue_insert(tcb, FALSE);
    quick_unlock();
 }
 
@@ -99,14 +428,17 @@ boolean_t scheduler_run(tcb_t* tcb, mutex_t *lock)
 {
    quick_lock();
    mutex_unlock(lock);
-   if (tcb->descheduled || tcb->blocked)
+   if (tcb->descheduled || tcb->blocked || tcb->wakeup != 0)
    {
       quick_unlock();
       return FALSE;
    }
-   LIST_REMOVE(runnable, tcb, scheduler_node);
-   LIST_INSERT_AFTER(runnable, tcb, scheduler_node);
-   scheduler_next();
+
+   /* Run the target directly, regardless of its level, and make it last
+    * in line at its level afterwards. */
+   runqueue_remove(tcb);
+   runqueue_insert(tcb, FALSE);
+   scheduler_switch(get_tcb(), tcb);
    return TRUE;
 }
 
@@ -123,7 +455,9 @@ void scheduler_block()
    debug_print("scheduler", "Blocking myself, thread %p", tcb);
    blocked_count++;
    tcb->blocked = TRUE;
-   LIST_REMOVE(runnable, tcb, scheduler_node);
+   scheduler_account(tcb, SCHED_BLOCKED, timer_nanos());
+   runqueue_remove(tcb);
+   scheduler_promote(tcb);
    scheduler_next();
 }
 
@@ -141,7 +475,8 @@ void scheduler_unblock(tcb_t* tcb)
    blocked_count--;
    tcb->blocked = FALSE;
    if (!tcb->descheduled && tcb->wakeup == 0) {
-      LIST_INSERT_AFTER(runnable, tcb, scheduler_node);
+      scheduler_account(tcb, SCHED_READY, timer_nanos());
+      runqueue_insert(tcb, TRUE);
    }
    quick_unlock();
 }
@@ -161,7 +496,9 @@ void scheduler_deschedule(mutex_t *lock)
    mutex_unlock(lock);
    assert(!tcb->descheduled);
    tcb->descheduled = TRUE;
-   LIST_REMOVE(runnable, tcb, scheduler_node);
+   scheduler_account(tcb, SCHED_BLOCKED, timer_nanos());
+   runqueue_remove(tcb);
+   scheduler_promote(tcb);
    scheduler_next();
 }
 
@@ -181,7 +518,8 @@ boolean_t scheduler_reschedule(tcb_t *tcb)
       tcb->descheduled = FALSE;
       debug_print("make_runnable", "Marking %p not descheduled", tcb);
       if (!tcb->blocked && tcb->wakeup == 0) {
-         LIST_INSERT_BEFORE(runnable, tcb, scheduler_node);
+         scheduler_account(tcb, SCHED_READY, timer_nanos());
+         runqueue_insert(tcb, FALSE);
          debug_print("make_runnable", "Adding %p to scheduler", tcb);
       }
       quick_unlock();
@@ -204,7 +542,8 @@ void scheduler_die(mutex_t *lock)
    debug_print("scheduler", "Dying %p", tcb);
    quick_lock();
    mutex_unlock(lock);
-   LIST_REMOVE(runnable, tcb, scheduler_node);
+   runqueue_remove(tcb);
+   rt_total -= tcb->rt_util;
    scheduler_next();
    assert(FALSE);
 }
@@ -217,45 +556,235 @@ void scheduler_die(mutex_t *lock)
  */
 static void scheduler_switch(tcb_t *old_tcb, tcb_t *new_tcb)
 {
+   uint64_t now;
+   sched_times_t *ptimes;
    debug_print("scheduler", "Now running thread %p", new_tcb);
+   
+   if (old_tcb != new_tcb) {
+      /* If we are still running we were preempted or yielded, otherwise
+       * we blocked, slept or descheduled ourselves. */
+      now = timer_nanos();
+      if (old_tcb->sched_state == SCHED_RUNNING) 
+         scheduler_account(old_tcb, SCHED_READY, now);
+      ptimes = process_times(old_tcb);
+      if (preempting) {
+         old_tcb->times.involuntary++;
+         if (ptimes) ptimes->involuntary++;
+      }
+      else {
+         old_tcb->times.voluntary++;
+         if (ptimes) ptimes->voluntary++;
+      }
+      scheduler_account(new_tcb, SCHED_RUNNING, now);
+   }
+   preempting = FALSE;
+
    set_esp0((int)new_tcb->kstack);
    assert(new_tcb->dir_p);
+   
+   switch_stats.switches++;
+   if (get_cr3() == (uint32_t)new_tcb->dir_p)
+      switch_stats.cr3_skips++;
+   else
+      switch_stats.cr3_loads++;
+   
+   fpu_switch(new_tcb);
    quick_fake_unlock();
+   switch_start = rdtsc();
    context_switch(&old_tcb->esp, &new_tcb->esp, new_tcb->dir_p);
+   
+   /* Whoever switched to us stamped switch_start, and interrupts are still
+    * disabled. */
+   switch_stats.cycles += rdtsc() - switch_start;
+   switch_stats.timed++;
    quick_unlock_all();
 }
 
 /**
- * @brief Switch to the next thread in the runnable queue.
+ * @brief Get a copy of the context switch cost counters.
+ *
+ * @param stats The structure to copy the counters into.
+ */
+void scheduler_switch_stats(switch_stats_t *stats)
+{
+   quick_lock();
+   memcpy(stats, &switch_stats, sizeof(switch_stats_t));
+   quick_unlock();
+}
+
+/**
+ * @brief Choose the next thread to run from the given level. 
+ *
+ *    The next thread in line is preferred, unless a sibling of the 
+ *    previous thread is waiting a little further back in the same level. 
+ *    Running the sibling first avoids reloading %cr3 and flushing the TLB.
+ *    At most SCHEDULER_SIBLING_STREAK siblings are run ahead of their turn 
+ *    in a row, so other processes are only ever delayed by a few slots.
+ *
+ * @param tcb The thread that is giving up the processor.
+ * @param level A non-empty level of the run queue.
+ *
+ * @return The thread to run next, which is now first in line at level.
+ */
+static tcb_t *scheduler_pick(tcb_t *tcb, int level)
+{
+   tcb_t *next = LIST_NEXT(runnable[level], scheduler_node);
+   tcb_t *sibling = next;
+   int i;
+
+   if (next->pcb != tcb->pcb && tcb != global_tcb() && 
+         sibling_streak < SCHEDULER_SIBLING_STREAK) {
+      for (i = 0; i < SCHEDULER_SIBLING_SCAN; i++) {
+         sibling = LIST_NEXT(sibling, scheduler_node);
+         if (sibling == next) break;
+         if (sibling->pcb == tcb->pcb && sibling != tcb) {
+            /* Move the sibling to the front of the line. */
+            runqueue_remove(sibling);
+            runqueue_insert(sibling, TRUE);
+            switch_stats.sibling_picks++;
+            sibling_streak++;
+            return sibling;
+         }
+      }
+   }
+
+   if (next->pcb != tcb->pcb) sibling_streak = 0;
+   return next;
+}
+
+/**
+ * @brief Wake every sleeper whose wakeup time has passed, and make them the
+ *    next threads to run at their levels.
+ *
+ * @param time The current time in ticks.
+ */
+static void scheduler_wake(unsigned long time)
+{
+   tcb_t *expired = wheel_expire(&sleepers, time); 
+   tcb_t *sleeper;
+   sched_times_t *ptimes;
+   uint64_t now;
+   
+   if (expired == NULL) return;
+   now = timer_nanos();
+   while ((sleeper = expired) != NULL)
+   {
+      debug_print("sleep", "Waking tcb %p", sleeper);
+      LIST_REMOVE(expired, sleeper, scheduler_node);
+      sleeper->wakeup = 0;
+      scheduler_account(sleeper, SCHED_READY, now);
+      ptimes = process_times(sleeper);
+      sleeper->times.wakeups++;
+      if (ptimes) ptimes->wakeups++;
+      if (now > sleeper->sleep_deadline) {
+         sleeper->times.overshoot_ns += now - sleeper->sleep_deadline;
+         if (ptimes) ptimes->overshoot_ns += now - sleeper->sleep_deadline;
+      }
+      runqueue_insert(sleeper, TRUE);
+   }
+}
+
+/**
+ * @brief Charge the running thread for a timer tick. 
+ *
+ *    A thread that uses its whole quantum is demoted one level, and every
+ *    SCHEDULER_BOOST_TICKS all runnable threads are boosted back to the 
+ *    top level. The running thread is only preempted when its quantum 
+ *    expires or a higher priority thread becomes runnable.
+ *    This function should never be called with interrupts enabled.
+ */
+void scheduler_tick()
+{
+   quick_assert_locked();
+   tcb_t *tcb = get_tcb();
+   unsigned long now = get_time();
+   int level;
+
+   scheduler_wake(now);
+   
+   if (now - last_boost >= SCHEDULER_BOOST_TICKS) {
+      last_boost = now;
+      scheduler_boost();
+   }
+
+   /* Charge real time threads against their budget, and throttle them 
+    * until their next release once it runs out. They are preempted only
+    * by an earlier deadline. */
+   if (tcb->rt_period && tcb != global_tcb() && 
+         LIST_CONTAINS(tcb, scheduler_node)) {
+      if (++tcb->rt_used >= tcb->rt_budget) {
+         scheduler_throttle(tcb);
+         preempting = TRUE;
+         scheduler_next();
+      }
+      else if (rt_ready != tcb) {
+         preempting = TRUE;
+         scheduler_next();
+      }
+      else {
+         quick_unlock();
+      }
+      return;
+   }
+
+   /* Until the first thread is registered we are not running on a 
+    * kernel stack with a tcb, and the global thread is never queued. */
+   level = runqueue_top();
+   if (level == SCHEDULER_LEVELS || tcb == global_tcb() || 
+         !LIST_CONTAINS(tcb, scheduler_node)) {
+      scheduler_next();
+      return;
+   }
+
+   if (++tcb->quantum_used >= SCHEDULER_QUANTUM(tcb->level)) {
+      tcb->quantum_used = 0;
+      if (tcb->level < SCHEDULER_LEVELS - 1) {
+         runqueue_remove(tcb);
+         tcb->level++;
+         runqueue_insert(tcb, FALSE);
+      }
+      preempting = TRUE;
+      scheduler_next();
+   }
+   else if (level < runqueue_level(tcb)) {
+      preempting = TRUE;
+      scheduler_next();
+   }
+   else {
+      quick_unlock();
+   }
+}
+
+/**
+ * @brief Switch to the next thread at the highest non-empty level of the 
+ *    run queue.
  *    This function should never be called with interrupts enabled!!!!!!
  */
 void scheduler_next()
 {
    quick_assert_locked();
    tcb_t *tcb = get_tcb();
-   tcb_t *sleeper;
-   unsigned long now;
+   unsigned long now = get_time();
+   int level;
    //debug_print("scheduler", "scheduler_next, old tcb = %p", tcb);
-   sleeper = heap_peek(&sleepers); 
-   now = get_time();
    
-   /* If it is time to wake up a thread, put him last in the run queue. */
-   if(sleeper && sleeper->wakeup < now)
-   {
-      debug_print("sleep", "Waking tcb %p from %p", sleeper, tcb);
-      heap_pop(&sleepers);
-      sleeper->wakeup = 0;
-      LIST_INSERT_BEFORE(runnable, sleeper, scheduler_node);
-      runnable = sleeper;
-   }
+   /* If it is time to wake up threads, run them next. The wheel is now at
+    * now, so every sleeper left is due after it. */
+   scheduler_wake(now);
 
-   if(!runnable)
+   level = runqueue_top();
+   if(level == SCHEDULER_LEVELS)
    {
       /* There is a sleeping or blocked thread, and no one to run - 
        * twiddle our thumbs.*/
-      if(sleeper || blocked_count > 0)
+      if(sleepers.count > 0 || blocked_count > 0)
       {
+         /* Stop ticking until the next sleeper is due. */
          tcb_t *next = global_tcb();
+         if (sleepers.count > 0)
+            timer_idle(wheel_next(&sleepers) - now);
+         else
+            timer_idle(0);
          scheduler_switch(tcb, next);
          return;
       }
@@ -275,45 +804,148 @@ void scheduler_next()
       }
    }
    
-   runnable = LIST_NEXT(runnable, scheduler_node);
-   scheduler_switch(tcb, runnable);
+   timer_resume();
+   if (level == SCHEDULER_RT_LEVEL) {
+      scheduler_switch(tcb, rt_ready);
+      return;
+   }
+   runnable[level] = scheduler_pick(tcb, level);
+   scheduler_switch(tcb, runnable[level]);
+}
+
+/**
+ * @brief Run from the idle loop after every interrupt. Switches to the 
+ *    next thread if an interrupt made one runnable, and otherwise returns
+ *    with interrupts still disabled, so the caller can halt atomically.
+ *    Interrupts must be disabled.
+ */
+void scheduler_idle()
+{
+   quick_lock();
+   while (runqueue_top() < SCHEDULER_LEVELS) {
+      scheduler_next();
+      quick_lock();
+   }
+   quick_fake_unlock();
 }
 
 /**
  * @brief Put the calling thread to sleep for the given time. 
  *    
- *    As of now - only this function calls heap_insert, and only 
- *    scheduler_next calls heap_peek / heap_pop. heap_remove will
- *    need to be called by dying processes with interrupts disabled. 
+ *    Only this function inserts into the sleep wheel, and only 
+ *    scheduler_wake expires threads from it. Both run with interrupts
+ *    disabled, and neither allocates memory.
  *
  * @param ticks The number of timer ticks to sleep for.
  *
  * @return ESUCCESS on successful sleep
- *         EFAIL if the thread could not be successfully put to sleep
  */
 int scheduler_sleep(unsigned long ticks)
 {
    tcb_t* tcb = get_tcb();
    debug_print("sleep", "%p going to sleep for %d ticks", tcb, ticks);
-   mutex_lock(&sleep_double_lock);
 
-   /* Double the sleep heap if necessary. */
-   if (heap_check_size(&sleepers) == ESUCCESS) {
-      /* Atomically insert into the sleep heap after possibly doubling
-       * the heap. */
-      quick_lock();
-      mutex_unlock(&sleep_double_lock);
-      tcb->wakeup = get_time() + ticks;
-      heap_insert(&sleepers, tcb);
-      LIST_REMOVE(runnable, tcb, scheduler_node);
-      scheduler_next();
-      return ESUCCESS;
-   }
-   else {
-      /* We needed to double the sleep heap but ran out of memory. */
-      mutex_unlock(&sleep_double_lock);
-      return EFAIL;
+   quick_lock();
+   scheduler_park(tcb, get_time() + ticks, ticks);
+   scheduler_next();
+   return ESUCCESS;
+}
+
+/**
+ * @brief Move the running thread from the run queue to the sleep wheel.
+ *    The caller must switch away. Interrupts must be disabled.
+ *
+ * @param tcb The running thread.
+ * @param wakeup The thread runs again once the time is past wakeup.
+ * @param ticks How long the thread expects to be away, to measure how 
+ * late it is woken.
+ */
+static void scheduler_park(tcb_t *tcb, unsigned long wakeup, long ticks)
+{
+   uint64_t now = timer_nanos();
+   scheduler_account(tcb, SCHED_SLEEPING, now);
+   tcb->sleep_deadline = now + (uint64_t)(ticks > 0 ? ticks : 0) * NS_PER_TICK;
+   runqueue_remove(tcb);
+   scheduler_promote(tcb);
+   tcb->wakeup = wakeup;
+   wheel_insert(&sleepers, tcb);
+}
+
+/**
+ * @brief Park a running real time thread until its next release, which is
+ *    its current deadline. Interrupts must be disabled.
+ *
+ * @param tcb The running real time thread.
+ */
+static void scheduler_throttle(tcb_t *tcb)
+{
+   scheduler_park(tcb, tcb->rt_deadline - 1, 
+         (long)(tcb->rt_deadline - get_time()));
+}
+
+/**
+ * @brief Make the invoking thread a real time thread, change its 
+ *    reservation, or return it to the best effort class.
+ *
+ *    Real time threads are scheduled earliest deadline first, ahead of 
+ *    every best effort thread. Each period the thread may run for budget
+ *    ticks, after which it is throttled until its next release. The first
+ *    period starts now.
+ *
+ * @param period The length of a period in ticks, or 0 to leave the real
+ * time class.
+ * @param budget The ticks the thread may run for in each period.
+ *
+ * @return ESUCCESS on success, EARGS if the reservation is malformed, and
+ * ESTATE if admitting it would raise total utilization above 1.
+ */
+int scheduler_reserve(unsigned long period, unsigned long budget)
+{
+   tcb_t *tcb = get_tcb();
+   unsigned long util = 0;
+
+   if (period > SCHEDULER_RT_MAX_PERIOD) return EARGS;
+   if (period != 0 && (budget == 0 || budget > period)) return EARGS;
+   
+   /* Round utilizations up, so the admitted set can never overload. */
+   if (period != 0)
+      util = (budget * SCHEDULER_RT_SCALE + period - 1) / period;
+
+   quick_lock();
+   if (rt_total - tcb->rt_util + util > SCHEDULER_RT_SCALE) {
+      quick_unlock();
+      return ESTATE;
    }
+   rt_total = rt_total - tcb->rt_util + util;
+
+   runqueue_remove(tcb);
+   tcb->rt_period = period;
+   tcb->rt_budget = budget;
+   tcb->rt_util = util;
+   tcb->rt_used = 0;
+   tcb->rt_deadline = get_time() + period;
+   runqueue_insert(tcb, TRUE);
+
+   /* Leaving the real time class may let someone else run first. */
+   scheduler_next();
+   return ESUCCESS;
 }
 
+/**
+ * @brief Finish the current job of the invoking real time thread, and 
+ *    wait for its next release without using the rest of its budget.
+ *
+ * @return ESUCCESS after the release, or ESTATE if the invoking thread is
+ * not a real time thread.
+ */
+int scheduler_rt_next()
+{
+   tcb_t *tcb = get_tcb();
+   if (tcb->rt_period == 0) return ESTATE;
+
+   quick_lock();
+   scheduler_throttle(tcb);
+   scheduler_next();
+   return ESUCCESS;
+}
 
@@ -27,6 +27,7 @@
 #include <simics.h>
 #include <x86/cr.h>
 #include <string.h>
+#include <fpu.h>
 
 /** @brief Number of pages per kernel stack. */
 
@@ -65,6 +66,7 @@ void thread_init(void)
 */
 void free_thread_resources(tcb_t* tcb)
 {
+   fpu_release(tcb);
    mutex_destroy(&tcb->deschedule_lock);
    cond_destroy(&tcb->swexn_signal);
    kvm_free_page((void*)tcb);
@@ -101,7 +103,19 @@ tcb_t* initialize_thread(pcb_t *pcb)
    tcb->tid = new_tid();
    tcb->pcb = pcb;
    tcb->wakeup = 0;
-   tcb->sleep_index = 0;
+   tcb->sleep_slot = NULL;
+   tcb->fpu_state = NULL;
+   tcb->level = 0;
+   tcb->quantum_used = 0;
+   tcb->donated = SCHEDULER_LEVELS;
+   tcb->blocked_on = NULL;
+   tcb->held = NULL;
+   tcb->last_region = NULL;
+   tcb->rt_period = 0;
+   tcb->rt_util = 0;
+   memset(&tcb->times, 0, sizeof(sched_times_t));
+   tcb->sched_state = SCHED_READY;
+   tcb->state_since = 0;
    tcb->blocked = FALSE;
    tcb->descheduled = FALSE;
    mutex_init(&tcb->deschedule_lock);
@@ -183,6 +197,7 @@ void check_invariants(boolean_t synchronous) {
       assert(pcb->virtual_dir);
       assert(pcb->region_lock.initialized == TRUE);
       assert(pcb->directory_lock.initialized == TRUE);
+      assert(pcb->new_pages_lock.initialized == TRUE);
       assert(pcb->status_lock.initialized == TRUE);
       assert(pcb->waiter_lock.initialized == TRUE);
       assert(pcb->check_waiter_lock.initialized == TRUE);
@@ -194,7 +209,7 @@ void check_invariants(boolean_t synchronous) {
       assert(tcb->deschedule_lock.initialized || tcb == global_tcb());
       assert(((int)get_esp() & PAGE_MASK) > 0xf00);
       assert(tcb->wakeup == 0);
-      assert(tcb->sleep_index == 0);
+      assert(tcb->sleep_slot == NULL);
    }
    assert(((unsigned int)tcb->kstack & PAGE_MASK) == 0);
    assert(tcb->blocked == FALSE);
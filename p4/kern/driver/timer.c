@@ -4,6 +4,14 @@
 * @brief Handles timer interrupts, and reports the number of ticks
 *  since system start.  _Not_ an effective clock, just a timer.
 *
+*  While the kernel is idle the timer is switched from square wave mode 
+*  to one-shot mode and armed for the next sleeper's deadline, so idle 
+*  periods skip timer interrupts. The ticks that pass in one-shot mode 
+*  are accounted for from the PIT counter, so get_time() stays correct.
+*
+*  For finer grained timing, the TSC is calibrated against the PIT at 
+*  boot, and timer_nanos() gives a 64 bit monotonic nanosecond clock.
+*
 * @author Justin Scheiner
 * @bug Timer drifts by about six seconds per day.
 */
@@ -30,10 +38,77 @@
 #define TEN_MS_MSB ((unsigned char)(((TIMER_RATE / 100) & 0xff00) >> 8))
 #define TEN_MS_LSB ((unsigned char)(TIMER_RATE / 100) & 0xff)
 
-/** @brief The number of ticks since boot.
- * This overflows every 12 hours - but is fine for the purposes of 15410.
- */
-static unsigned int ticks;
+/** @brief The number of PIT counts in one tick. */
+#define TEN_MS (TIMER_RATE / 100)
+
+/** @brief Mode command for an interrupt on terminal count of counter 0. */
+#define TIMER_ONE_SHOT 0x30
+
+/** @brief Command to latch the current value of counter 0. */
+#define TIMER_LATCH 0x00
+
+/** @brief The largest counter value the PIT accepts. */
+#define TIMER_MAX_COUNT 0xffff
+
+/** @brief The longest one-shot we can arm, in ticks. */
+#define TIMER_ONESHOT_MAX (TIMER_MAX_COUNT / TEN_MS)
+
+/** @brief Counter 2 of the PIT, which is gated by the speaker port. */
+#define TIMER_CALIBRATE_IO_PORT 0x42
+
+/** @brief The speaker port, which gates counter 2 and reports its output. */
+#define TIMER_GATE_IO_PORT 0x61
+
+/** @brief Gate bit of counter 2 in the speaker port. */
+#define TIMER_GATE 0x01
+
+/** @brief Speaker enable bit in the speaker port. */
+#define TIMER_SPEAKER 0x02
+
+/** @brief Output bit of counter 2 in the speaker port. */
+#define TIMER_OUT 0x20
+
+/** @brief Mode command for an interrupt on terminal count of counter 2. */
+#define TIMER_CALIBRATE_ONE_SHOT 0xb0
+
+/** @brief The number of PIT counts to calibrate the TSC over (50 ms). */
+#define TIMER_CALIBRATE_COUNT (5 * TEN_MS)
+
+/** @brief The most TSC cycles we wait for calibration to finish before 
+ * giving up on the TSC. Over a second on any processor below 4 GHz. */
+#define TIMER_CALIBRATE_TIMEOUT 0xffffffffULL
+
+/** @brief The TSC frequency in Hz, or 0 if calibration failed. */
+static uint64_t tsc_hz = 0;
+
+/** @brief Nanoseconds per TSC cycle, as a 32.32 fixed point number. */
+static uint64_t ns_per_cycle;
+
+/** @brief The TSC value at calibration, where the nanosecond clock 
+ * starts. */
+static uint64_t tsc_base;
+
+/** @brief The number of ticks since boot. get_time() reports only the low
+ * bits, which wrap after about 1.36 years and are always compared 
+ * modulo wrapping, while the tick fallback of timer_nanos() needs all of 
+ * them. */
+static uint64_t ticks;
+
+/** @brief True iff the timer is armed in one-shot mode. */
+static boolean_t oneshot = FALSE;
+
+/** @brief The number of PIT counts the armed one-shot was loaded with. */
+static unsigned int oneshot_count;
+
+/** @brief PIT counts that have passed since the last whole tick was added
+ * to ticks, if the timer was stopped part way through a tick. */
+static unsigned int residual = 0;
+
+static void timer_periodic(void);
+static uint64_t timer_ticks(void);
+static unsigned int timer_elapsed(void);
+static void timer_account(void);
+static void timer_calibrate(void);
 
 /** 
 * @brief Initializes the timer. 
@@ -41,6 +116,54 @@ static unsigned int ticks;
 void timer_init()
 {
    ticks = 0;
+   timer_calibrate();
+   timer_periodic();
+}
+
+/** 
+* @brief Measure the TSC frequency by timing a one-shot of counter 2 of 
+*  the PIT, which we can poll without interrupts. If the one-shot never 
+*  seems to finish, the clock falls back on ticks.
+*/
+static void timer_calibrate()
+{
+   uint64_t start, cycles, calibrate_ns;
+
+   /* Raise the gate of counter 2, with the speaker off. */
+   outb(TIMER_GATE_IO_PORT, 
+         (inb(TIMER_GATE_IO_PORT) & ~TIMER_SPEAKER) | TIMER_GATE);
+
+   outb(TIMER_MODE_IO_PORT, TIMER_CALIBRATE_ONE_SHOT);
+   outb(TIMER_CALIBRATE_IO_PORT, TIMER_CALIBRATE_COUNT & 0xff);
+   outb(TIMER_CALIBRATE_IO_PORT, (TIMER_CALIBRATE_COUNT >> 8) & 0xff);
+
+   start = rdtsc();
+   do {
+      cycles = rdtsc() - start;
+   } while ((inb(TIMER_GATE_IO_PORT) & TIMER_OUT) == 0 && 
+         cycles < TIMER_CALIBRATE_TIMEOUT);
+   tsc_base = rdtsc();
+
+   if (cycles == 0 || cycles >= TIMER_CALIBRATE_TIMEOUT) {
+      tsc_hz = 0;
+      return;
+   }
+
+   /* The timeout keeps cycles within the 32 bit divisor udiv64 takes, so 
+    * the scale comes straight from it, whatever the frequency. */
+   tsc_hz = udiv64(cycles * TIMER_RATE, TIMER_CALIBRATE_COUNT);
+   calibrate_ns = udiv64((uint64_t)TIMER_CALIBRATE_COUNT * NS_PER_SECOND, 
+         TIMER_RATE);
+   ns_per_cycle = udiv64(calibrate_ns << 32, (uint32_t)cycles);
+}
+
+/** 
+* @brief Put the timer in square wave mode, generating an interrupt every
+*  tick.
+*/
+static void timer_periodic()
+{
+   oneshot = FALSE;
 
    //Indicate that the timer should be in square wave mode.
    outb(TIMER_MODE_IO_PORT, TIMER_SQUARE_WAVE);
@@ -50,6 +173,99 @@ void timer_init()
    outb(TIMER_PERIOD_IO_PORT, TEN_MS_MSB);
 }
 
+/** 
+* @brief Arm the timer to generate a single interrupt once the given
+*  number of ticks have passed since the last whole tick.
+*
+* @param count The number of ticks to wait, at most TIMER_ONESHOT_MAX.
+*/
+static void timer_arm(unsigned int count)
+{
+   oneshot = TRUE;
+   oneshot_count = count * TEN_MS - residual;
+
+   outb(TIMER_MODE_IO_PORT, TIMER_ONE_SHOT);
+   outb(TIMER_PERIOD_IO_PORT, oneshot_count & 0xff);
+   outb(TIMER_PERIOD_IO_PORT, (oneshot_count >> 8) & 0xff);
+}
+
+/** 
+* @brief Get the number of PIT counts since the one-shot was armed.
+*
+*  Once the one-shot fires, the counter wraps around and keeps counting,
+*  so the result is clamped to the armed count. This is only wrong if the
+*  interrupt is held off for more than a few milliseconds.
+*
+* @return The number of counts since the one-shot was armed.
+*/
+static unsigned int timer_elapsed()
+{
+   unsigned int remaining;
+
+   outb(TIMER_MODE_IO_PORT, TIMER_LATCH);
+   remaining = inb(TIMER_PERIOD_IO_PORT);
+   remaining |= inb(TIMER_PERIOD_IO_PORT) << 8;
+
+   if (remaining > oneshot_count) return oneshot_count;
+   return oneshot_count - remaining;
+}
+
+/** 
+* @brief Add the ticks that have passed on the armed one-shot to ticks, 
+*  carrying any partial tick in residual.
+*/
+static void timer_account()
+{
+   residual += timer_elapsed();
+   ticks += residual / TEN_MS;
+   residual %= TEN_MS;
+}
+
+/** 
+* @brief Stop ticking while the kernel is idle. The timer is armed to fire 
+*  once at the given deadline, or as late as it can if there is none. 
+*  Interrupts must be disabled.
+*
+* @param deadline The number of ticks from now we must wake up in, or 0 if
+* nothing is waiting on the timer.
+*/
+void timer_idle(unsigned long deadline)
+{
+   quick_assert_locked();
+   if (oneshot) {
+      /* Account for the part of the current one-shot that has passed, 
+       * and rearm from there. */
+      timer_account();
+   }
+
+   if (deadline == 0 || deadline > TIMER_ONESHOT_MAX) {
+      deadline = TIMER_ONESHOT_MAX;
+   }
+   timer_arm(deadline);
+}
+
+/** 
+* @brief Resume ticking when the kernel stops being idle, or when the 
+*  one-shot fires. Interrupts must be disabled.
+*
+*  Account for the ticks that passed on the one-shot. If we stopped part 
+*  way through a tick, arm the timer for the rest of it, and the timer 
+*  handler returns to square wave mode when that fires.
+*/
+void timer_resume()
+{
+   quick_assert_locked();
+   if (!oneshot) return;
+
+   timer_account();
+   if (residual == 0) {
+      timer_periodic();
+   }
+   else {
+      timer_arm(1);
+   }
+}
+
 /** 
 * @brief Increments the timer counter.
 *
@@ -57,25 +273,84 @@ void timer_init()
 */
 void timer_handler(ureg_t* reg)
 {
-   ticks++;
    outb(INT_CTL_PORT, INT_ACK_CURRENT);
 
    /* Interrupts are disabled, so set the lock depth to 1 to indicate
     * this. */
    quick_lock();
+
+   if (oneshot) {
+      /* Account for every tick we skipped, and go back to ticking
+       * normally. The scheduler will stop the timer again if we are still 
+       * idle. */
+      timer_resume();
+   }
+   else {
+      ticks++;
+   }
    
-   /* Run the next thread. */
-   scheduler_next();
+   /* Charge the running thread, and run the next thread if it is 
+    * preempted. */
+   scheduler_tick();
 }
 
 /** 
-* @brief Main access to the timer's current value.
+* @brief Get the time since boot in nanoseconds, from the TSC. Falls back 
+*  on the tick count if the TSC could not be calibrated.
+*
+*  The TSC is multiplied by ns_per_cycle in 32 bit pieces, since we do not 
+*  link against libgcc for 64 bit arithmetic.
+* 
+* @return The number of nanoseconds since the timer was initialized.
+*/
+uint64_t timer_nanos(void)
+{
+   uint64_t cycles;
+   uint32_t c_lo, c_hi, s_lo, s_hi;
+
+   if (tsc_hz == 0) {
+      return timer_ticks() * NS_PER_TICK;
+   }
+
+   cycles = rdtsc() - tsc_base;
+   c_lo = (uint32_t)cycles;
+   c_hi = (uint32_t)(cycles >> 32);
+   s_lo = (uint32_t)ns_per_cycle;
+   s_hi = (uint32_t)(ns_per_cycle >> 32);
+
+   return (((uint64_t)c_hi * s_hi) << 32) + 
+      (uint64_t)c_hi * s_lo + (uint64_t)c_lo * s_hi + 
+      (((uint64_t)c_lo * s_lo) >> 32);
+}
+
+/** 
+* @brief Get the full number of ticks since boot, including the ticks that 
+*  have passed on a one-shot that has not fired yet.
 * 
 * @return The number of ticks since the handler has been installed.
 */
+static uint64_t timer_ticks(void)
+{
+   uint64_t now;
+   
+   quick_lock();
+   now = ticks;
+   if (oneshot) {
+      now += (residual + timer_elapsed()) / TEN_MS;
+   }
+   quick_unlock();
+   return now;
+}
+
+/** 
+* @brief Main access to the timer's current value.
+* 
+* @return The number of ticks since the handler has been installed, 
+*  truncated to a long.
+*/
 long get_time(void)
 {
-   return ticks;
+   return (long)timer_ticks();
 }
 
 
@@ -17,6 +17,8 @@
 #include <ureg.h>
 #include <swexn.h>
 #include <debug.h>
+#include <fpu.h>
+#include <ecodes.h>
 
 #define ERRBUF_SIZE 0x100
 
@@ -89,18 +91,47 @@ void invalid_opcode_handler(ureg_t* reg)
 }
 
 /** 
-* @brief Kills threads if they try to do floating point math. 
+* @brief Gives the FPU to threads that try to do floating point math. 
+*  Kills them if we can not allocate somewhere to save their registers.
 * 
 * @param reg The register state on entry to the handler.
 */
 void device_not_available_handler(ureg_t* reg)
 {
    char errbuf[ERRBUF_SIZE];
+   if (fpu_claim() == ESUCCESS) return;
+
    swexn_try_invoke_handler(reg);
    sprintf(errbuf, "Device not available exception at %%eip = 0x%d", reg->eip);
    thread_kill(errbuf);
 }
 
+/** 
+* @brief Kills threads on unmasked x87 floating point exceptions. 
+* 
+* @param reg The register state on entry to the handler.
+*/
+void math_fault_handler(ureg_t* reg)
+{
+   char errbuf[ERRBUF_SIZE];
+   swexn_try_invoke_handler(reg);
+   sprintf(errbuf, "Floating point exception at %%eip = 0x%x", reg->eip);
+   thread_kill(errbuf);
+}
+
+/** 
+* @brief Kills threads on unmasked SSE floating point exceptions. 
+* 
+* @param reg The register state on entry to the handler.
+*/
+void simd_fault_handler(ureg_t* reg)
+{
+   char errbuf[ERRBUF_SIZE];
+   swexn_try_invoke_handler(reg);
+   sprintf(errbuf, "SIMD floating point exception at %%eip = 0x%x", reg->eip);
+   thread_kill(errbuf);
+}
+
 /**
 * @brief We don't double fault. Ever. 
 * 
@@ -72,6 +72,12 @@ void handler_install()
    tg = (trap_gate_t)(base + TRAP_GATE_SIZE * IDT_MC);
    INSTALL_HANDLER(tg, asm_machine_check_handler);
 
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * IDT_MF);
+   INSTALL_HANDLER(tg, asm_math_fault_handler);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * IDT_XF);
+   INSTALL_HANDLER(tg, asm_simd_fault_handler);
+
    tg = (trap_gate_t)(base + TRAP_GATE_SIZE * SYSCALL_INT);
    INSTALL_HANDLER(tg, asm_syscall_handler);
    IDT_SET_DPL(tg, 0x3);
@@ -176,6 +182,50 @@ void handler_install()
    INSTALL_HANDLER(tg, asm_swexn_handler);
    IDT_SET_DPL(tg, 0x3);
 
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * GET_NANOS_INT);
+   INSTALL_HANDLER(tg, asm_get_nanos_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * SLEEP_NANOS_INT);
+   INSTALL_HANDLER(tg, asm_sleep_nanos_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * FUTEX_WAIT_INT);
+   INSTALL_HANDLER(tg, asm_futex_wait_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * FUTEX_WAKE_INT);
+   INSTALL_HANDLER(tg, asm_futex_wake_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * SCHED_STATS_INT);
+   INSTALL_HANDLER(tg, asm_sched_stats_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * RT_RESERVE_INT);
+   INSTALL_HANDLER(tg, asm_rt_reserve_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * RT_NEXT_INT);
+   INSTALL_HANDLER(tg, asm_rt_next_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * SPAWN_INT);
+   INSTALL_HANDLER(tg, asm_spawn_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * SHM_CREATE_INT);
+   INSTALL_HANDLER(tg, asm_shm_create_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * SHM_MAP_INT);
+   INSTALL_HANDLER(tg, asm_shm_map_handler);
+   IDT_SET_DPL(tg, 0x3);
+
+   tg = (trap_gate_t)(base + TRAP_GATE_SIZE * KERN_STATS_INT);
+   INSTALL_HANDLER(tg, asm_kern_stats_handler);
+   IDT_SET_DPL(tg, 0x3);
+
    tg = (trap_gate_t)(base + TRAP_GATE_SIZE * TIMER_IDT_ENTRY);
    INSTALL_HANDLER(tg, asm_timer_handler);
    IDT_MAKE_INTERRUPT(tg);
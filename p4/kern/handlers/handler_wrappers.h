@@ -15,6 +15,10 @@ void asm_invalid_opcode_handler(void);
 
 void asm_device_not_available_handler(void);
 
+void asm_math_fault_handler(void);
+
+void asm_simd_fault_handler(void);
+
 void asm_double_fault_handler(void);
 
 void asm_invalid_tss_handler(void);
@@ -83,6 +87,28 @@ void asm_vanish_handler(void);
 
 void asm_swexn_handler(void);
 
+void asm_get_nanos_handler(void);
+
+void asm_sleep_nanos_handler(void);
+
+void asm_futex_wait_handler(void);
+
+void asm_futex_wake_handler(void);
+
+void asm_sched_stats_handler(void);
+
+void asm_rt_reserve_handler(void);
+
+void asm_rt_next_handler(void);
+
+void asm_spawn_handler(void);
+
+void asm_shm_create_handler(void);
+
+void asm_shm_map_handler(void);
+
+void asm_kern_stats_handler(void);
+
 void asm_timer_handler(void);
 
 void asm_keyboard_handler(void);
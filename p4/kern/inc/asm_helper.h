@@ -9,6 +9,8 @@
 #ifndef ASM_HELPER_BGUWQ67UHG
 #define ASM_HELPER_BGUWQ67UHG
 
+#include <stdint.h>
+
 /** @def void *get_esp(void)
  *
  * @brief Get current stack pointer.
@@ -23,4 +25,16 @@ void *get_esp();
  */
 void halt();
 
+/** @def uint64_t udiv64(uint64_t dividend, uint32_t divisor)
+ *
+ * @brief Divide a 64 bit integer by a 32 bit integer, since we do not 
+ * link against libgcc.
+ *
+ * @param dividend The 64 bit dividend.
+ * @param divisor The 32 bit divisor.
+ *
+ * @return The 64 bit quotient.
+ */
+uint64_t udiv64(uint64_t dividend, uint32_t divisor);
+
 #endif
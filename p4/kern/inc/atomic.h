@@ -31,6 +31,19 @@ int atomic_add(int *dest, int src);
  */
 int atomic_add_volatile(volatile unsigned int* dest, int src);
 
+/** @brief Atomic compare and swap.
+ *
+ * @param dest Will be set to new, if it holds expected.
+ *
+ * @param expected The value dest must hold.
+ *
+ * @param new The new value of dest.
+ *
+ * @return The original value of dest. The swap happened iff this is 
+ *  expected.
+ */
+int atomic_cas(int *dest, int expected, int new);
+
 #endif /* end of include guard: ATOMIC_XEF37AV5 */
 
 
@@ -8,6 +8,16 @@
 #ifndef CONTEXT_SWITCH_FK34JHG4
 #define CONTEXT_SWITCH_FK34JHG4
 
+/** @brief The registers context_switch saves on the stack of a thread it
+ * switches away from, just below its return address. */
+typedef struct SWITCH_FRAME
+{
+   long edi;
+   long esi;
+   long ebx;
+   long ebp;
+} switch_frame_t;
+
 /** @brief Switch from executing in the current thread to executing
  *         in another thread.
  *
@@ -0,0 +1,32 @@
+/** 
+* @file fpu.h
+* @brief Lazy saving and restoring of FPU and SSE state.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef FPU_M3QZ7TE1
+#define FPU_M3QZ7TE1
+
+#include <kernel_types.h>
+
+/** @brief The size of an fxsave area. */
+#define FPU_STATE_SIZE 512
+
+/** @brief The alignment fxsave and fxrstor require. */
+#define FPU_STATE_ALIGN 16
+
+void fpu_init(void);
+void fpu_switch(tcb_t *tcb);
+int fpu_claim(void);
+int fpu_copy(tcb_t *parent, tcb_t *child);
+void fpu_release(tcb_t *tcb);
+
+/* Assembly helpers. */
+void fpu_save(void *state);
+void fpu_restore(void *state);
+void fpu_reset(void);
+void fpu_clts(void);
+
+#endif /* end of include guard: FPU_M3QZ7TE1 */
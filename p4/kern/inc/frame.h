@@ -0,0 +1,28 @@
+/** 
+* @file frame.h
+* @brief A buddy allocator for the frames of user memory, which keeps all
+*  of its bookkeeping outside of the frames it manages.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef FRAME_Q2M8VJ5R
+
+#define FRAME_Q2M8VJ5R
+
+/** @brief The number of block sizes, so the largest block is 
+ *    2^(FRAME_ORDERS - 1) frames, one page table's worth. */
+#define FRAME_ORDERS 11
+
+/** @brief The most frames handed to frame_free_batch by one caller at a 
+ *    time. */
+#define FRAME_BATCH 64
+
+void frame_init(unsigned long base, int n_frames);
+unsigned long frame_alloc(int order);
+unsigned long frame_alloc_nowait(void);
+void frame_free(unsigned long frame, int order);
+void frame_free_batch(unsigned long* frames, int n);
+
+#endif /* end of include guard: FRAME_Q2M8VJ5R */
@@ -0,0 +1,63 @@
+/**
+* @file futex.h
+* @brief Wait queues keyed by user addresses, used by the futex_wait and
+*  futex_wake system calls to build user level synchronization primitives.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef FUTEX_K3VD8QZA
+
+#define FUTEX_K3VD8QZA
+
+#include <kernel_types.h>
+#include <mutex.h>
+#include <list.h>
+#include <types.h>
+#include <reg.h>
+#include <ureg.h>
+
+/** @brief The number of wait queues in the futex hash. */
+#define FUTEX_BUCKETS 64
+
+/** @brief Hash a (process, user address) pair into the futex table. */
+#define FUTEX_HASH(pcb, addr) \
+   ((((unsigned int)(pcb) >> 4) ^ ((unsigned int)(addr) >> 2)) \
+      % FUTEX_BUCKETS)
+
+typedef struct FUTEX_WAITER futex_waiter_t;
+DEFINE_LIST(futex_waiter_node_t, futex_waiter_t);
+
+/** @brief A thread sleeping on a user address. Lives on the waiter's
+ *    kernel stack for the duration of futex_wait. */
+struct FUTEX_WAITER
+{
+   /** @brief The sleeping thread. */
+   tcb_t *tcb;
+
+   /** @brief The address space the key belongs to. */
+   pcb_t *pcb;
+
+   /** @brief The user virtual address being waited on. */
+   int *addr;
+
+   /** @brief Links the waiters of a single bucket in FIFO order. */
+   futex_waiter_node_t node;
+};
+
+/** @brief One wait queue of the futex hash. */
+typedef struct FUTEX_BUCKET
+{
+   /** @brief Protects the queue, and orders value checks against wakes. */
+   mutex_t lock;
+
+   /** @brief The first waiter in the bucket, or NULL. */
+   futex_waiter_t *waiters;
+} futex_bucket_t;
+
+void futex_init(void);
+void futex_wait_handler(ureg_t* reg);
+void futex_wake_handler(ureg_t* reg);
+
+#endif /* end of include guard: FUTEX_K3VD8QZA */
@@ -13,6 +13,7 @@ void hashtable_init(hashtable_t *hashtable, unsigned int (*hash)(int));
 void hashtable_put(hashtable_t *hashtable, int tid, tcb_t *tcb);
 tcb_t *hashtable_get(hashtable_t *hashtable, int tid);
 tcb_t *hashtable_remove(hashtable_t *hashtable, int tid);
+tcb_t *hashtable_next(hashtable_t *hashtable, int tid);
 
 #endif
 
@@ -11,6 +11,8 @@
 
 #include <list.h>
 #include <types.h>
+#include <sched_stats.h>
+#include <elf_410.h>
 
 /** @brief Arbitrary magic constants to identify corruption of our data
  * structures. */
@@ -19,16 +21,24 @@
 
 typedef struct MUTEX_NODE mutex_node_t;
 typedef struct MUTEX mutex_t;
+typedef struct RWLOCK_NODE rwlock_node_t;
+typedef struct RWLOCK rwlock_t;
 typedef struct COND cond_t;
 typedef struct REGION region_t;
+typedef struct SHM_SEGMENT shm_segment_t;
 typedef struct STATUS status_t;
 typedef struct PROCESS_CONTROL_BLOCK pcb_t;
 typedef struct THREAD_CONTROL_BLOCK tcb_t;
-typedef struct SLEEP_HEAP sleep_heap_t;
+typedef struct TIMER_WHEEL timer_wheel_t;
+typedef struct SWITCH_STATS switch_stats_t;
 typedef struct HASHTABLE_LINK hashtable_link_t;
 typedef struct HASHTABLE hashtable_t;
 typedef struct HANDLER handler_t;
 
+/** @brief The number of locks the page tables of a process are spread 
+ * over. */
+#define PCB_TABLE_LOCKS 16
+
 DEFINE_LIST(tcb_node_t, tcb_t);
 DEFINE_LIST(pcb_node_t, pcb_t);
 
@@ -49,8 +59,46 @@ struct MUTEX {
    /** @brief The last thread waiting on the mutex. */
    mutex_node_t *tail;
 
-   /** @brief True iff someone is holding the mutex. */ 
-   boolean_t locked;
+   /** @brief The thread holding the mutex, or NULL if it is free. */ 
+   tcb_t *owner;
+
+   /** @brief The next mutex held by our owner. */
+   struct MUTEX *held_next;
+
+   /** @brief Simple check to protect against access before intialization
+    * or after destruction. */
+   boolean_t initialized;
+};
+
+/** @brief A node in a reader writer lock's waiting queue. */
+struct RWLOCK_NODE {
+   /** @brief tcb of the waiting thread. */
+   tcb_t *tcb;
+
+   /** @brief True if the thread is waiting to write. */
+   boolean_t write;
+
+   /** @brief Set once the lock has been handed to the thread. */
+   boolean_t granted;
+
+   /** @brief Next waiting thread. */
+   struct RWLOCK_NODE *next;
+};
+
+/** @brief A lock shared by any number of readers, or held by one writer. 
+ * Waiters are served in order, so neither side starves. */
+struct RWLOCK {
+   /** @brief The first thread waiting on the lock. */
+   rwlock_node_t *head;
+
+   /** @brief The last thread waiting on the lock. */
+   rwlock_node_t *tail;
+
+   /** @brief The number of threads reading. */
+   int readers;
+
+   /** @brief The thread writing, or NULL. */
+   tcb_t *writer;
 
    /** @brief Simple check to protect against access before intialization
     * or after destruction. */
@@ -80,8 +128,24 @@ struct REGION
    /** @brief The page fault handler for the region. */
    void (*fault)(void* addr, int ecode);
 
-   /** @brief The next region in the address space. */
-   struct REGION* next;
+   /** @brief The lowest address the region may grow down to, or NULL if 
+    *    it does not grow. */
+   void* limit;
+
+   /** @brief The regions starting below us in our subtree. */
+   struct REGION* left;
+
+   /** @brief The regions starting above us in our subtree. */
+   struct REGION* right;
+
+   /** @brief The height of our subtree. */
+   int height;
+
+   /** @brief The highest end of any region in our subtree. */
+   void* max_end;
+
+   /** @brief The shared memory segment mapped by the region, or NULL. */
+   shm_segment_t* shm;
 };
 
 /** @brief Status block structure to store the exit status of a process. */
@@ -120,9 +184,13 @@ struct PROCESS_CONTROL_BLOCK
    /** @brief True iff we are in the process of vanishing. */
    boolean_t vanishing;
 
-   /** @brief A list of regions with different page fault and freeing 
+   /** @brief A tree of regions with different page fault and freeing 
     * procedures. */
    region_t *regions;
+
+   /** @brief The number of times regions have been freed, so threads can
+    * tell when the region they last found may be gone. */
+   int region_gen;
    
    /** @brief Our exit status. */
    status_t *status;
@@ -136,22 +204,35 @@ struct PROCESS_CONTROL_BLOCK
 
    /** @brief Translates addresses to virtual table addresses*/
    void *virtual_dir;
+
+   /** @brief The executable we are running, whose text and rodata are 
+    * read in on demand. */
+   simple_elf_t elf;
    
    /** @brief Mutual exclusion locks for pcb. */
-   mutex_t region_lock, directory_lock, status_lock, 
+   mutex_t directory_lock, status_lock, 
            waiter_lock, check_waiter_lock, child_lock,
-           swexn_lock, new_pages_lock;
-   
-   /** @brief Our node in a global list of PCBs, used when allocating new 
-    *  tables for kernel virtual memory. */
-   pcb_node_t global_node;
+           swexn_lock;
+
+   /** @brief Protect the region list, and the layout of the address space 
+    * from new_pages and remove_pages. Faults and system calls that only
+    * look at them share them. */
+   rwlock_t region_lock, new_pages_lock;
 
+   /** @brief Protect the entries of the page tables, each table locked by
+    * the lock its directory index hashes to. */
+   mutex_t table_locks[PCB_TABLE_LOCKS];
+   
    /** @brief Circular list of our children. */
    pcb_t *children;
 
    /** @brief Our node in our parent's children list. */
    pcb_node_t child_node;
 
+   /** @brief Where the time of all of our threads, living and dead, has
+    * gone. */
+   sched_times_t times;
+
    /** @brief Circular list of software exception stacks currently being
     * used by threads in this process. */
    tcb_t *swexn_list;
@@ -203,6 +284,47 @@ struct THREAD_CONTROL_BLOCK{
     * descheduled list. If we are blocked we will be in neither list. */
    tcb_node_t scheduler_node;
 
+   /** @brief Our priority level in the run queue, 0 is the highest. */
+   int level;
+
+   /** @brief The number of timer ticks we have run for at our current
+    * level since we were last demoted, promoted or boosted. */
+   int quantum_used;
+
+   /** @brief The highest priority level donated to us by threads waiting 
+    * on mutexes we hold, or SCHEDULER_LEVELS if there are none. We run at
+    * the higher of this and level. */
+   int donated;
+
+   /** @brief Our real time period in ticks, or 0 if we are a best effort 
+    * thread. */
+   unsigned long rt_period;
+
+   /** @brief The ticks we may run for in each real time period. */
+   unsigned long rt_budget;
+
+   /** @brief The ticks we have run for in the current period. */
+   unsigned long rt_used;
+
+   /** @brief The end of the current period, and the time of our next 
+    * release. */
+   unsigned long rt_deadline;
+
+   /** @brief Our share of the processor, in units of 1/SCHEDULER_RT_SCALE. */
+   unsigned long rt_util;
+
+   /** @brief The mutex we are waiting for, or NULL. */
+   mutex_t *blocked_on;
+
+   /** @brief The mutexes we are holding, linked through held_next. */
+   mutex_t *held;
+
+   /** @brief The region our last region lookup found, or NULL. */
+   region_t *last_region;
+
+   /** @brief Our process's region_gen when we found last_region. */
+   int last_region_gen;
+
    /** @brief True iff we are currently blocked. */
    boolean_t blocked;
 
@@ -217,8 +339,25 @@ struct THREAD_CONTROL_BLOCK{
     * be woken up at. */
    unsigned long wakeup;
 
-   /** @brief Our position in the sleep heap. */
-   int sleep_index;
+   /** @brief The slot of the sleep wheel we are in, or NULL if we are not 
+    * sleeping. */
+   tcb_t **sleep_slot;
+   
+   /** @brief Save area for our FPU and SSE registers, or NULL if we have
+    * never used the FPU. */
+   void *fpu_state;
+
+   /** @brief Where our time has gone. */
+   sched_times_t times;
+
+   /** @brief SCHED_RUNNING, SCHED_READY, SCHED_BLOCKED or SCHED_SLEEPING. */
+   int sched_state;
+
+   /** @brief The time, in nanoseconds, we entered sched_state. */
+   unsigned long long state_since;
+
+   /** @brief The time, in nanoseconds, our current sleep should end. */
+   unsigned long long sleep_deadline;
    
    /** @brief A software exception handler registered by the user. */
    handler_t handler;
@@ -240,17 +379,53 @@ struct THREAD_CONTROL_BLOCK{
    int sanity_constant;
 };
 
-/** @brief Binary heap of sleeping threads. */
-struct SLEEP_HEAP 
+/** @brief log2 of the number of slots in each level of the sleep wheel. */
+#define WHEEL_BITS 6
+
+/** @brief The number of slots in each level of the sleep wheel. */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+/** @brief The number of levels in the sleep wheel. */
+#define WHEEL_LEVELS 4
+
+/** @brief Hierarchical timing wheel of sleeping threads. */
+struct TIMER_WHEEL
+{
+   /** @brief Circular lists of sleeping threads, linked through their
+    * scheduler nodes. */
+   tcb_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+   /** @brief The next tick of the wheel to expire. */
+   unsigned long now;
+
+   /** @brief The number of threads in the wheel. */
+   int count;
+};
+
+/** @brief Counters measuring the cost of context switches. */
+struct SWITCH_STATS
 {
-   /** @brief Index of the first empty slot in the heap (size of heap + 1). */
-   int index;
+   /** @brief The number of context switches. */
+   unsigned long switches;
+
+   /** @brief The number of switches that loaded a new page directory. */
+   unsigned long cr3_loads;
+
+   /** @brief The number of switches between threads sharing a page 
+    * directory, which skip the TLB flush. */
+   unsigned long cr3_skips;
+
+   /** @brief The number of times scheduler_next ran a sibling of the 
+    * previous thread ahead of its turn. */
+   unsigned long sibling_picks;
 
-   /** @brief Number of allocated entries in the heap. */
-   int size; 
+   /** @brief TSC cycles from the start of a switch until the new thread 
+    * resumed, summed over the switches in timed. */
+   unsigned long long cycles;
 
-   /** @brief Table of elements in the heap. */
-   tcb_t** data; 
+   /** @brief The number of switches measured in cycles. Switches into a
+    * new thread return to pop_stub, so they are not measured. */
+   unsigned long timed;
 };
 
 /** @brief Link in a hashtable storing a tid -> tcb mapping. */
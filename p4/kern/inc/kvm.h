@@ -15,6 +15,12 @@
 /* Allow for a table of addressable space exclusive to this process. */
 #define KVM_START (USER_MEM_END + (TABLE_SIZE * PAGE_SIZE))
 
+/* The number of kvm tables, all allocated at boot. */
+#define KVM_TABLES (DIR_SIZE - DIR_OFFSET(KVM_START))
+
+/* The most free frames the kernel keeps before returning them to users. */
+#define KVM_FRAME_WATERMARK 64
+
 /* Initialization */
 void kvm_init();
 
@@ -26,6 +26,7 @@
 void lifecycle_init();
 
 void exec_handler(ureg_t*  reg);
+void spawn_handler(ureg_t*  reg);
 
 void thread_kill(char* error_message);
 void thread_fork_handler(ureg_t*  reg);
@@ -28,6 +28,12 @@
 #define PTENT_USER         0x4
 #define PTENT_ZFOD         0x200
 #define PTENT_COW          0x400
+#define PTENT_FILE         0x800
+
+/* There are no software bits left, so shared memory segment pages, which 
+ *  are always present, reuse the bit marking executable pages that are not
+ *  (they lose it when they are read in). */
+#define PTENT_SHARED       PTENT_FILE
 
 #define PAGE_MASK (PAGE_SIZE - 1)
 #define PAGE_OF(addr) (((int)(addr)) & (~PAGE_MASK))
@@ -68,21 +74,27 @@
 
 /** Initialize **/
 int mm_init(void); 
+boolean_t mm_zero_idle(void);
 
 /** Request / receive resources */
 void *mm_new_kp_page(void);
 int mm_alloc(pcb_t* pcb, void* addr, size_t len, unsigned int flags);
 int mm_duplicate_address_space(pcb_t* pcb);
 int mm_request_frames(int n);
-void mm_frame_zfod_page(void* addr);
+int mm_resolve_write(void* addr);
+unsigned long mm_new_shared_frame(void);
+int mm_map_shared(pcb_t* pcb, void* addr, unsigned long* frames, int n);
 
 /** Release resources **/
 void mm_remove_pages(pcb_t* pcb, void* start, void* end);
 void mm_free_user_space(pcb_t* pcb);
 void mm_free_address_space(pcb_t* pcb);
+void mm_unref_frame(unsigned long frame);
 
 /** Requests information **/
 int mm_getflags(void* addr);
+boolean_t mm_fault_resolved(void* addr, boolean_t write);
+void mm_zero_stats(unsigned long* hits, unsigned long* misses);
 boolean_t mm_validate_write(void* addr, int len);
 
 #endif /* end of include guard: MM_1PZ6H5QE */
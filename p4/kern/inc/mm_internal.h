@@ -11,10 +11,16 @@
 #define MM_INTERNAL_DR6WBXWC
 
 #include <kernel_types.h>
+#include <tlb.h>
 
-#define DEFAULT_COPY_PAGE ((void*)(USER_MEM_END))
 #define FREE_PAGE ((void*)(-1 * PAGE_SIZE))
 
+/* Where the idle thread maps frames to zero them, just above KVM. */
+#define ZERO_PAGE ((void*)(-2 * PAGE_SIZE))
+
+/* The most pre-zeroed frames the idle thread keeps on hand. */
+#define ZERO_POOL_SIZE 64
+
 #define DIR_SIZE 1024
 #define TABLE_SIZE 1024
 #define DIR_SHIFT 22
@@ -29,7 +35,7 @@
 #define PDENT_DISABLE_CACHE   0x10
 #define PDENT_ACCESSED        0x20
 #define PDENT_RESERVED        0x40
-#define PDENT_2MPAGESIZE      0x80
+#define PDENT_4MPAGESIZE      0x80
 #define PDENT_GLOBAL          0x100
 
 // Page table entry flags. 
@@ -45,6 +51,24 @@
 
 #define TABLE_PRESENT(table) ((unsigned long)(FLAGS_OF(table) & PDENT_PRESENT))
 #define PAGE_PRESENT(page) ((unsigned long)(FLAGS_OF(page) & PTENT_PRESENT))
+
+/** @brief The bytes mapped by a single directory entry. */
+#define LARGE_PAGE_SIZE (TABLE_SIZE * PAGE_SIZE)
+
+/** @brief True if the directory entry maps a 4 MB page instead of a table.
+ *    Such entries are still TABLE_PRESENT, but have no virtual table. */
+#define TABLE_LARGE(table) \
+   ((unsigned long)(FLAGS_OF(table) & (PDENT_PRESENT | PDENT_4MPAGESIZE)) \
+      == (PDENT_PRESENT | PDENT_4MPAGESIZE))
+
+/** @brief The lock protecting the entries of the table that maps addr. */
+#define TABLE_LOCK(pcb, addr) \
+   (&(pcb)->table_locks[DIR_OFFSET(addr) % PCB_TABLE_LOCKS])
+
+/** @brief True if the page belongs to the user, even if it has not been 
+ *    read in from the executable yet. */
+#define PAGE_MAPPED(page) \
+   ((unsigned long)(FLAGS_OF(page) & (PTENT_PRESENT | PTENT_FILE)))
 #define PAGE_FROM_INDEX(d, t) (((d) << DIR_SHIFT) + ((t) << TABLE_SHIFT))
 
 /** 
@@ -60,10 +84,14 @@ typedef unsigned long page_tablent_t;
 typedef page_tablent_t* page_dirent_t;
 
 void invalidate_page(void* addr);
-unsigned long mm_new_frame(unsigned long* table, unsigned long page);
+unsigned long mm_new_frame(unsigned long* table, unsigned long page, 
+   boolean_t zero);
 unsigned long mm_free_frame(unsigned long* table, unsigned long page);
 void* mm_new_table(pcb_t* pcb, void* addr);
-void mm_free_table(pcb_t* pcb, void* addr);
+void mm_free_table(pcb_t* pcb, void* addr, tlb_batch_t* tlb);
+int mm_share_file_page(void* addr, unsigned long frame);
+int mm_fill_file_page(void* addr, void (*fill)(void*), unsigned long* frame);
+void mm_ref_frame(unsigned long frame);
 
 #endif /* end of include guard: MM_INTERNAL_DR6WBXWC */
 
@@ -15,11 +15,16 @@
 #include <kernel_types.h>
 #include <types.h>
 
+/** @brief The longest chain of blocked mutex owners a waiter donates its
+ * priority through. Bounds the work done under the quick lock. */
+#define MUTEX_DONATION_DEPTH 8
+
 extern boolean_t locks_enabled;
 
 void mutex_init(mutex_t *mp);
 void mutex_destroy(mutex_t *mp);
 void mutex_lock(mutex_t *mp);
+boolean_t mutex_trylock(mutex_t *mp);
 void mutex_unlock(mutex_t *mp);
 void quick_lock();
 void quick_unlock();
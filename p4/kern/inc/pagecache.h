@@ -0,0 +1,41 @@
+/** 
+* @file pagecache.h
+* @brief A cache of the text and rodata pages of the executables on the
+*  RAM disk, shared read only by every process running them.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef PAGECACHE_X4NQ7TLE
+
+#define PAGECACHE_X4NQ7TLE
+
+/** @brief The number of chains in the page cache hash. */
+#define PAGECACHE_BUCKETS 128
+
+/** @brief Hash an (executable, virtual page) pair into the page cache. */
+#define PAGECACHE_HASH(exec, page) \
+   ((((unsigned int)(exec) >> 4) ^ ((unsigned int)(page) >> PAGE_SHIFT)) \
+      % PAGECACHE_BUCKETS)
+
+/** @brief One cached page of an executable. */
+typedef struct PAGECACHE_ENTRY
+{
+   /** @brief The executable, named by its table of contents entry. */
+   const char* exec;
+
+   /** @brief The virtual address of the page. */
+   unsigned long page;
+
+   /** @brief The frame holding the page, referenced by the cache. */
+   unsigned long frame;
+
+   /** @brief The next entry in the same chain. */
+   struct PAGECACHE_ENTRY* next;
+} pagecache_entry_t;
+
+void pagecache_init(void);
+int pagecache_map(void* addr);
+
+#endif /* end of include guard: PAGECACHE_X4NQ7TLE */
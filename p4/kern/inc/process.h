@@ -13,10 +13,24 @@
 #include <kernel_types.h>
 #include <elf_410.h>
 #include <types.h>
+#include <page.h>
 
 /* The starting address of the stack in all processes. */
 #define USER_STACK_BASE 0xc0000000
 
+/* The initial size of the stack region. Only its top page is framed up 
+ *  front, the rest is zero filled on demand. */
+#define USER_STACK_SIZE (4 * PAGE_SIZE)
+
+/* How far below USER_STACK_BASE the stack region may grow on fault. */
+#define USER_STACK_RLIMIT (256 * PAGE_SIZE)
+
+/* The least the stack region grows by at a time. */
+#define USER_STACK_STEP (4 * PAGE_SIZE)
+
+/* The gap kept between the stack region and the regions below it. */
+#define USER_STACK_GUARD (4 * PAGE_SIZE)
+
 extern pcb_t *init_process;
 
 void free_process_resources(pcb_t* pcb, boolean_t vanishing);
@@ -26,6 +26,10 @@ int allocate_region(
 ); 
 
 int allocate_stack_region(pcb_t* pcb);
+int allocate_shared_region(void* start, shm_segment_t* shm, pcb_t* pcb);
+int region_grow(pcb_t* pcb, void* addr);
+region_t* region_find(pcb_t* pcb, void* addr);
+region_t* region_grower(pcb_t* pcb, void* addr);
 region_t* duplicate_region_list(pcb_t* pcb);
 void free_region_list(pcb_t* pcb);
 int free_region(pcb_t* pcb, void* start);
@@ -0,0 +1,21 @@
+/** 
+* @file rwlock.h
+* @brief Definitions for reader writer locks.
+*
+* @author Tim Wilson
+* @author Justin Scheiner
+*/
+
+#ifndef RWLOCK_H_P7W3KD2N
+#define RWLOCK_H_P7W3KD2N
+
+#include <kernel_types.h>
+
+void rwlock_init(rwlock_t *rwp);
+void rwlock_destroy(rwlock_t *rwp);
+void rwlock_lock_read(rwlock_t *rwp);
+void rwlock_unlock_read(rwlock_t *rwp);
+void rwlock_lock_write(rwlock_t *rwp);
+void rwlock_unlock_write(rwlock_t *rwp);
+
+#endif
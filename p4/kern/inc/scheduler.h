@@ -12,6 +12,37 @@
 #include <kernel_types.h>
 #include <types.h>
 
+/** @brief The number of priority levels in the run queue. */
+#define SCHEDULER_LEVELS 4
+
+/** @brief The number of timer ticks a thread may run at a given level 
+ * before it is demoted. Lower priority levels get longer quanta. */
+#define SCHEDULER_QUANTUM(level) (1 << (level))
+
+/** @brief The number of timer ticks between boosts of every runnable
+ * thread to the highest priority level. */
+#define SCHEDULER_BOOST_TICKS 100
+
+/** @brief The largest number of siblings of the previous thread that 
+ * scheduler_next will run ahead of their turn in a row. */
+#define SCHEDULER_SIBLING_STREAK 2
+
+/** @brief How far back in line scheduler_next looks for a sibling of the
+ * previous thread. */
+#define SCHEDULER_SIBLING_SCAN 4
+
+/** @brief The level runqueue_top reports while a real time thread is 
+ * runnable. Real time threads run ahead of every best effort level. */
+#define SCHEDULER_RT_LEVEL (-1)
+
+/** @brief Fixed point scale of real time utilizations. Admission control
+ * keeps the total utilization at or below this. */
+#define SCHEDULER_RT_SCALE (1 << 16)
+
+/** @brief The longest real time period, in ticks. Bounds the fixed point
+ * arithmetic in admission control. */
+#define SCHEDULER_RT_MAX_PERIOD (1 << 15)
+
 void scheduler_init();
 void scheduler_register(tcb_t* tcb);
 
@@ -22,9 +53,17 @@ void scheduler_deschedule(mutex_t *lock);
 boolean_t scheduler_reschedule(tcb_t *tcb);
 void scheduler_die(mutex_t *lock);
 void scheduler_next();
+void scheduler_tick();
+void scheduler_idle();
+int scheduler_level_count(int level);
+int scheduler_priority(tcb_t *tcb);
+void scheduler_donate(tcb_t *tcb, int level);
+void scheduler_switch_stats(switch_stats_t *stats);
+void scheduler_thread_stats(tcb_t *tcb, sched_stats_t *stats);
+void scheduler_orphan(tcb_t *tcb);
 int scheduler_sleep(unsigned long ticks);
-
-// heap_t* scheduler_sleep_heap = NULL;
+int scheduler_reserve(unsigned long period, unsigned long budget);
+int scheduler_rt_next(void);
 
 #endif /* end of include guard: SCHEDULER_JIJV6ZY3 */
 
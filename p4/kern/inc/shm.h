@@ -0,0 +1,54 @@
+/**
+* @file shm.h
+* @brief Shared memory segments, created by shm_create and mapped into any
+*  number of address spaces by shm_map.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef SHM_Q7LC2RWN
+
+#define SHM_Q7LC2RWN
+
+#include <kernel_types.h>
+#include <types.h>
+#include <reg.h>
+#include <ureg.h>
+
+/** @brief A shared memory segment. */
+struct SHM_SEGMENT
+{
+   /** @brief The handle shm_map names the segment by. */
+   int id;
+
+   /** @brief The number of pages in the segment. */
+   int n_pages;
+
+   /** @brief The number of regions mapping the segment. */
+   int refs;
+
+   /** @brief True once a region has mapped the segment. Until then, it 
+    *    survives losing its last reference while its creator lives. */
+   boolean_t mapped;
+
+   /** @brief The process that created the segment, or NULL once it has 
+    *    exited. */
+   pcb_t* owner;
+
+   /** @brief The frames backing the segment, each of which the segment
+    *    holds a reference to. */
+   unsigned long* frames;
+
+   /** @brief The next segment in the global list. */
+   struct SHM_SEGMENT* next;
+};
+
+void shm_init(void);
+void shm_attach(shm_segment_t* shm);
+void shm_detach(shm_segment_t* shm);
+void shm_release(pcb_t* pcb);
+void shm_create_handler(ureg_t* reg);
+void shm_map_handler(ureg_t* reg);
+
+#endif /* end of include guard: SHM_Q7LC2RWN */
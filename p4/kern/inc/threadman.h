@@ -21,6 +21,12 @@ void deschedule_handler(ureg_t*  reg);
 void make_runnable_handler(ureg_t*  reg);
 void get_ticks_handler(ureg_t*  reg);
 void sleep_handler(ureg_t*  reg);
+void get_nanos_handler(ureg_t*  reg);
+void sleep_nanos_handler(ureg_t*  reg);
+void sched_stats_handler(ureg_t*  reg);
+void rt_reserve_handler(ureg_t*  reg);
+void rt_next_handler(ureg_t*  reg);
+void kern_stats_handler(ureg_t*  reg);
 
 #endif /* end of include guard: THREADMAN_4AB52XKO */
 
@@ -10,8 +10,17 @@
 #define TIMER_39YOD2E4
 
 #include <types.h>
+#include <stdint.h>
+
+/** @brief The number of nanoseconds in a second. */
+#define NS_PER_SECOND 1000000000
+
+/** @brief The number of nanoseconds in a timer tick. */
+#define NS_PER_TICK (NS_PER_SECOND / 100)
 
 void timer_init(void);
+void timer_idle(unsigned long deadline);
+void timer_resume(void);
 
 /** 
 * @brief A basic wrapper for the timer handler.
@@ -21,5 +30,6 @@ void timer_init(void);
 */
 void asm_timer_wrapper(void);
 long get_time(void);
+uint64_t timer_nanos(void);
 
 #endif /* end of include guard: TIMER_39YOD2E4 */
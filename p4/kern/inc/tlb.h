@@ -0,0 +1,47 @@
+/** 
+* @file tlb.h
+* @brief Batches the TLB invalidations of many unmapped pages, so they can
+*  be flushed with a single reload of cr3, or not at all when the address 
+*  space is not the one we are running in.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef TLB_H7CN2QXD
+
+#define TLB_H7CN2QXD
+
+#include <kernel_types.h>
+#include <types.h>
+
+/** @brief The most pages invalidated one at a time. A batch with more 
+ *    reloads cr3 instead. */
+#define TLB_FLUSH_THRESHOLD 32
+
+/** @brief Pages unmapped but not yet invalidated. Lives on the stack of
+ *    whoever is unmapping. */
+typedef struct TLB_BATCH
+{
+   /** @brief The pages to invalidate. */
+   void* pages[TLB_FLUSH_THRESHOLD];
+
+   /** @brief The number of pages in pages. */
+   int n;
+
+   /** @brief True if the pages are not in the current address space, so 
+    *    the TLB holds none of them. */
+   boolean_t skip;
+
+   /** @brief True if the pages are global, so only invlpg removes them. */
+   boolean_t global;
+
+   /** @brief True if there were too many pages, and cr3 will be reloaded.*/
+   boolean_t reload;
+} tlb_batch_t;
+
+void tlb_batch_init(tlb_batch_t* tlb, pcb_t* pcb);
+void tlb_batch_add(tlb_batch_t* tlb, void* page);
+void tlb_batch_flush(tlb_batch_t* tlb);
+
+#endif /* end of include guard: TLB_H7CN2QXD */
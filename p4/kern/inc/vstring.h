@@ -12,6 +12,7 @@
 #include <mm.h>
 #include <ecodes.h>
 #include <ureg.h>
+#include <stdint.h>
 
 int v_strcpy(char *dest, char *src, int max_len, boolean_t user_source);
 int v_memcpy(char *dest, char *src, int max_len, boolean_t user_source);
@@ -130,4 +131,36 @@ static inline int v_copy_out_int(int* dst, int src)
    else return ESUCCESS;
 }
 
+/** 
+* @brief Copies in a 64 bit unsigned integer from user memory. 
+* 
+* @param ptr A local copy of the integer.
+* @param arg_addr The address of the user argument. 
+* 
+* @return ESUCCESS on success, EFAIL on failure. 
+*/
+static inline int v_copy_in_uint64(uint64_t* ptr, char* arg_addr)
+{
+   int ret = v_memcpy((char*)ptr, arg_addr, sizeof(uint64_t), TRUE);
+   if(ret < sizeof(uint64_t))
+      return EFAIL; 
+   else return ESUCCESS;
+}
+
+/** 
+* @brief Copies a 64 bit unsigned integer back out to user memory. 
+* 
+* @param dst The pointer into user memory. 
+* @param src The value to copy out. 
+* 
+* @return ESUCCESS on success, EFAIL on failure. 
+*/
+static inline int v_copy_out_uint64(uint64_t* dst, uint64_t src)
+{
+   int ret = v_memcpy((char*)dst, (char*)&src, sizeof(uint64_t), FALSE);
+   if(ret < sizeof(uint64_t))
+      return EFAIL; 
+   else return ESUCCESS;
+}
+
 #endif
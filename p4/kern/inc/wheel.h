@@ -0,0 +1,22 @@
+/** 
+* @file wheel.h
+* @brief A hierarchical timing wheel used for sleeping threads. 
+*  The wheel keys on wake time. 
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef WHEEL_K2T8QX41
+
+#define WHEEL_K2T8QX41
+
+#include <kernel_types.h>
+
+void wheel_init(timer_wheel_t *wheel, unsigned long now);
+void wheel_insert(timer_wheel_t *wheel, tcb_t *tcb);
+void wheel_remove(timer_wheel_t *wheel, tcb_t *tcb);
+tcb_t *wheel_expire(timer_wheel_t *wheel, unsigned long now);
+unsigned long wheel_next(timer_wheel_t *wheel);
+
+#endif /* end of include guard: WHEEL_K2T8QX41 */
@@ -0,0 +1,251 @@
+/** 
+* @file frame.c
+*
+* @brief A buddy allocator for the frames of user memory.
+*
+* Free memory is kept as blocks of 2^order frames, aligned to their size,
+*  on one free list per order. The lists are linked through arrays indexed
+*  by frame number rather than through the frames themselves, so nothing 
+*  here ever maps or touches a frame. A block's buddy is found by flipping
+*  the bit of its order in its frame number, and freed blocks are merged 
+*  with their buddies as far as they go.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#include <frame.h>
+#include <mm.h>
+#include <page.h>
+#include <mutex.h>
+#include <assert.h>
+#include <debug.h>
+#include <malloc.h>
+
+/** @brief Marks a frame that is not the first frame of a free block. */
+#define FRAME_USED 0xff
+
+/** @brief The end of a free list. */
+#define FRAME_NONE (-1)
+
+/** @brief The frame number of the frame at physical address frame. */
+#define FRAME_INDEX(frame) (((frame) - frame_base) >> PAGE_SHIFT)
+
+/** @brief The physical address of frame number index. */
+#define FRAME_ADDR(index) (frame_base + ((unsigned long)(index) << PAGE_SHIFT))
+
+/** @brief The physical address of frame number 0. Must be aligned to the 
+ *    largest block. */
+static unsigned long frame_base;
+
+/** @brief The number of frames, free or not, starting at frame_base. */
+static int n_frames;
+
+/** @brief The order of the free block starting at each frame, or 
+ *    FRAME_USED. */
+static unsigned char* frame_order;
+
+/** @brief The next and previous free blocks of the same order. */
+static int *frame_next, *frame_prev;
+
+/** @brief The first free block of each order, or FRAME_NONE. */
+static int free_heads[FRAME_ORDERS];
+
+/** @brief Protects the free lists. */
+static mutex_t frame_lock;
+
+/**
+* @brief Put the free block at index on the free list for order.
+*/
+static void frame_push(int index, int order)
+{
+   frame_order[index] = order;
+   frame_prev[index] = FRAME_NONE;
+   frame_next[index] = free_heads[order];
+   if(free_heads[order] != FRAME_NONE)
+      frame_prev[free_heads[order]] = index;
+   free_heads[order] = index;
+}
+
+/**
+* @brief Take the free block at index off of its free list.
+*/
+static void frame_remove(int index)
+{
+   int order = frame_order[index];
+
+   if(frame_prev[index] != FRAME_NONE)
+      frame_next[frame_prev[index]] = frame_next[index];
+   else
+      free_heads[order] = frame_next[index];
+   if(frame_next[index] != FRAME_NONE)
+      frame_prev[frame_next[index]] = frame_prev[index];
+   frame_order[index] = FRAME_USED;
+}
+
+/**
+* @brief Free the block at index, merging it with its buddies. Must be 
+*  called with frame_lock held.
+*/
+static void frame_free_locked(int index, int order)
+{
+   int buddy;
+
+   assert(index >= 0 && index < n_frames);
+   assert(frame_order[index] == FRAME_USED);
+
+   for(; order < FRAME_ORDERS - 1; order++)
+   {
+      buddy = index ^ (1 << order);
+      if(buddy >= n_frames || frame_order[buddy] != order)
+         break;
+      frame_remove(buddy);
+      if(buddy < index)
+         index = buddy;
+   }
+   frame_push(index, order);
+}
+
+/**
+* @brief Initialize the allocator with every frame in [base + PAGE_SIZE, 
+*  base + n * PAGE_SIZE) free. The first frame is never handed out.
+*
+*  This should only be called from mm_init, before interrupts are enabled.
+*
+* @param base The physical address of the first frame. 
+* @param n The number of frames starting at base.
+*/
+void frame_init(unsigned long base, int n)
+{
+   int i, order;
+
+   assert(PAGE_OFFSET(base) == 0);
+   frame_base = base;
+   n_frames = n;
+   mutex_init(&frame_lock);
+
+   frame_order = smalloc(n * sizeof(unsigned char));
+   frame_next = smalloc(n * sizeof(int));
+   frame_prev = smalloc(n * sizeof(int));
+   assert(frame_order && frame_next && frame_prev);
+
+   for(i = 0; i < FRAME_ORDERS; i++)
+      free_heads[i] = FRAME_NONE;
+   for(i = 0; i < n; i++)
+      frame_order[i] = FRAME_USED;
+
+   /* Carve the free frames into the largest aligned blocks they hold. */
+   for(i = 1; i < n; i += (1 << order))
+   {
+      for(order = FRAME_ORDERS - 1; order > 0; order--)
+      {
+         if((i & ((1 << order) - 1)) == 0 && i + (1 << order) <= n)
+            break;
+      }
+      frame_push(i, order);
+   }
+}
+
+/**
+* @brief Take a block of 2^order frames off of the free lists. Must be 
+*  called with frame_lock held.
+*
+* @return The frame number of the block, or FRAME_NONE.
+*/
+static int frame_alloc_locked(int order)
+{
+   int index, k;
+
+   for(k = order; k < FRAME_ORDERS && free_heads[k] == FRAME_NONE; k++)
+      continue;
+   if(k == FRAME_ORDERS)
+   {
+      debug_print("frame", "No free block of order %d", order);
+      return FRAME_NONE;
+   }
+
+   index = free_heads[k];
+   frame_remove(index);
+
+   /* Give back the upper half until the block is the size asked for. */
+   while(k > order)
+   {
+      k--;
+      frame_push(index + (1 << k), k);
+   }
+   return index;
+}
+
+/**
+* @brief Allocate 2^order physically contiguous frames, aligned to their 
+*  size. The caller must already have requested them.
+*
+* @param order The log of the number of frames.
+*
+* @return The physical address of the first frame, or 0 if no block is 
+*  large enough.
+*/
+unsigned long frame_alloc(int order)
+{
+   int index;
+
+   assert(order >= 0 && order < FRAME_ORDERS);
+
+   mutex_lock(&frame_lock);
+   index = frame_alloc_locked(order);
+   mutex_unlock(&frame_lock);
+
+   return (index == FRAME_NONE) ? 0 : FRAME_ADDR(index);
+}
+
+/**
+* @brief Allocate a single frame without ever blocking, for the idle 
+*  thread. 
+*
+* @return The physical address of the frame, or 0 if there are no free 
+*  frames or someone else is using the free lists.
+*/
+unsigned long frame_alloc_nowait()
+{
+   int index = FRAME_NONE;
+
+   /* The idle thread must not be preempted while it holds the lock. */
+   quick_lock();
+   if(mutex_trylock(&frame_lock))
+   {
+      index = frame_alloc_locked(0);
+      mutex_unlock(&frame_lock);
+   }
+   quick_unlock();
+
+   return (index == FRAME_NONE) ? 0 : FRAME_ADDR(index);
+}
+
+/**
+* @brief Free a block of 2^order frames from frame_alloc.
+*
+* @param frame The physical address of the first frame.
+* @param order The order it was allocated with.
+*/
+void frame_free(unsigned long frame, int order)
+{
+   mutex_lock(&frame_lock);
+   frame_free_locked(FRAME_INDEX(frame), order);
+   mutex_unlock(&frame_lock);
+}
+
+/**
+* @brief Free n single frames at once, taking the lock only once.
+*
+* @param frames The physical addresses of the frames.
+* @param n The number of frames.
+*/
+void frame_free_batch(unsigned long* frames, int n)
+{
+   int i;
+
+   mutex_lock(&frame_lock);
+   for(i = 0; i < n; i++)
+      frame_free_locked(FRAME_INDEX(frames[i]), 0);
+   mutex_unlock(&frame_lock);
+}
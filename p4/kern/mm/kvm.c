@@ -3,11 +3,19 @@
 *
 * @brief Implementation of kernel virtual memory. 
 *  - All kvm tables are global, shared, and direct mapped. 
-*  - There are at most DIR_OFFSET(KVM_END - KVM_START) of these tables. 
-*  - kvm tables are direct mapped. 
+*  - There are DIR_OFFSET(KVM_END - KVM_START) + 1 of these tables, all
+*    allocated by kvm_init, so a new directory just copies the top of the
+*    global directory, and no directory ever changes to map a new table.
+*    This costs KVM_TABLES pages of the kernel heap, about half a megabyte.
 *
 *  - kvm is NOT responsible for requesting frames. This should occur 
 *    at the highest reasonable level. 
+*
+*  - Freed pages keep their frames for the kernel until it has 
+*    KVM_FRAME_WATERMARK of them spare. Beyond that, frames go back to the
+*    user pool, and the pages they were mapped at are kept on a list of 
+*    free addresses, linked through their (not present) table entries, to
+*    be framed again before kvm_bottom moves down.
 *  
 * @author Justin Scheiner
 * @author Tim Wilson
@@ -25,6 +33,7 @@
 #include <string.h>
 #include <ecodes.h>
 #include <atomic.h>
+#include <timer.h>
 
 static void* _kvm_initial_table;
 inline void* kvm_initial_table() { return _kvm_initial_table; }
@@ -34,93 +43,114 @@ inline void* kvm_initial_table() { return _kvm_initial_table; }
  *    KVM is defined as [kvm_bottom, KVM_MEM_END] */
 static void* kvm_bottom;
 
-/** @brief The bottom after all requests are met. */
-static void* kvm_bottom_requested;
+/** @brief The number of kvm pages without frames that are not requested:
+ *    those below kvm_bottom, and those on kvm_free_addrs. */
+static int n_kvm_pages;
 
 /** @brief A list of free frames reserved for the kernel. */
 static free_block_t* kernel_free_list;
 
-/** @brief A lock that protects the kernel free list. */
-static mutex_t kernel_free_lock;
+/** @brief A list of kvm pages without frames above kvm_bottom. */
+static void* kvm_free_addrs;
 
-/** @brief A lock that protects the creation of new KVM tables. */
-static mutex_t new_table_lock;
+/** @brief A lock that protects the kernel free list, the free address 
+ *    list and kvm_bottom. */
+static mutex_t kernel_free_lock;
 
 /** @brief The number of free frames available to the kernel. */
 static int n_kernel_frames;
 
-/** @brief Serializes requests for kernel memory. */
-static mutex_t kernel_request_lock;
-
 static void* kvm_alloc_page(void* page);
-static void* kvm_new_table(void* addr);
+static page_tablent_t* kvm_table(void* page);
 
 /** 
 * @brief Requests frames for allocation. 
+*
+*  Kernel frames, kvm address space and user frames are each reserved with
+*   a compare and swap, and the earlier reservations are given back if a 
+*   later one fails, so requests never lock.
+*
+*  A user page shared copy-on-write must still be requested by each 
+*   address space that maps it, since any of them may need its own copy.
 * 
 * @param n_user The number of user frames to allocate. 
 * @param n_kernel The number of kernel frames to allocate. 
 */
 int kvm_request_frames(int n_user, int n_kernel)
 {
-   int ret = ENOVM;
-   int extrakernel = 0;
-   mutex_lock(&kernel_request_lock);
+   int available, extrakernel;
    
-   /* If there aren't enough kernel frames to satisfy the request, 
-    *  we'll need to allocate from the general frame pool. */
-   if((n_kernel_frames - n_kernel) < 0)
+   /* Take what we can from the kernel's own free frames. If there aren't 
+    *  enough to satisfy the request, we'll need to allocate the rest from 
+    *  the general frame pool. */
+   do
    {
-      n_user += (n_kernel - n_kernel_frames);
-      extrakernel = (n_kernel - n_kernel_frames);
-      n_kernel = n_kernel_frames;
-   }
+      available = n_kernel_frames;
+      extrakernel = (available < n_kernel) ? n_kernel - available : 0;
+   } while(atomic_cas(&n_kernel_frames, available, 
+      available - (n_kernel - extrakernel)) != available);
+   n_user += extrakernel;
 
-   if(kvm_bottom_requested - n_user * PAGE_SIZE <= (void*)KVM_START)
+   /* Reserve kvm address space for the frames from the general pool. */
+   do
    {
-      mutex_unlock(&kernel_request_lock);
-      return ret;
-   }
+      available = n_kvm_pages;
+      if(available < extrakernel)
+      {
+         atomic_add(&n_kernel_frames, n_kernel - extrakernel);
+         return ENOVM;
+      }
+   } while(atomic_cas(&n_kvm_pages, available, available - extrakernel) 
+      != available);
    
-   ret = mm_request_frames(n_user);
-   if(ret == ESUCCESS)
+   if(mm_request_frames(n_user) < 0)
    {
-      kvm_bottom_requested -= extrakernel * PAGE_SIZE;
-      n_kernel_frames -= n_kernel;
+      atomic_add(&n_kvm_pages, extrakernel);
+      atomic_add(&n_kernel_frames, n_kernel - extrakernel);
+      return ENOVM;
    }
-
-   mutex_unlock(&kernel_request_lock);
-   return ret;
+   return ESUCCESS;
 }
 
 /** 
-* @brief Responsible for allocating the first kvm table and mapping it in 
-*  the global directory. 
+* @brief Responsible for allocating every kvm table and mapping them in 
+*  the global directory. The table mapping KVM_END is the initial table.
+*
+*  The time and memory this takes are logged.
 */
 void kvm_init()
 {
    page_dirent_t* global_dir;
-   _kvm_initial_table = mm_new_kp_page();
-   assert(_kvm_initial_table);
-   
+   void* table;
+   uint64_t start;
+   int i;
+
+   start = timer_nanos();
    kernel_free_list = NULL;
-   kvm_bottom_requested = kvm_bottom = KVM_END;
+   kvm_free_addrs = NULL;
+   kvm_bottom = KVM_END;
+   n_kvm_pages = ((char*)KVM_END - (char*)KVM_START) / PAGE_SIZE - 1;
    mutex_init(&kernel_free_lock);
-   mutex_init(&new_table_lock);
-   mutex_init(&kernel_request_lock);
    n_kernel_frames = 0;
    
    global_dir = (page_dirent_t*)global_pcb()->dir_v;
-   global_dir[ DIR_OFFSET(KVM_END) ] = (page_dirent_t)
-      ((int)_kvm_initial_table | PDENT_PRESENT | PDENT_RW | PDENT_GLOBAL);
+   for(i = DIR_OFFSET(KVM_START); i < DIR_SIZE; i++)
+   {
+      /* kvm tables are direct mapped. */
+      table = mm_new_kp_page();
+      assert(table);
+      global_dir[i] = (page_dirent_t)
+         ((int)table | PDENT_PRESENT | PDENT_RW | PDENT_GLOBAL);
+   }
+   _kvm_initial_table = (void*)PAGE_OF(global_dir[ DIR_OFFSET(KVM_END) ]);
+   
+   lprintf("kvm: %d tables (%d KB) preallocated in %lu us", KVM_TABLES, 
+      KVM_TABLES * PAGE_SIZE / 1024, 
+      (unsigned long)(timer_nanos() - start) / 1000);
 }
 
 /** 
 * @brief Frames "page" and returns the physical address of the frame. 
-*
-*  If the address requires a new global table to be allocated, it is,
-*     and the new mapping for the table is reflected in _every_
-*     process (ever).
 * 
 * @param page The page to frame. 
 * 
@@ -134,43 +164,13 @@ void* kvm_alloc_page(void* page)
    assert(PAGE_OFFSET(page) == 0);
    assert((unsigned long)page >= USER_MEM_END);
    
-   /* kvm tables are direct mapped. */
-   page_dirent_t* dir;
    page_tablent_t* table;
    
-   /* Note we may not have a stack yet, so it isn't safe to reference
-    *  our TCB (and therefore our own PCB). */
-   dir = (page_dirent_t*)get_pcb()->dir_v;
-   table = dir[ DIR_OFFSET(page) ];
-   
-   /* Deal with new global table allocation if necessary. */
-   if(!TABLE_PRESENT(table))
-   {
-      mutex_lock(&new_table_lock);
-
-      /* If, after locking the table still isn't allocated, 
-       *  we are free to allocate it ourselves. */
-      table = dir[ DIR_OFFSET(page) ];
-      if(!TABLE_PRESENT(table))
-      {
-         if((table = kvm_new_table(page)) == NULL)
-            return NULL;
-      }
-      else
-      {
-         table = (page_tablent_t*)PAGE_OF(table);
-      }
-      
-      mutex_unlock(&new_table_lock);
-   }
-   else 
-      table = (page_tablent_t*)PAGE_OF(table);
-   
-   assert(FLAGS_OF(table) == 0);
+   table = kvm_table(page);
    assert(!PAGE_PRESENT(table[ TABLE_OFFSET(page) ]));
    
    debug_print("kvm", "Mapping %p in table %p", page, table);
-   frame = mm_new_frame((unsigned long*)table, (unsigned long)page);
+   frame = mm_new_frame((unsigned long*)table, (unsigned long)page, TRUE);
 
    /* Set appropriate flags for the new frame. */
    table[ TABLE_OFFSET(page) ] = 
@@ -196,11 +196,7 @@ void* kvm_new_page()
       new_page = kernel_free_list;
       
       /* Remap the page. */
-      page_dirent_t* global_dir = global_pcb()->dir_v;
-      page_tablent_t* table = 
-         (page_tablent_t*)PAGE_OF(global_dir[ DIR_OFFSET(new_page) ]);
-      
-      assert(FLAGS_OF(table) == 0);
+      page_tablent_t* table = kvm_table(new_page);
       table[ TABLE_OFFSET(new_page) ] = PAGE_OF(table[ TABLE_OFFSET(new_page) ])
          | PTENT_GLOBAL | PTENT_RW | PTENT_PRESENT;
       invalidate_page(new_page);
@@ -210,36 +206,64 @@ void* kvm_new_page()
          new_page, kernel_free_list);
       
       mutex_unlock(&kernel_free_lock);
+      memset(new_page, 0, PAGE_SIZE);
    }
    else
    {
-      new_page = kvm_bottom = kvm_bottom - PAGE_SIZE;
+      /* Reuse an address given up by kvm_free_page before moving down. */
+      if(kvm_free_addrs)
+      {
+         new_page = kvm_free_addrs;
+         kvm_free_addrs = (void*)kvm_table(new_page)[ TABLE_OFFSET(new_page) ];
+         kvm_table(new_page)[ TABLE_OFFSET(new_page) ] = 0;
+      }
+      else
+         new_page = kvm_bottom = kvm_bottom - PAGE_SIZE;
       
       /* This assertion doesn't fail, as it is part of the 
        *  request / alloc setup. */
-      assert(kvm_bottom > (void*)KVM_START);
+      assert(new_page > (void*)KVM_START);
 
       mutex_unlock(&kernel_free_lock);
       
-      /* Frame the new page */
+      /* Frame the new page, which mm_new_frame zeroes for us. */
       if(kvm_alloc_page(new_page) == NULL)
          return NULL;
    }
-   memset(new_page, 0, PAGE_SIZE);
    return new_page;
 }
 
 /** 
 * @brief Makes "page" available to subsequent calls to 
 *  kvm_new_page. 
+*
+*  If the kernel already has KVM_FRAME_WATERMARK frames spare, the frame 
+*   goes back to the user pool instead, along with the request made for 
+*   it, and only the address is kept.
 * 
 * @param page The kvm page to free. 
 */
 void kvm_free_page(void* page)
 {
    void* next;
+   page_tablent_t* table;
    assert(page > (void*)KVM_START);
 
+   if(n_kernel_frames >= KVM_FRAME_WATERMARK)
+   {
+      table = kvm_table(page);
+      mm_free_frame((unsigned long*)table, (unsigned long)page);
+      
+      mutex_lock(&kernel_free_lock);
+      debug_print("kvm", "Returned the frame of %p to the user pool", page);
+      table[ TABLE_OFFSET(page) ] = (page_tablent_t)kvm_free_addrs;
+      kvm_free_addrs = page;
+      mutex_unlock(&kernel_free_lock);
+
+      atomic_add(&n_kvm_pages, 1);
+      return;
+   }
+
    if(kernel_free_list)
       assert((void*)kernel_free_list > (void*)KVM_START);
    
@@ -247,11 +271,8 @@ void kvm_free_page(void* page)
    memset(page, 0, sizeof(free_block_t));
    
    /* Will there be race conditions on freed kernel pages? (No!) */
-   page_dirent_t* global_dir = global_pcb()->dir_v;
-   page_tablent_t* table = global_dir[ DIR_OFFSET(page) ];
-   table = (page_tablent_t*)PAGE_OF(table);
+   table = kvm_table(page);
    
-   mutex_lock(&kernel_request_lock);
    mutex_lock(&kernel_free_lock);
    
    debug_print("kvm", "Adding page %p to kernel_free_list=%p", page, kernel_free_list);
@@ -259,65 +280,36 @@ void kvm_free_page(void* page)
    kernel_free_list = page;
    kernel_free_list->next = next;
    
-   n_kernel_frames++;
+   atomic_add(&n_kernel_frames, 1);
    
    assert((void*)kernel_free_list > (void*)KVM_START);
    
    /* Unmap the page to make illegal accesses show up in debugging. */
-   assert(FLAGS_OF(table) == 0);
    table[ TABLE_OFFSET(page) ] = PAGE_OF(table[ TABLE_OFFSET(page) ]);
    invalidate_page(page);
    
    mutex_unlock(&kernel_free_lock);
-   mutex_unlock(&kernel_request_lock);
    
    /* Wipe all flags, unmap the page. */
    
 }
 
 /** 
-* @brief Allocates a new direct mapped, global kvm table. 
+* @brief Finds the table mapping a kvm page. Every kvm table was mapped by
+*  kvm_init, and kvm tables are direct mapped.
 * 
-* @param page The address to map the new table for - since we are
-*  responsible for filling in every processes page directory.
+* @param page The kvm page.
 * 
-* @return The physical / virtual address of the new table. 
+* @return The table.
 */
-void* kvm_new_table(void* addr)
+static page_tablent_t* kvm_table(void* page)
 {
-   void* table;
-   pcb_t *global, *iter;
-   page_dirent_t* dir_v;
-   page_dirent_t* virtual_dir;
-   
-   global = global_pcb();
-   dir_v = global->dir_v;
-   assert(!TABLE_PRESENT(dir_v[ DIR_OFFSET(addr) ]));
-
-   /* kvm tables are direct mapped. */
-   if((table = mm_new_kp_page()) == NULL)
-      return NULL;
-
-   /* Need to update ALL directories. Luckily this only happens when the 
-    *  kernel uses up 4M of space. */
-   mutex_t* global_lock = global_list_lock();
-   mutex_lock(global_lock);
-
-   /* Map the new table in every other PCB*/
-   LIST_FORALL(global, iter, global_node)
-   {
-      debug_print("kvm", "UPDATING GLOBAL TABLE, pid = %x", iter->pid);
-      dir_v = iter->dir_v;
-      virtual_dir = iter->virtual_dir;
-
-      assert(FLAGS_OF(table) == 0);
-      dir_v[ DIR_OFFSET(addr) ] = 
-         (page_tablent_t*)((int)table | PDENT_GLOBAL | PDENT_PRESENT | PDENT_RW);
-      virtual_dir[ DIR_OFFSET(addr) ] = table;
-   }
-   
-   mutex_unlock(global_lock);
+   page_dirent_t* global_dir = global_pcb()->dir_v;
+   page_tablent_t* table = global_dir[ DIR_OFFSET(page) ];
    
+   assert(TABLE_PRESENT(table));
+   table = (page_tablent_t*)PAGE_OF(table);
+   assert(FLAGS_OF(table) == 0);
    return table;
 }
 
@@ -354,15 +346,13 @@ void* kvm_vtop(void* vaddr)
 *     - Supervisory mode everywhere.
 *     - Read only / not present in user land.
 *     - The directory itself mapped in kernel VM
+*     - Every kvm table, which never change after kvm_init.
 *
 *  The PCB will be updated with 
 *     - the physical address of the new directory
 *     - the virtual address of the new directory
 *     - the virtual address of the virtual directory.
 * 
-*  We are also responsible for adding ourself to the global PCB list
-*     that is used for managing the global kvm tables. 
-* 
 * @param pcb The PCB to endow with a new directory. 
 *
 * @return 0 on success, a negative integer on failure. 
@@ -371,6 +361,7 @@ int kvm_new_directory(pcb_t* pcb)
 {
    int i;
    page_dirent_t* global_dir = global_pcb()->dir_v;
+   page_dirent_t* global_virtual_dir = global_pcb()->virtual_dir;
    
    if(kvm_request_frames(0, 2) < 0)
       return ENOVM;
@@ -383,31 +374,24 @@ int kvm_new_directory(pcb_t* pcb)
    
    debug_print("kvm", "Global directory at %p", global_dir);
    
+   /* Most of the direct map is made of 4 MB pages, which have no tables. */
    for(i = 0; i < DIR_OFFSET(USER_MEM_START); i++)
-      virtual_dir_v[i] = (page_dirent_t)PAGE_OF(global_dir[i]);
+      virtual_dir_v[i] = global_virtual_dir[i];
    
    memcpy(dir_v, global_dir, 
       DIR_OFFSET(USER_MEM_START) * sizeof(page_tablent_t*));
    
-   /* Need to acquire the new table lock here, otherwise a new global 
-    *  table could get allocated, and we would never find out about it, 
-    *  since we aren't on the global list.*/
-   mutex_lock(&new_table_lock);
-   
    /* When we do this copy the directory itself gets mapped as well. */
-   for(i = DIR_OFFSET(kvm_bottom); i < DIR_SIZE; i++)
+   for(i = DIR_OFFSET(KVM_START); i < DIR_SIZE; i++)
       virtual_dir_v[i] = (page_dirent_t)PAGE_OF(global_dir[i]);
   
-   memcpy(dir_v + DIR_OFFSET(kvm_bottom), 
-      global_dir + DIR_OFFSET(kvm_bottom), 
-      (DIR_SIZE - DIR_OFFSET(kvm_bottom)) * sizeof(page_tablent_t*));
+   memcpy(dir_v + DIR_OFFSET(KVM_START), 
+      global_dir + DIR_OFFSET(KVM_START), 
+      KVM_TABLES * sizeof(page_tablent_t*));
    
    pcb->dir_v = dir_v;
    pcb->dir_p = kvm_vtop(dir_v);
    pcb->virtual_dir = virtual_dir_v;
-
-   global_list_add(pcb);
-   mutex_unlock(&new_table_lock);
    
    return ESUCCESS;
 }
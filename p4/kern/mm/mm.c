@@ -4,7 +4,23 @@
 *
 * - Frame requests are handled at the highest level that is contained
 *   in VM - this means mm_duplicate_address_space, and mm_alloc
-*  
+*
+* - Locks are taken in the order new_pages_lock, directory_lock (or the
+*   page cache lock), TABLE_LOCK, user_free_lock. directory_lock 
+*   serializes changes to the layout of an address space. Faults only 
+*   change entries that are already mapped, so they take just the lock of
+*   the table they touch, and faults on different tables proceed in 
+*   parallel. Tables are only created under directory_lock, and only freed
+*   once a single thread is left, so a fault may look one up without it.
+*
+* - Fork shares frames copy-on-write. Every user mapping of a frame holds
+*   one requested frame, so a frame mapped by n address spaces keeps n - 1
+*   frames in reserve, one for each copy that may be made later.
+*
+* - Shared memory segment pages (PTENT_SHARED) are the exception: fork
+*   shares them writable, and the segment holds a reference of its own, so
+*   they are never copied.
+*
 * @author Justin Scheiner
 * @author Tim Wilson
 * @bug Kernel page allocation can probably do better than malloc.
@@ -28,6 +44,9 @@
 #include <debug.h>
 #include <ecodes.h>
 #include <atomic.h>
+#include <malloc_wrappers.h>
+#include <frame.h>
+#include <tlb.h>
 
 /* @brief Local copy of the total number of physical frames in the system.
  *  mm implementation assumes contiguous memory. */
@@ -38,19 +57,44 @@ static int n_phys_frames;
 /* @brief The number of free frames in the system. */
 static int n_free_frames;
 
-/* @brief The number of free frames that have been requested by users. */
+/* @brief The number of free frames that have not been requested yet. 
+ *  Requests reserve frames from it with atomic_cas, so they never lock. */
 static int n_user_frames;
 
-static free_block_t* user_free_list;
+/* Protects the frame reference counts. The free frames themselves are 
+ *  managed by frame.c. */
+static mutex_t user_free_lock;
 
-/* Protects requests for frames. */
-static mutex_t request_lock;
+/* @brief Free frames zeroed ahead of time by the idle thread. The pool is
+ *  protected by the quick lock, since the idle thread may not block. */
+static unsigned long zero_pool[ZERO_POOL_SIZE];
+static int n_zero_pool;
 
-/* Protects the user free list structure. */
-static mutex_t user_free_lock;
+/* @brief Zeroed allocations served from the pool, and zeroed by hand. */
+static unsigned long zero_hits, zero_misses;
+
+/* @brief The number of address spaces mapping each frame of user memory. */
+static unsigned short* frame_refs;
+
+/** @brief The reference count of the user frame at physical address frame. */
+#define FRAME_REFS(frame) \
+   (frame_refs[((unsigned long)(frame) - USER_MEM_START) >> PAGE_SHIFT])
+
+/** @brief The order of the frame blocks that back 4 MB pages. */
+#define LARGE_ORDER (FRAME_ORDERS - 1)
+
+static void mm_release_request(int n);
+static void mm_release_frames(int n);
+static void mm_free_batch(unsigned long* batch, int* n, tlb_batch_t* tlb);
+static unsigned long mm_take_frame(boolean_t zero, boolean_t* zeroed);
+static unsigned long mm_unmap_frame(unsigned long* table_v, unsigned long page,
+   tlb_batch_t* tlb);
+static int mm_map_large(pcb_t* pcb, int d_index);
+static void mm_unmap_large(pcb_t* pcb, int d_index);
+static void mm_split_large(pcb_t* pcb, int d_index);
 
 /** 
-* @brief Initialize the user frame list, enable paging.
+* @brief Initialize the user frame allocator, enable paging.
 *  This function should only be called from kernel_main,
 *     before interrupts are enabled. It is also responsible 
 *     adding the global directory to the global pcb.
@@ -65,26 +109,20 @@ int mm_init()
    page_tablent_t* table;
    page_dirent_t* global_dir, *virtual_dir;
    n_phys_frames = machine_phys_frames();
-   free_block_t* iter;
    
-   /* Point the free list at the first free page. */
-   user_free_list = (free_block_t*)(USER_MEM_START + PAGE_SIZE);
-
    /* This makes an assumption that initially memory is contiguous. */
    n_free_frames = n_phys_frames - (USER_MEM_START >> PAGE_SHIFT) - PAGE_SIZE;
    n_user_frames = n_free_frames;
    
    /* Initialize the ZFOD frame explicitly */
    memset(ZFOD_FRAME, 0, PAGE_SIZE);
+
+   frame_refs = scalloc(n_phys_frames - (USER_MEM_START >> PAGE_SHIFT),
+      sizeof(unsigned short));
+   assert(frame_refs);
    
-   /* Build a very simple link structure on free frames. */
-   for(i = 0, iter = user_free_list; 
-      i < n_free_frames - 1; 
-      i++, iter = iter->next)
-   {
-      iter->next = (free_block_t*)((char*)iter + PAGE_SIZE);
-   }
-   iter->next = NULL;
+   /* Every frame above the ZFOD frame is free. */
+   frame_init(USER_MEM_START, n_phys_frames - (USER_MEM_START >> PAGE_SHIFT));
    
    /* Initialize global page directory. V = P */
    global_pcb()->dir_v = global_pcb()->dir_p = (void*)mm_new_kp_page();
@@ -97,25 +135,27 @@ int mm_init()
    global_dir = (page_dirent_t*)global_pcb()->dir_v;
    virtual_dir = (page_dirent_t*)global_pcb()->virtual_dir;
    
-   /* Iterate over directory entries in direct mapped kernel region. */
-   for(i = 0, addr = 0; i < DIR_OFFSET(USER_MEM_START); i++)
-   {
-      /* Allocate a direct mapped page table for each. */
-      table = global_dir[i] = (page_tablent_t*)mm_new_kp_page();
-      assert(table != NULL);
-      
-      global_dir[i] = (page_dirent_t)(
-         (unsigned long)table | (PDENT_RW | PDENT_PRESENT) );
-      virtual_dir[i] = table;
+   /* The first 4 MB of the direct mapped kernel region gets a real table,
+    *  so that NULL can be left unmapped. */
+   table = (page_tablent_t*)mm_new_kp_page();
+   assert(table != NULL);
+   global_dir[0] = (page_dirent_t)(
+      (unsigned long)table | (PDENT_RW | PDENT_PRESENT) );
+   virtual_dir[0] = table;
 
-      /* Iterate over table entries. */
-      for(j = 0; j < (TABLE_SIZE); j++, addr += PAGE_SIZE)
-         table[j] = addr | (PTENT_GLOBAL | PTENT_RW | PTENT_PRESENT);
-   }
+   for(j = 0, addr = 0; j < (TABLE_SIZE); j++, addr += PAGE_SIZE)
+      table[j] = addr | (PTENT_GLOBAL | PTENT_RW | PTENT_PRESENT);
 
    /* Explicitly unmap NULL to prevent NULL dereferences in the kernel. */
-   table = (page_tablent_t*)PAGE_OF(global_dir[0]);
    table[0] = 0; /* Not present, writable, or global */
+
+   /* The rest of it is direct mapped with global 4 MB pages. */
+   for(i = 1; i < DIR_OFFSET(USER_MEM_START); i++, addr += LARGE_PAGE_SIZE)
+   {
+      global_dir[i] = (page_dirent_t)(addr | 
+         (PDENT_4MPAGESIZE | PDENT_GLOBAL | PDENT_RW | PDENT_PRESENT));
+      virtual_dir[i] = NULL;
+   }
    
    assert(addr == USER_MEM_START);
    
@@ -124,13 +164,13 @@ int mm_init()
          global_dir[i] = 0;
 
    mutex_init(&user_free_lock);
-   mutex_init(&request_lock);
    
    /* Initialize kernel virtual memory which lives above 
     * USER_MEM_END and is global. */
    kvm_init();
 
    /* After this point we give up our direct access to pages in user land.*/
+   set_cr4(get_cr4() | CR4_PSE | CR4_PGE);
    set_cr3((uint32_t)global_dir);
    set_cr0(get_cr0() | CR0_PG);
 
@@ -148,12 +188,16 @@ void mm_free_user_space(pcb_t* pcb)
    unsigned long d_index;
    unsigned long t_index;
    unsigned long frame, page;
+   unsigned long batch[FRAME_BATCH];
+   int n_batch = 0;
+   tlb_batch_t tlb;
    
    page_dirent_t* dir_v, *virtual_dir;
    page_tablent_t *table_v, *table_p;
    
    dir_v = pcb->dir_v;
    virtual_dir = pcb->virtual_dir;
+   tlb_batch_init(&tlb, pcb);
    
    for(d_index = DIR_OFFSET(USER_MEM_START); 
       d_index < DIR_OFFSET(USER_MEM_END); d_index++)
@@ -163,20 +207,31 @@ void mm_free_user_space(pcb_t* pcb)
 
       if(!TABLE_PRESENT(table_p))
          continue;
+
+      if(TABLE_LARGE(table_p))
+      {
+         mm_unmap_large(pcb, d_index);
+         continue;
+      }
       
       for(t_index = 0; t_index < TABLE_SIZE; t_index++)
       {
          frame = table_v[t_index];
-         if(!PAGE_PRESENT(frame))
+         if(!PAGE_MAPPED(frame))
             continue;
          
+         /* Frames no one else maps are handed back a batch at a time. */
          page = PAGE_FROM_INDEX(d_index, t_index);
-         mm_free_frame(table_v, page);
+         if((frame = mm_unmap_frame(table_v, page, &tlb)) == 0)
+            continue;
+         batch[n_batch++] = frame;
+         if(n_batch == FRAME_BATCH)
+            mm_free_batch(batch, &n_batch, &tlb);
       }
 
-      mm_free_table(pcb, (void*)PAGE_FROM_INDEX(d_index, 0));
-      dir_v[d_index] = 0;
+      mm_free_table(pcb, (void*)PAGE_FROM_INDEX(d_index, 0), &tlb);
    }
+   mm_free_batch(batch, &n_batch, &tlb);
 }
 
 /** 
@@ -192,9 +247,6 @@ void mm_free_address_space(pcb_t* pcb)
    pcb_t* global;
    page_dirent_t* dir_v, *virtual_dir;
    
-   /* Remove the PCB from the global list before removing its directory. */
-   global_list_remove(pcb);
-   
    global = global_pcb();
    dir_v = pcb->dir_v;
    virtual_dir = pcb->virtual_dir;
@@ -214,35 +266,63 @@ void mm_free_address_space(pcb_t* pcb)
 * @brief Duplicates the current address space in the process
 *  indicated by pcb. 
 *
+*  No pages are copied. Every present page is shared with the new process,
+*   and writable pages are made read only and marked PTENT_COW in both 
+*   address spaces, to be copied by mm_resolve_write when either side 
+*   writes.
+*   We still request a frame for every shared page, so that the copy can 
+*   never fail.
+*
 * @param new_pcb The new process to copy into. The page directory 
 *  should be empty, but allocated.  
+*
+* @return ESUCCESS on success, ENOVM if the frames can not be reserved.
 */
 int mm_duplicate_address_space(pcb_t* new_pcb) 
 {
    assert(get_pcb() != new_pcb);
    unsigned long d_index, user_frames, kernel_frames;
    unsigned long t_index;
-   unsigned long flags;
-   unsigned long page;
-   unsigned long copy_page = 0;
    pcb_t* current_pcb;
    
-   page_dirent_t *current_dir_v, *new_dir_v, *current_virtual_dir;
-   page_tablent_t *copy_table_v = NULL, *current_table_v, *new_table_v, 
-      *current_table_p;
+   page_dirent_t *current_dir_v, *current_virtual_dir;
+   page_tablent_t *current_table_v, *new_table_v, *current_table_p;
 
-   page_tablent_t current_frame, new_frame;
+   page_tablent_t current_frame;
    
    /* Initial values. */
    current_pcb = get_pcb();
    current_dir_v = current_pcb->dir_v;
-   new_dir_v = new_pcb->dir_v;
    current_virtual_dir = current_pcb->virtual_dir;
 
-   /* First determine the resources we will need. 
+   /* Large pages can only be shared copy-on-write a page at a time, so 
+    *  split them into tables first. 
     *    Since this is essentially a helper function for fork, 
     *    there is only one thread - us.
     **/
+   kernel_frames = 0;
+   for(d_index = DIR_OFFSET(USER_MEM_START); 
+      d_index < DIR_OFFSET(USER_MEM_END); d_index++)
+   {
+      if(TABLE_LARGE(current_dir_v[d_index]))
+         kernel_frames++;
+   }
+   if(kernel_frames > 0)
+   {
+      if(kvm_request_frames(0, kernel_frames) < 0)
+         return ENOVM;
+      
+      mutex_lock(&current_pcb->directory_lock);
+      for(d_index = DIR_OFFSET(USER_MEM_START); 
+         d_index < DIR_OFFSET(USER_MEM_END); d_index++)
+      {
+         if(TABLE_LARGE(current_dir_v[d_index]))
+            mm_split_large(current_pcb, d_index);
+      }
+      mutex_unlock(&current_pcb->directory_lock);
+   }
+
+   /* First determine the resources we will need. */
    user_frames = 0;
    kernel_frames = 0;
    for(d_index = DIR_OFFSET(USER_MEM_START); 
@@ -257,40 +337,15 @@ int mm_duplicate_address_space(pcb_t* new_pcb)
       kernel_frames++;
       for(t_index = 0; t_index < TABLE_SIZE; t_index++)
       {
-         current_frame = current_table_v[t_index];
-         if(PAGE_PRESENT(current_frame))
-         {
+         if(PAGE_MAPPED(current_table_v[t_index]))
             user_frames++;
-         }
-         else 
-         {
-            copy_page = PAGE_FROM_INDEX(d_index, t_index);
-            copy_table_v = current_table_v; 
-         }
       }
    }
    
-   /* If we didn't find a safe addressable page to copy through, 
-    *    we need to allocate a table with one. */
-   if(copy_page == 0)
-      kernel_frames++;
-   
    /* Request the frames we need. */
    if(kvm_request_frames(user_frames, kernel_frames) < 0)
       return ENOVM;
    
-   /* Allocate the copy table if necessary 
-    *    (this should be rare) */
-   if(copy_page == 0)
-   {
-      if(!TABLE_PRESENT(current_dir_v[ DIR_OFFSET(DEFAULT_COPY_PAGE) ]))
-         copy_table_v = mm_new_table(current_pcb, (void*)DEFAULT_COPY_PAGE);
-      else 
-         copy_table_v = current_virtual_dir[ DIR_OFFSET(DEFAULT_COPY_PAGE)];
-      
-      copy_page = (unsigned long)DEFAULT_COPY_PAGE;
-   }
-   
    /* Proceed with the duplication */
    for(d_index = DIR_OFFSET(USER_MEM_START);
          d_index < DIR_OFFSET(USER_MEM_END); d_index++)
@@ -301,8 +356,6 @@ int mm_duplicate_address_space(pcb_t* new_pcb)
       if(!TABLE_PRESENT(current_table_p))
          continue;
       
-      flags = FLAGS_OF(current_table_p);
-      
       new_table_v = 
          mm_new_table(new_pcb, (void*)(PAGE_FROM_INDEX(d_index, 0)));
 
@@ -310,37 +363,498 @@ int mm_duplicate_address_space(pcb_t* new_pcb)
       assert(new_table_v);
       assert(FLAGS_OF(new_table_v) == 0);
       
+      mutex_lock(&user_free_lock);
       for(t_index = 0; t_index < TABLE_SIZE; t_index++)
       {
          current_frame = current_table_v[t_index];
-         if(!PAGE_PRESENT(current_frame)) 
+         if(!PAGE_MAPPED(current_frame)) 
             continue;
 
-         flags = FLAGS_OF(current_frame);
-         page = PAGE_FROM_INDEX(d_index, t_index);
-         
-         if(page == copy_page)
+         /* The ZFOD frame is shared by everyone, and is never counted. 
+          *  Pages not yet read in will be read in by the child itself. */
+         if(!PAGE_PRESENT(current_frame) || (current_frame & PTENT_ZFOD))
+         {
+            new_table_v[t_index] = current_frame;
             continue;
+         }
+
+         /* Shared segment pages stay writable in both. */
+         if((current_frame & PTENT_RW) && !(current_frame & PTENT_SHARED))
+         {
+            current_frame = (current_frame & ~PTENT_RW) | PTENT_COW;
+            current_table_v[t_index] = current_frame;
+         }
          
-         new_frame = mm_new_frame((unsigned long*)copy_table_v, 
-            (unsigned long)copy_page);
-         
-         /* This always passes, since we've already requested the frames. */
-         assert(new_frame);
+         FRAME_REFS(PAGE_OF(current_frame))++;
+         new_table_v[t_index] = current_frame;
+      }
+      mutex_unlock(&user_free_lock);
+   }
+
+   /* Flush our own writable translations for the pages we just shared. */
+   set_cr3(get_cr3());
+   
+   return ESUCCESS;
+}
+
+/** 
+* @brief Gives the current process a private copy of the copy-on-write 
+*  page at page. Must be called with the lock for its table held.
+*
+*  The frame for the copy was requested when the page was shared, so this 
+*   never fails. If no other address space still maps the frame, it is 
+*   simply made writable again.
+* 
+* @param table_v The page table that page belongs to.
+* @param page The page to resolve.
+*/
+static void mm_copy_on_write(page_tablent_t* table_v, unsigned long page)
+{
+   unsigned long frame, new_frame, flags;
+   page_tablent_t *free_table_v;
+   boolean_t zeroed;
+   
+   frame = PAGE_OF(table_v[ TABLE_OFFSET(page) ]);
+   flags = (FLAGS_OF(table_v[ TABLE_OFFSET(page) ]) & ~PTENT_COW) | PTENT_RW;
+
+   mutex_lock(&user_free_lock);
+   if(FRAME_REFS(frame) > 1)
+   {
+      /* Take our reserved frame, and copy the shared frame into it 
+       *    through the free page while it is still mapped at page. */
+      new_frame = mm_take_frame(FALSE, &zeroed);
+      assert(new_frame);
+      atomic_add(&n_free_frames, -1);
+
+      free_table_v = kvm_initial_table();
+      free_table_v[ TABLE_OFFSET(FREE_PAGE) ] = 
+         new_frame | PTENT_PRESENT | PTENT_RW; 
+      invalidate_page((void*)FREE_PAGE);
+      
+      /* The free page is only ever used right after it is mapped and 
+       *  invalidated, so its stale translation is harmless. */
+      memcpy((void*)FREE_PAGE, (void*)page, PAGE_SIZE);
+      free_table_v[ TABLE_OFFSET(FREE_PAGE) ] = 0;
+
+      FRAME_REFS(frame)--;
+      FRAME_REFS(new_frame) = 1;
+      frame = new_frame;
+   }
+   
+   table_v[ TABLE_OFFSET(page) ] = frame | flags;
+   invalidate_page((void*)page);
+   mutex_unlock(&user_free_lock);
+}
+
+/** 
+* @brief Replaces the ZFOD frame at page with a zeroed frame of its own.
+*  Must be called with the lock for its table held.
+*
+*  The frame was requested when the page was mapped, so this never fails.
+* 
+* @param table_v The page table that page belongs to.
+* @param page The page to frame.
+*/
+static void mm_frame_zfod_page(page_tablent_t* table_v, unsigned long page)
+{
+   unsigned long frame, tflags;
 
-         memcpy((void*)copy_page, (void*)page, PAGE_SIZE);
-         new_table_v[t_index] = new_frame | flags;
+   tflags = FLAGS_OF(table_v[ TABLE_OFFSET(page) ]);
+   assert(tflags & PTENT_ZFOD);
+   
+   /* Allocate the free page, but keep it in supervisor mode for now. */
+   frame = mm_new_frame((unsigned long*)table_v, page, TRUE);
+   table_v[ TABLE_OFFSET(page) ] = 
+      ~PTENT_ZFOD & ((unsigned long) frame | PTENT_RW | tflags);
+   invalidate_page((void*)page);
+
+   /* You are hereby a real page. mazel-tov */
+}
+
+/** 
+* @brief Makes the page containing addr writable, if it is only read only
+*  because it is a ZFOD or copy-on-write page of the current process.
+* 
+* @param addr An address in the page to resolve.
+* 
+* @return ESUCCESS if the page is now writable, including when another 
+*  thread made it so first, EFAIL if it was neither a ZFOD nor a 
+*  copy-on-write page.
+*/
+int mm_resolve_write(void* addr)
+{
+   unsigned long page, frame;
+   page_dirent_t *dir_v, *virtual_dir_v;
+   page_tablent_t *table_v;
+   pcb_t* pcb = get_pcb();
+   int ret = ESUCCESS;
+   
+   page = PAGE_OF(addr);
+   dir_v = (page_dirent_t*)pcb->dir_v;
+   virtual_dir_v = (page_dirent_t*)pcb->virtual_dir;
+
+   /* Another thread may have resolved the page while we waited. */
+   mutex_lock(TABLE_LOCK(pcb, page));
+   if(!TABLE_PRESENT(dir_v[ DIR_OFFSET(page) ]) || 
+         TABLE_LARGE(dir_v[ DIR_OFFSET(page) ]))
+   {
+      mutex_unlock(TABLE_LOCK(pcb, page));
+      return EFAIL;
+   }
+   
+   table_v = virtual_dir_v[ DIR_OFFSET(page) ];
+   assert(FLAGS_OF(table_v) == 0);
+   frame = table_v[ TABLE_OFFSET(page) ];
+   
+   if(!PAGE_PRESENT(frame))
+      ret = EFAIL;
+   else if(TEST_SET(frame, PTENT_PRESENT | PTENT_RW | PTENT_USER))
+      ret = ESUCCESS;
+   else if(frame & PTENT_ZFOD)
+      mm_frame_zfod_page(table_v, page);
+   else if(frame & PTENT_COW)
+      mm_copy_on_write(table_v, page);
+   else 
+      ret = EFAIL;
+
+   mutex_unlock(TABLE_LOCK(pcb, page));
+   return ret;
+}
+
+/** 
+* @brief Maps a frame that is already filled with the contents of an 
+*  executable page at addr, which must not have been read in yet.
+*
+*  The request made for the page when it was mapped is kept until the page
+*   is freed, as for pages shared by fork.
+* 
+* @param addr An address in the page to map.
+* @param frame The frame to share.
+* 
+* @return ESUCCESS if the page is now present, EFAIL if it was never a 
+*  page of the executable.
+*/
+int mm_share_file_page(void* addr, unsigned long frame)
+{
+   unsigned long page, tflags;
+   page_tablent_t *table_v;
+   pcb_t* pcb = get_pcb();
+   int ret = ESUCCESS;
+   
+   page = PAGE_OF(addr);
+
+   mutex_lock(TABLE_LOCK(pcb, page));
+   table_v = ((page_dirent_t*)pcb->virtual_dir)[ DIR_OFFSET(page) ];
+   tflags = TABLE_PRESENT(((page_dirent_t*)pcb->dir_v)[ DIR_OFFSET(page) ]) 
+      ? FLAGS_OF(table_v[ TABLE_OFFSET(page) ]) : 0;
+   
+   if(!(tflags & PTENT_PRESENT))
+   {
+      if(tflags & PTENT_FILE)
+      {
+         mutex_lock(&user_free_lock);
+         FRAME_REFS(frame)++;
+         table_v[ TABLE_OFFSET(page) ] = 
+            frame | PTENT_PRESENT | (tflags & ~PTENT_FILE);
+         invalidate_page((void*)page);
+         mutex_unlock(&user_free_lock);
       }
+      else ret = EFAIL;
    }
+   mutex_unlock(TABLE_LOCK(pcb, page));
+   return ret;
+}
 
-   /* Unmap the page we used for copying for good measure. */
-   assert(FLAGS_OF(copy_table_v) == 0);
-   copy_table_v[ TABLE_OFFSET(copy_page) ] = 0;
-   invalidate_page((void*)copy_page);
+/** 
+* @brief Frames the executable page at addr, which must not have been read
+*  in yet, with its own frame filled by fill. 
+*
+*  fill is handed the page while it is still mapped read/write to the 
+*   kernel only, so no other thread can see it half filled.
+* 
+* @param addr An address in the page to frame.
+* @param fill Fills the page it is passed.
+* @param frame Set to the new frame, or 0 if the page was already present.
+* 
+* @return ESUCCESS if the page is now present, EFAIL if it was never a 
+*  page of the executable.
+*/
+int mm_fill_file_page(void* addr, void (*fill)(void*), unsigned long* frame)
+{
+   unsigned long page, tflags;
+   page_tablent_t *table_v;
+   pcb_t* pcb = get_pcb();
+   int ret = ESUCCESS;
    
+   page = PAGE_OF(addr);
+   *frame = 0;
+
+   mutex_lock(TABLE_LOCK(pcb, page));
+   table_v = ((page_dirent_t*)pcb->virtual_dir)[ DIR_OFFSET(page) ];
+   tflags = TABLE_PRESENT(((page_dirent_t*)pcb->dir_v)[ DIR_OFFSET(page) ]) 
+      ? FLAGS_OF(table_v[ TABLE_OFFSET(page) ]) : 0;
+   
+   if(!(tflags & PTENT_PRESENT))
+   {
+      if(tflags & PTENT_FILE)
+      {
+         /* The frame was requested when the page was mapped. */
+         *frame = mm_new_frame((unsigned long*)table_v, page, TRUE);
+         fill((void*)page);
+         table_v[ TABLE_OFFSET(page) ] = 
+            *frame | PTENT_PRESENT | (tflags & ~PTENT_FILE);
+         invalidate_page((void*)page);
+      }
+      else ret = EFAIL;
+   }
+   mutex_unlock(TABLE_LOCK(pcb, page));
+   return ret;
+}
+
+/** 
+* @brief Adds a reference to a user frame for a holder outside of any
+*  address space, which must have requested a frame of its own. 
+* 
+* @param frame The frame to reference.
+*/
+void mm_ref_frame(unsigned long frame)
+{
+   mutex_lock(&user_free_lock);
+   assert(FRAME_REFS(frame) > 0);
+   FRAME_REFS(frame)++;
+   mutex_unlock(&user_free_lock);
+}
+
+/**
+* @brief Allocates a zeroed frame for a shared memory segment, which
+*  holds the frame's first reference. The caller must have requested it.
+*
+* @return The physical address of the frame.
+*/
+unsigned long mm_new_shared_frame()
+{
+   unsigned long frame;
+   page_tablent_t* free_table_v;
+   boolean_t zeroed;
+
+   mutex_lock(&user_free_lock);
+   frame = mm_take_frame(TRUE, &zeroed);
+   assert(frame);
+   atomic_add(&n_free_frames, -1);
+   FRAME_REFS(frame) = 1;
+
+   /* The frame belongs to no address space yet, so zero it at the free
+    *  page, which the user free lock protects. */
+   if(!zeroed)
+   {
+      free_table_v = kvm_initial_table();
+      free_table_v[ TABLE_OFFSET(FREE_PAGE) ] =
+         frame | PTENT_PRESENT | PTENT_RW;
+      invalidate_page((void*)FREE_PAGE);
+      memset((void*)FREE_PAGE, 0, PAGE_SIZE);
+      free_table_v[ TABLE_OFFSET(FREE_PAGE) ] = 0;
+   }
+   mutex_unlock(&user_free_lock);
+   return frame;
+}
+
+/**
+* @brief Drops a reference to a user frame held outside of any address
+*  space, along with the request that came with it. The frame is freed
+*  once no one references it.
+*
+* @param frame The frame to release.
+*/
+void mm_unref_frame(unsigned long frame)
+{
+   mutex_lock(&user_free_lock);
+   assert(FRAME_REFS(frame) > 0);
+   if(--FRAME_REFS(frame) > 0)
+   {
+      mutex_unlock(&user_free_lock);
+      mm_release_request(1);
+      return;
+   }
+   mutex_unlock(&user_free_lock);
+
+   frame_free(frame, 0);
+   mm_release_frames(1);
+}
+
+/**
+* @brief Maps the frames of a shared memory segment read/write at addr in
+*  pcb's address space, each of which gains a reference.
+*
+*  The pages are marked PTENT_SHARED, so fork shares them with the child
+*   instead of copying them on write. Each mapping requests a frame of its
+*   own, as pages shared by fork do, so that unmapping them is accounted
+*   the same way.
+*
+* @param pcb The process to map the segment in, which must be current.
+* @param addr The page aligned address to map the segment at. No page of
+*  the range may already belong to the user.
+* @param frames The frames of the segment.
+* @param n The number of frames.
+*
+* @return ESUCCESS on success, ENOVM if the frames could not be requested.
+*/
+int mm_map_shared(pcb_t* pcb, void* addr, unsigned long* frames, int n)
+{
+   page_dirent_t* dir_v = (page_dirent_t*)pcb->dir_v;
+   page_dirent_t* virtual_dir = (page_dirent_t*)pcb->virtual_dir;
+   page_tablent_t* table_v;
+   unsigned long page;
+   int i, kernel_frames;
+
+   assert(n > 0);
+   assert((char*)addr + n * PAGE_SIZE <= (char*)USER_MEM_END);
+   mutex_lock(&pcb->directory_lock);
+
+   kernel_frames = 0;
+   for(i = DIR_OFFSET(addr);
+      i <= DIR_OFFSET((char*)addr + n * PAGE_SIZE - 1); i++)
+   {
+      if(!TABLE_PRESENT(dir_v[i]))
+         kernel_frames++;
+   }
+
+   if(kvm_request_frames(n, kernel_frames) < 0)
+   {
+      mutex_unlock(&pcb->directory_lock);
+      return ENOVM;
+   }
+
+   for(i = 0, page = (unsigned long)addr; i < n; i++, page += PAGE_SIZE)
+   {
+      /* We've already requested the frame - this should never fail. */
+      if(!TABLE_PRESENT(dir_v[ DIR_OFFSET(page) ]))
+         assert(mm_new_table(pcb, (void*)page));
+
+      /* Large pages only ever back regions of their own. */
+      assert(!TABLE_LARGE(dir_v[ DIR_OFFSET(page) ]));
+      table_v = (page_tablent_t*)virtual_dir[ DIR_OFFSET(page) ];
+      assert(!PAGE_MAPPED(table_v[ TABLE_OFFSET(page) ]));
+
+      mutex_lock(&user_free_lock);
+      assert(FRAME_REFS(frames[i]) > 0);
+      FRAME_REFS(frames[i])++;
+      mutex_unlock(&user_free_lock);
+
+      table_v[ TABLE_OFFSET(page) ] = frames[i] |
+         PTENT_PRESENT | PTENT_USER | PTENT_RW | PTENT_SHARED;
+      invalidate_page((void*)page);
+   }
+
+   mutex_unlock(&pcb->directory_lock);
+   return ESUCCESS;
+}
+
+/** 
+* @brief Tries to back the whole directory entry d_index with a single 
+*  4 MB page. Must be called with the directory lock held, in the address
+*  space of pcb.
+*
+*  The page is mapped supervisor only and zeroed. mm_alloc hands it to the
+*   user once the rest of its request has succeeded. Its frames are 
+*   requested like any others, and each holds a reference as usual.
+* 
+* @param pcb The process to map the page in. 
+* @param d_index The directory entry to map, which must not be present.
+* 
+* @return ESUCCESS if the entry is now a large page. Otherwise EFAIL, and 
+*  nothing has changed.
+*/
+static int mm_map_large(pcb_t* pcb, int d_index)
+{
+   unsigned long block, frame;
+   void* page = (void*)PAGE_FROM_INDEX(d_index, 0);
+   page_dirent_t* dir_v = (page_dirent_t*)pcb->dir_v;
+
+   assert(!TABLE_PRESENT(dir_v[d_index]));
+   if(mm_request_frames(TABLE_SIZE) < 0)
+      return EFAIL;
+   if((block = frame_alloc(LARGE_ORDER)) == 0)
+   {
+      mm_release_request(TABLE_SIZE);
+      return EFAIL;
+   }
+
+   mutex_lock(&user_free_lock);
+   for(frame = block; frame < block + LARGE_PAGE_SIZE; frame += PAGE_SIZE)
+      FRAME_REFS(frame) = 1;
+   atomic_add(&n_free_frames, -TABLE_SIZE);
+   mutex_unlock(&user_free_lock);
+
+   debug_print("mm", "Mapping large page %p to frame 0x%lx", page, block);
+   dir_v[d_index] = 
+      (page_dirent_t)(block | PDENT_4MPAGESIZE | PDENT_RW | PDENT_PRESENT);
+   invalidate_page(page);
+   memset(page, 0, LARGE_PAGE_SIZE);
    return ESUCCESS;
 }
 
+/** 
+* @brief Unmaps the 4 MB page at directory entry d_index, and frees its 
+*  frames. Must be called with the directory lock held, or when no one 
+*  else can use the address space.
+*
+*  Large pages are split before they are ever shared, so we hold the only
+*   reference to each of their frames.
+* 
+* @param pcb The process to unmap the page from. 
+* @param d_index The directory entry of the page.
+*/
+static void mm_unmap_large(pcb_t* pcb, int d_index)
+{
+   unsigned long block, frame;
+   page_dirent_t* dir_v = (page_dirent_t*)pcb->dir_v;
+
+   assert(TABLE_LARGE(dir_v[d_index]));
+   block = PAGE_OF(dir_v[d_index]);
+   dir_v[d_index] = 0;
+   ((page_dirent_t*)pcb->virtual_dir)[d_index] = 0;
+   invalidate_page((void*)PAGE_FROM_INDEX(d_index, 0));
+
+   mutex_lock(&user_free_lock);
+   for(frame = block; frame < block + LARGE_PAGE_SIZE; frame += PAGE_SIZE)
+   {
+      assert(FRAME_REFS(frame) == 1);
+      FRAME_REFS(frame) = 0;
+   }
+   mutex_unlock(&user_free_lock);
+
+   frame_free(block, LARGE_ORDER);
+   mm_release_frames(TABLE_SIZE);
+}
+
+/** 
+* @brief Replaces the 4 MB page at directory entry d_index with a table of
+*  4 KB pages that map the same frames. The frame for the table must 
+*  already have been requested.
+* 
+* @param pcb The process to split the page in. 
+* @param d_index The directory entry of the page.
+*/
+static void mm_split_large(pcb_t* pcb, int d_index)
+{
+   unsigned long block, flags;
+   page_tablent_t* table_v;
+   int t_index;
+   void* page = (void*)PAGE_FROM_INDEX(d_index, 0);
+   page_dirent_t* dir_v = (page_dirent_t*)pcb->dir_v;
+
+   block = PAGE_OF(dir_v[d_index]);
+   flags = FLAGS_OF(dir_v[d_index]) & (PDENT_USER | PDENT_RW);
+   
+   /* This always passes, since we've already requested the frame. */
+   table_v = mm_new_table(pcb, page);
+   assert(table_v);
+   
+   for(t_index = 0; t_index < TABLE_SIZE; t_index++)
+      table_v[t_index] = (block + t_index * PAGE_SIZE) | flags | PTENT_PRESENT;
+   invalidate_page(page);
+}
+
 /** 
 * @brief Allocates a page for a new table. 
 *  1. Initializes all of it's entries as non-present.
@@ -361,14 +875,23 @@ void* mm_new_table(pcb_t* pcb, void* addr)
    
    table_p = kvm_vtop(table_v); 
 
+   /* Faults look up the virtual table once they see the entry present. */
+   virtual_dir_v[ DIR_OFFSET(addr) ] = table_v;
    dir_v[ DIR_OFFSET(addr) ] = (page_dirent_t)((unsigned long)table_p 
       | PDENT_USER | PDENT_PRESENT | PDENT_RW);
-      
-   virtual_dir_v[ DIR_OFFSET(addr) ] = table_v;
    return table_v;
 }
 
-void mm_free_table(pcb_t* pcb, void* addr)
+/** 
+* @brief Unmaps the table for addr from the PCB's directories, and frees 
+*  it once no translation can still use it.
+*
+* @param pcb The process to free the table of.
+* @param addr An address the table maps.
+* @param tlb The batch of pages unmapped from the process, which is 
+*  flushed.
+*/
+void mm_free_table(pcb_t* pcb, void* addr, tlb_batch_t* tlb)
 {
    void *table_v;
    
@@ -376,18 +899,29 @@ void mm_free_table(pcb_t* pcb, void* addr)
    page_dirent_t* virtual_dir_v = pcb->virtual_dir;
    table_v = virtual_dir_v[ DIR_OFFSET(addr) ];
 
-   debug_print("mm", "About to free table %p for address %p", table_v, addr);
-   kvm_free_page(table_v);
-   
    virtual_dir_v[ DIR_OFFSET(addr) ] = 0;
    dir_v[ DIR_OFFSET(addr) ] = 0;
+   
+   /* Any invalidation also drops the cached directory entry. */
+   tlb_batch_add(tlb, addr);
+   tlb_batch_flush(tlb);
+
+   debug_print("mm", "About to free table %p for address %p", table_v, addr);
+   kvm_free_page(table_v);
 }
 
 /** 
 * @brief Allocates frames for the address range in the given processes 
 *  address space, with flags indicated by "flags".
 *
-*  The pages will be filled with zeros initially.
+*  The pages will be filled with zeros initially. With PTENT_ZFOD, they 
+*   share the zero frame until they are written, and with PTENT_FILE they 
+*   are not present until they are read in from the executable. Either way
+*   their frames are still requested.
+*
+*  Anonymous (PTENT_ZFOD) memory in the current address space that covers
+*   whole directory entries is instead backed by 4 MB pages, framed right 
+*   away, wherever the frame allocator has the contiguous frames.
 *
 *  Pages that already belong to the user will be skipped, and the 
 *     "flags" value WILL NOT be applied.
@@ -417,6 +951,19 @@ int mm_alloc(pcb_t* pcb, void* addr, size_t len, unsigned int flags)
    /* Determine the resources for this request in advance. */
    mutex_lock(&pcb->directory_lock);
 
+   /* Large pages are requested and framed first, but stay out of the 
+    *  user's reach until the rest of the request has succeeded. */
+   if((flags & PTENT_ZFOD) && (flags & PTENT_RW) && 
+         get_cr3() == (unsigned long)pcb->dir_p)
+   {
+      for(i = DIR_OFFSET(addr + LARGE_PAGE_SIZE - 1); 
+         i < DIR_OFFSET(addr + len); i++)
+      {
+         if(!TABLE_PRESENT(dir_v[i]))
+            mm_map_large(pcb, i);
+      }
+   }
+
    /* Determine how many pages we will need. */
    user_frames = 0;
    for(page = PAGE_OF(addr);  
@@ -425,11 +972,11 @@ int mm_alloc(pcb_t* pcb, void* addr, size_t len, unsigned int flags)
       table_p = (page_tablent_t*)dir_v[ DIR_OFFSET(page) ];
       if(!TABLE_PRESENT(table_p))
          user_frames++;
-      else
+      else if(!TABLE_LARGE(table_p))
       {
          table_v = (page_tablent_t*)virtual_dir[ DIR_OFFSET(page) ];
          assert(FLAGS_OF(table_v) == 0);
-         if(!PAGE_PRESENT(table_v[ TABLE_OFFSET(page) ])) 
+         if(!PAGE_MAPPED(table_v[ TABLE_OFFSET(page) ])) 
             user_frames++;
       }
    }
@@ -446,6 +993,11 @@ int mm_alloc(pcb_t* pcb, void* addr, size_t len, unsigned int flags)
    if(kvm_request_frames(user_frames, kernel_frames) < 0)
    {
       debug_print("mm", "Failed request in mm_alloc!");
+      for(i = DIR_OFFSET(addr); i <= DIR_OFFSET(addr + len - 1); i++)
+      {
+         if(TABLE_LARGE(dir_v[i]) && !(FLAGS_OF(dir_v[i]) & PDENT_USER))
+            mm_unmap_large(pcb, i);
+      }
       mutex_unlock(&pcb->directory_lock);
       return ENOVM;
    }
@@ -454,6 +1006,8 @@ int mm_alloc(pcb_t* pcb, void* addr, size_t len, unsigned int flags)
       page <= PAGE_OF(addr + len - 1); page += PAGE_SIZE) 
    {
       table_p = (page_tablent_t*)dir_v[ DIR_OFFSET(page) ];
+      if(TABLE_LARGE(table_p))
+         continue;
       
       /* We've already requested the frame - this should never fail. */
       if(!TABLE_PRESENT(table_p))
@@ -467,18 +1021,30 @@ int mm_alloc(pcb_t* pcb, void* addr, size_t len, unsigned int flags)
        *      in order of priority, and that flags set by previous users will 
        *      be correct. 
        */
-      if(PAGE_PRESENT((table_v[ TABLE_OFFSET(page) ]))) 
+      if(PAGE_MAPPED((table_v[ TABLE_OFFSET(page) ]))) 
          continue;
 
-      if(flags & PTENT_ZFOD)
+      if(flags & PTENT_FILE)
       {
+         /* Not present until the page is first touched and read in. */
+         table_v[ TABLE_OFFSET(page) ] = (flags & ~PTENT_PRESENT);
+         invalidate_page((void*)page);
+         continue;
+      }
+      else if(flags & PTENT_ZFOD)
+      {
+         /* Read only until the first write gives the page its own frame. */
          debug_print("mm", "Mapping ZFOD frame!");
          frame = (unsigned long)ZFOD_FRAME;
+         table_v[ TABLE_OFFSET(page) ] = 
+            (frame | PTENT_PRESENT | (flags & ~PTENT_RW));
+         invalidate_page((void*)page);
+         continue;
       }
       else
       {
          /* Allocate the free page, but keep it in supervisor mode for now. */
-         frame = mm_new_frame((unsigned long*)table_v, page);
+         frame = mm_new_frame((unsigned long*)table_v, page, TRUE);
       }
       
       /* Reassign the page with the flags the user originally asked for. */
@@ -488,40 +1054,20 @@ int mm_alloc(pcb_t* pcb, void* addr, size_t len, unsigned int flags)
          
       invalidate_page((void*)page);
    }
+
+   /* Hand the large pages over to the user. */
+   for(i = DIR_OFFSET(addr); i <= DIR_OFFSET(addr + len - 1); i++)
+   {
+      if(TABLE_LARGE(dir_v[i]) && !(FLAGS_OF(dir_v[i]) & PDENT_USER))
+      {
+         dir_v[i] = (page_dirent_t)((unsigned long)dir_v[i] | PDENT_USER);
+         invalidate_page((void*)PAGE_FROM_INDEX(i, 0));
+      }
+   }
    mutex_unlock(&pcb->directory_lock);
    return 0;
 } 
 
-void mm_frame_zfod_page(void* addr)
-{
-   unsigned long page, frame;
-   long tflags;
-
-   pcb_t* pcb = get_pcb();
-   page = PAGE_OF(addr);
-   
-   /* Navigate and check the current page tables. */
-   page_dirent_t* dir_v = (page_dirent_t*) pcb->dir_v;
-   page_dirent_t* virtual_dir_v = (page_dirent_t*) pcb->virtual_dir;
-   page_tablent_t* table_p = dir_v[ DIR_OFFSET(page) ];
-   page_tablent_t* table_v = virtual_dir_v[ DIR_OFFSET(page) ];
-   
-   /* Assert that we are actually framing a ZFOD page. */
-   assert(FLAGS_OF(table_v) == 0);
-   assert(TABLE_PRESENT(table_p));
-   tflags = FLAGS_OF(table_v[ TABLE_OFFSET(page) ]);
-   assert(tflags & PTENT_ZFOD);
-   
-   /* Allocate the free page, but keep it in supervisor mode for now. */
-   frame = mm_new_frame((unsigned long*)table_v, page);
-   table_v[ TABLE_OFFSET(page) ] = 
-      ~PTENT_ZFOD & ((unsigned long) frame | PTENT_RW | tflags);
-   invalidate_page((void*)page);
-
-   /* You are hereby a real page. mazel-tov */
-}
-
-
 /** 
 * @brief Removes pages from the currently running processes address space. 
 *
@@ -535,6 +1081,9 @@ void mm_remove_pages(pcb_t* pcb, void* start, void* end)
 {
    page_dirent_t *dir_v, *virtual_dir_v;
    page_tablent_t *table_v, *table_p;
+   unsigned long frame, batch[FRAME_BATCH];
+   int n_batch = 0;
+   tlb_batch_t tlb;
    void* page;
    
    assert(((unsigned int)start & PAGE_MASK) == 0);
@@ -545,17 +1094,70 @@ void mm_remove_pages(pcb_t* pcb, void* start, void* end)
    dir_v = (page_dirent_t*)pcb->dir_v;
    virtual_dir_v = (page_dirent_t*)pcb->virtual_dir;
    
+   tlb_batch_init(&tlb, pcb);
    mutex_lock(&pcb->directory_lock);
    for(page = start; page < end; page += PAGE_SIZE)
    {
       table_p = dir_v[ DIR_OFFSET(page) ]; 
       assert(TABLE_PRESENT(table_p));
+      if(TABLE_LARGE(table_p))
+      {
+         mm_unmap_large(pcb, DIR_OFFSET(page));
+         page += LARGE_PAGE_SIZE - PAGE_SIZE;
+         continue;
+      }
       table_v = (page_tablent_t*)virtual_dir_v[ DIR_OFFSET(page) ];
-      assert(mm_free_frame(table_v, (unsigned long)page) >= 0);
+      assert(PAGE_MAPPED(table_v[ TABLE_OFFSET(page) ]));
+      mutex_lock(TABLE_LOCK(pcb, page));
+      frame = mm_unmap_frame(table_v, (unsigned long)page, &tlb);
+      mutex_unlock(TABLE_LOCK(pcb, page));
+      if(frame == 0)
+         continue;
+      batch[n_batch++] = frame;
+      if(n_batch == FRAME_BATCH)
+         mm_free_batch(batch, &n_batch, &tlb);
    }
+   mm_free_batch(batch, &n_batch, &tlb);
    mutex_unlock(&pcb->directory_lock);
 }
 
+/** 
+* @brief Checks whether the current process may now make an access that 
+*  faulted. Another thread may have framed or filled the page while we 
+*  faulted on it, publishing it to the user only once it was ready, so 
+*  this waits on the page's table lock before reading its entry.
+* 
+* @param addr The faulting address.
+* @param write True if the access was a write.
+* 
+* @return True if the page now grants the access.
+*/
+boolean_t mm_fault_resolved(void* addr, boolean_t write)
+{
+   unsigned long page, flags, need;
+   page_dirent_t *dir_v;
+   page_tablent_t *table_v;
+   pcb_t* pcb = get_pcb();
+   
+   page = PAGE_OF(addr);
+   dir_v = (page_dirent_t*)pcb->dir_v;
+   need = PTENT_PRESENT | PTENT_USER | (write ? PTENT_RW : 0);
+
+   mutex_lock(TABLE_LOCK(pcb, page));
+   if(!TABLE_PRESENT(dir_v[ DIR_OFFSET(page) ]))
+      flags = 0;
+   else if(TABLE_LARGE(dir_v[ DIR_OFFSET(page) ]))
+      flags = FLAGS_OF(dir_v[ DIR_OFFSET(page) ]);
+   else
+   {
+      table_v = ((page_dirent_t*)pcb->virtual_dir)[ DIR_OFFSET(page) ];
+      flags = FLAGS_OF(table_v[ TABLE_OFFSET(page) ]);
+   }
+   mutex_unlock(TABLE_LOCK(pcb, page));
+   
+   return TEST_SET(flags, need);
+}
+
 /** 
 * @brief Returns the flags for the page "addr" is in.
 * 
@@ -577,7 +1179,9 @@ int mm_getflags(void* addr)
    page_tablent_t* table_v = virtual_dir_v[ DIR_OFFSET(page) ];
    assert(FLAGS_OF(table_v) == 0);
    
-   if(TABLE_PRESENT(table_p))
+   if(TABLE_LARGE(table_p))
+      return FLAGS_OF(table_p) & ~PDENT_4MPAGESIZE;
+   else if(TABLE_PRESENT(table_p))
    {
       tflags = FLAGS_OF(table_v[ TABLE_OFFSET(page) ]);
       return tflags;
@@ -592,6 +1196,8 @@ int mm_getflags(void* addr)
  *        - Writable
  *        - User
  *
+ *    ZFOD and copy-on-write pages in the region are framed along the way.
+ *
  *    The rule of thumb is - if a user can't write somewhere, 
  *     we shouldn't accidentally do it for them.
  *
@@ -606,6 +1212,15 @@ boolean_t mm_validate_write(void *addr, int len)
    int i;
    for (i = 0; i < npages; i++) {
       int tflags = mm_getflags((void*)addr + i*PAGE_SIZE);
+      
+      /* ZFOD and copy-on-write pages are writable once they are framed,
+       *  by us or by another thread while we waited. */
+      if(tflags > 0 && (tflags & (PTENT_ZFOD | PTENT_COW)))
+      {
+         mm_resolve_write((void*)addr + i*PAGE_SIZE);
+         tflags = mm_getflags((void*)addr + i*PAGE_SIZE);
+      }
+
       if(tflags <= 0 || 
             !TEST_SET(tflags, (PTENT_PRESENT | PTENT_RW | PTENT_USER)))
          return FALSE;
@@ -633,8 +1248,10 @@ void* mm_new_kp_page()
 }
 
 /** 
-* @brief Serializes frame requests to check if the 
-*  demands can be met. 
+* @brief Reserves n frames, if that many are free and unrequested. 
+*
+*  The reservation is a single compare and swap, retried only if another 
+*   request or release changed the count in between.
 * 
 * @param n The number of frames we are requesting. 
 * 
@@ -643,44 +1260,138 @@ void* mm_new_kp_page()
 */
 int mm_request_frames(int n)
 {
-   int ret = ENOVM;
+   int available;
    
    if(n == 0) return ESUCCESS;
 
-   mutex_lock(&request_lock);
-   if((n_user_frames - n) >= 0)
+   do
    {
-      n_user_frames -= n;
-      ret = ESUCCESS;
+      available = n_user_frames;
+      if(available - n < 0)
+         return ENOVM;
+   } while(atomic_cas(&n_user_frames, available, available - n) != available);
+
+   return ESUCCESS;
+}
+
+/** 
+* @brief Returns n requested frames that were never allocated. 
+*/
+static void mm_release_request(int n)
+{
+   atomic_add(&n_user_frames, n);
+}
+
+/** 
+* @brief Takes a requested frame from the free frames.
+*
+*  Callers that need the frame zeroed get one from the idle thread's pool 
+*   when there is one. Everyone else leaves the pool alone, unless it holds
+*   the only free frames left.
+* 
+* @param zero True if the caller needs the frame zeroed.
+* @param zeroed Set to true if the frame is known to be zero.
+* 
+* @return The physical address of the frame.
+*/
+static unsigned long mm_take_frame(boolean_t zero, boolean_t* zeroed)
+{
+   unsigned long frame = 0;
+   *zeroed = FALSE;
+
+   quick_lock();
+   if(zero && n_zero_pool > 0)
+   {
+      frame = zero_pool[--n_zero_pool];
+      *zeroed = TRUE;
+      zero_hits++;
    }
-   mutex_unlock(&request_lock);
-   assert(n_user_frames <= n_free_frames);
-   return ret;
+   else if(zero) zero_misses++;
+   quick_unlock();
+   
+   /* Every free frame left may be sitting in the pool. */
+   if(frame == 0 && (frame = frame_alloc(0)) == 0)
+   {
+      quick_lock();
+      assert(n_zero_pool > 0);
+      frame = zero_pool[--n_zero_pool];
+      *zeroed = TRUE;
+      quick_unlock();
+   }
+   return frame;
+}
+
+/** 
+* @brief Zeroes a free frame into the pool of pre-zeroed frames, if the 
+*  pool has room. Called over and over by the idle thread, so it never 
+*  blocks, and frames are only ever added to the pool here.
+*
+* @return True if a frame was zeroed, false if the pool is full or no frame 
+*  could be taken without blocking.
+*/
+boolean_t mm_zero_idle()
+{
+   unsigned long frame;
+   page_tablent_t* free_table_v;
+
+   if(n_zero_pool >= ZERO_POOL_SIZE || (frame = frame_alloc_nowait()) == 0)
+      return FALSE;
+   
+   /* Nobody else maps frames at the zero page. */
+   free_table_v = kvm_initial_table();
+   free_table_v[ TABLE_OFFSET(ZERO_PAGE) ] = frame | PTENT_PRESENT | PTENT_RW;
+   invalidate_page(ZERO_PAGE);
+   memset(ZERO_PAGE, 0, PAGE_SIZE);
+   
+   /* As with the free page, the next use invalidates the zero page. */
+   free_table_v[ TABLE_OFFSET(ZERO_PAGE) ] = 0;
+
+   quick_lock();
+   zero_pool[n_zero_pool++] = frame;
+   quick_unlock();
+   return TRUE;
+}
+
+/** 
+* @brief Reports how many allocations of zeroed frames were served from 
+*  the pre-zeroed pool, and how many had to zero a frame themselves.
+* 
+* @param hits Set to the number served from the pool.
+* @param misses Set to the number zeroed by hand.
+*/
+void mm_zero_stats(unsigned long* hits, unsigned long* misses)
+{
+   quick_lock();
+   *hits = zero_hits;
+   *misses = zero_misses;
+   quick_unlock();
 }
 
 /** 
 * @brief Safely allocates a new frame.
 *  1. Allocates a new frame for the current process.
 *  2. Maps that frame to the place indicated by "page" in rw/supervisor mode.
-*  3. Uses the new mapping to update the free list.
+*  3. Uses the new mapping to zero the frame.
 *
 *  ASSUMES table_v is in the current address space. 
 * 
 * @param table_v The page table that "page" belongs to. 
 * @param page The page to map. 
+* @param zero True if the caller needs the frame zeroed.
 * 
 * @return The physical address of the new frame.
 */
-unsigned long mm_new_frame(unsigned long* table_v, unsigned long page)
+unsigned long mm_new_frame(unsigned long* table_v, unsigned long page, 
+   boolean_t zero)
 {
    unsigned long new_frame;
-   free_block_t* free_block;
+   boolean_t zeroed;
    
    assert(FLAGS_OF(table_v) == 0);
    assert(FLAGS_OF(page) == 0);
    
    mutex_lock(&user_free_lock);
-   new_frame = (unsigned long)user_free_list;
+   new_frame = mm_take_frame(zero, &zeroed);
    
    /* Calls to mm_new_frame should have already requested the frames. 
     *  and done something appropriate if the resources weren't available. */
@@ -689,81 +1400,121 @@ unsigned long mm_new_frame(unsigned long* table_v, unsigned long page)
    table_v[ TABLE_OFFSET(page) ] = new_frame | PTENT_PRESENT | PTENT_RW; 
    invalidate_page((void*)page);
    
-   free_block = (free_block_t*)page;
-   user_free_list = free_block->next;
-   n_free_frames--;
-   assert(n_user_frames <= n_free_frames);
+   atomic_add(&n_free_frames, -1);
+   FRAME_REFS(new_frame) = 1;
       
    mutex_unlock(&user_free_lock);
 
-   memset((void*)page, 0, PAGE_SIZE);
+   if(zero && !zeroed)
+      memset((void*)page, 0, PAGE_SIZE);
    return new_frame;
 }
 
 /** 
-* @brief Releases a frame into the free frame pool.
+* @brief Unmaps page, and drops its reference to its frame. 
+*
+*  Pages that never had a frame of their own, and frames that some other 
+*   address space still maps, only return their request. Otherwise the 
+*   frame is returned for the caller to free and release.
 *
 * table_v is not required to be in the current address space. 
 *
 * @param table The page table the page occupies. 
-* @param page The page to free from the address space associated with table. 
+* @param page The page to unmap from the address space associated with table. 
+* @param tlb The batch to add the page to. It must be flushed before the 
+*  frame is freed.
 * 
-* @return 0 on success, a negative integer on failure. 
+* @return The frame, if no one maps it any more. Otherwise 0.
 */
-unsigned long mm_free_frame(unsigned long* table_v, unsigned long page)
+static unsigned long mm_unmap_frame(unsigned long* table_v, unsigned long page,
+   tlb_batch_t* tlb)
 {
-   free_block_t* node;
    unsigned long frame, flags;
    
    assert(FLAGS_OF(table_v) == 0);
    assert(FLAGS_OF(page) == 0);
 
-   page_tablent_t* free_table_v = kvm_initial_table();
-
    frame = table_v[ TABLE_OFFSET(page) ];
    flags = FLAGS_OF(frame);
-   if(!PAGE_PRESENT(frame)) 
-      return -1;
+   assert(PAGE_MAPPED(frame));
    
    frame = PAGE_OF(frame);
    table_v[ TABLE_OFFSET(page) ] = 0;
-   invalidate_page((void*)page);
+   tlb_batch_add(tlb, (void*)page);
    
-   /* The frame was requested, but never written to. */
-   if(flags & PTENT_ZFOD)
+   /* The frame was requested, but never written to or read in. */
+   if((flags & PTENT_ZFOD) || !(flags & PTENT_PRESENT))
    {
-      mutex_lock(&request_lock);
-      n_user_frames++;
-      assert(n_user_frames <= n_free_frames);
-      mutex_unlock(&request_lock);
+      mm_release_request(1);
       return 0;
    }
 
-   /* This frame should now be invisible to the process. */
+   /* Someone else still maps the frame, so only the request goes back. */
    mutex_lock(&user_free_lock);
+   assert(FRAME_REFS(frame) > 0);
+   if(--FRAME_REFS(frame) > 0)
+   {
+      mutex_unlock(&user_free_lock);
+      mm_release_request(1);
+      return 0;
+   }
+   mutex_unlock(&user_free_lock);
    
-   assert(FLAGS_OF(free_table_v) == 0);
-   free_table_v[ TABLE_OFFSET(FREE_PAGE) ] = frame | PTENT_PRESENT | PTENT_RW; 
-   invalidate_page((void*)FREE_PAGE);
-   
-   node = (free_block_t*) FREE_PAGE;
-   node->next = user_free_list;
-   user_free_list = (free_block_t*)frame;
-   
-   /* All allocations are proceeded by a request.*/
-   assert(user_free_list != NULL);
+   return frame;
+}
 
-   free_table_v[ TABLE_OFFSET(FREE_PAGE) ] = 0;
-   invalidate_page((void*)FREE_PAGE);
-   mutex_unlock(&user_free_lock);
+/** 
+* @brief Returns a batch of frames from mm_unmap_frame, and their requests,
+*  to the pool, and empties the batch. The pages the frames were mapped at
+*  are invalidated first.
+*
+* @param batch The frames to free.
+* @param n The number of frames in the batch, set to 0.
+* @param tlb The pages unmapped, which is flushed.
+*/
+static void mm_free_batch(unsigned long* batch, int* n, tlb_batch_t* tlb)
+{
+   tlb_batch_flush(tlb);
+   if(*n == 0) return;
+   frame_free_batch(batch, *n);
+   mm_release_frames(*n);
+   *n = 0;
+}
+
+/** 
+* @brief Accounts for n frames, and their requests, going back to the pool.
+*/
+static void mm_release_frames(int n)
+{
+   /* The frames must be free before anyone can request them. */
+   atomic_add(&n_free_frames, n);
+   atomic_add(&n_user_frames, n);
+}
 
-   mutex_lock(&request_lock);
-   n_user_frames++;
-   n_free_frames++;
-   assert(n_user_frames <= n_free_frames);
-   mutex_unlock(&request_lock);
+/** 
+* @brief Releases a frame into the free frame pool.
+*
+* table_v is not required to be in the current address space. 
+*
+* @param table The page table the page occupies. 
+* @param page The page to free from the address space associated with table. 
+* 
+* @return 0 on success, a negative integer on failure. 
+*/
+unsigned long mm_free_frame(unsigned long* table_v, unsigned long page)
+{
+   unsigned long frame;
+   int n = 1;
+   tlb_batch_t tlb;
+   
+   if(!PAGE_MAPPED(table_v[ TABLE_OFFSET(page) ])) 
+      return -1;
    
+   /* Kernel pages are global. */
+   tlb_batch_init(&tlb, page >= USER_MEM_END ? NULL : get_pcb());
+   if((frame = mm_unmap_frame(table_v, page, &tlb)) != 0)
+      mm_free_batch(&frame, &n, &tlb);
+   else
+      tlb_batch_flush(&tlb);
    return 0;
 }
-
-
@@ -0,0 +1,108 @@
+/** 
+* @file pagecache.c
+*
+* @brief Reads the text and rodata pages of executables in on demand, and
+*  shares them between every process running the same executable.
+*
+* The first process to touch a page reads it into a frame of its own, and
+*  the cache takes a reference to that frame. Afterwards, every process 
+*  touching the same page of the same executable maps the cached frame read
+*  only. Cached frames are never evicted, so the cache is bounded by the 
+*  size of the RAM disk.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#include <pagecache.h>
+#include <mm.h>
+#include <mm_internal.h>
+#include <loader.h>
+#include <process.h>
+#include <mutex.h>
+#include <malloc.h>
+#include <ecodes.h>
+#include <debug.h>
+
+/** @brief The cached pages. */
+static pagecache_entry_t* pagecache[PAGECACHE_BUCKETS];
+
+/** @brief Protects the cache, and orders the first read of each page. */
+static mutex_t pagecache_lock;
+
+/**
+* @brief Initialize the page cache.
+*/
+void pagecache_init()
+{
+   mutex_init(&pagecache_lock);
+}
+
+/**
+* @brief Read the page of the current executable mapped at page.
+*
+* @param page The page to fill.
+*/
+static void pagecache_fill(void* page)
+{
+   read_text_range(&get_pcb()->elf, page, (unsigned long)page, 
+      (unsigned long)page + PAGE_SIZE);
+}
+
+/**
+* @brief Map the text or rodata page containing addr into the current 
+*  process, reading it in if no process has yet.
+*
+* @param addr An address in the page.
+*
+* @return ESUCCESS if the page is now present, EFAIL if it is not a page of
+*  the executable.
+*/
+int pagecache_map(void* addr)
+{
+   const char* exec = get_pcb()->elf.e_fname;
+   unsigned long page = PAGE_OF(addr);
+   unsigned long frame;
+   pagecache_entry_t* entry;
+   pagecache_entry_t** bucket = &pagecache[PAGECACHE_HASH(exec, page)];
+   int ret;
+
+   mutex_lock(&pagecache_lock);
+   for(entry = *bucket; entry; entry = entry->next)
+   {
+      if(entry->exec == exec && entry->page == page)
+      {
+         ret = mm_share_file_page(addr, entry->frame);
+         mutex_unlock(&pagecache_lock);
+         return ret;
+      }
+   }
+
+   if((ret = mm_fill_file_page(addr, pagecache_fill, &frame)) < 0 || 
+         frame == 0)
+   {
+      mutex_unlock(&pagecache_lock);
+      return ret;
+   }
+
+   /* The cache's reference needs a frame requested for it. Without one, 
+    *  the page just stays private. */
+   if((entry = smalloc(sizeof(pagecache_entry_t))) != NULL)
+   {
+      if(mm_request_frames(1) == ESUCCESS)
+      {
+         mm_ref_frame(frame);
+         entry->exec = exec;
+         entry->page = page;
+         entry->frame = frame;
+         entry->next = *bucket;
+         *bucket = entry;
+         debug_print("pagecache", "Cached %s page %p in frame 0x%lx", 
+            exec, (void*)page, frame);
+      }
+      else sfree(entry, sizeof(pagecache_entry_t));
+   }
+   
+   mutex_unlock(&pagecache_lock);
+   return ESUCCESS;
+}
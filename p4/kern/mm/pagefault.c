@@ -9,6 +9,7 @@
 #include <process.h>
 #include <cr.h>
 #include <mutex.h>
+#include <rwlock.h>
 #include <mm.h>
 #include <simics.h>
 #include <debug.h>
@@ -19,6 +20,8 @@
 #include <ureg.h>
 #include <swexn.h>
 #include <idt.h>
+#include <pagecache.h>
+#include <region.h>
 
 #define PF_ECODE_NOT_PRESENT 0x1
 #define PF_ECODE_WRITE 0x2
@@ -31,8 +34,10 @@ void generic_fault(void* addr, int ecode);
 /** 
 * @brief Page fault handler. 
 *
-*  Determines what region of user memory caused the fault, 
-*   and dispatches the appropriate handler. 
+*  Resolves ZFOD and copy-on-write faults, and grows the stack down to 
+*   faults just below it, otherwise determines what 
+*   region of user memory caused the fault, and dispatches the appropriate
+*   handler. 
 *  
 *  On entry, interrupts are disabled, so %cr2 doesn't change
 *     (as a result of another page fault.)
@@ -41,7 +46,7 @@ void generic_fault(void* addr, int ecode);
 */
 void page_fault_handler(ureg_t* reg)
 {
-   int ecode; 
+   int ecode, flags, grown; 
    void* addr;
    pcb_t* pcb;
    region_t* region;
@@ -55,33 +60,60 @@ void page_fault_handler(ureg_t* reg)
    /* Our kernel does not page fault. */
    assert(ecode & PF_ECODE_USER);
    assert(!(ecode & PF_ECODE_RESERVED));
+
+   /* Another thread may have been framing or filling the page, and has
+    *  finished with it by now. */
+   if(mm_fault_resolved(addr, (ecode & PF_ECODE_WRITE) != 0))
+      return;
+
+   /* Writes to ZFOD pages and pages shared by fork are not the user's 
+    *  fault, so they are resolved before any software exception handler 
+    *  sees them. (Bit 0 of the error code is set when the page was 
+    *  present.) */
+   if((ecode & PF_ECODE_WRITE) && (ecode & PF_ECODE_NOT_PRESENT) &&
+         mm_resolve_write(addr) == ESUCCESS)
+      return;
    
-   swexn_try_invoke_handler(reg);
+   /* Nor are accesses just below the stack, which grows to cover them. */
+   if(!(ecode & PF_ECODE_NOT_PRESENT))
+   {
+      rwlock_lock_read(&pcb->new_pages_lock);
+      grown = region_grow(pcb, addr);
+      rwlock_unlock_read(&pcb->new_pages_lock);
+      if(grown == ESUCCESS)
+         return;
+   }
+   
+   /* Neither are pages of the executable that have not been read in yet, 
+    *  so their region's handler reads them in before swexn. */
+   flags = mm_getflags(addr);
+   if((ecode & PF_ECODE_NOT_PRESENT) || flags <= 0 || !(flags & PTENT_FILE))
+      swexn_try_invoke_handler(reg);
    
-   void (*handler)(void*, int);
+   void (*handler)(void*, int) = generic_fault;
 
-   mutex_lock(&pcb->region_lock);
-   for(region = pcb->regions; region; region = region->next)
+   rwlock_lock_read(&pcb->region_lock);
+   if((region = region_find(pcb, addr)) != NULL)
    {
-      if(region->start <= addr && addr < region->end)
-      {
-         debug_print("page",
-            "fault at %p being handled by region %p with start %p and end %p",
-            addr, region, region->start, region->end);
-         handler = region->fault;
-         mutex_unlock(&pcb->region_lock);
-         handler(addr, ecode);
-         return;
-      }
+      debug_print("page",
+         "fault at %p being handled by region %p with start %p and end %p",
+         addr, region, region->start, region->end);
+      handler = region->fault;
    }
-   mutex_unlock(&pcb->region_lock);
+   /* A region that could not grow down to addr handles the fault, 
+    *  unless some other region contains it. */
+   else if((region = region_grower(pcb, addr)) != NULL)
+      handler = region->fault;
+   rwlock_unlock_read(&pcb->region_lock);
 
-   debug_print("page", "fault at %p being handled by generic fault", addr);
-   generic_fault(addr, ecode);
+   if(handler == generic_fault)
+      debug_print("page", "fault at %p being handled by generic fault", addr);
+   handler(addr, ecode);
 }
 
 /** 
 * @brief The fault handler invoked by a page fault on the .txt region. 
+*  Reads the page in from the page cache on first access.
 * 
 * @param addr The address that caused the fault. 
 * @param ecode The error code of the fault. 
@@ -90,12 +122,19 @@ void txt_fault(void* addr, int ecode)
 {
    char errbuf[ERRBUF_SIZE];
    debug_print("page", ".txt fault at %p!!!", addr);
+
+   /* The page has not been read in yet. */
+   if(!(ecode & PF_ECODE_NOT_PRESENT) && pagecache_map(addr) == ESUCCESS)
+      return;
+
+
    sprintf(errbuf, "Page Fault: Illegal access to .txt region at %p.", addr);
    thread_kill(errbuf);
 }
 
 /** 
 * @brief The fault handler invoked by a page fault on the .rodat region. 
+*  Reads the page in from the page cache on first access.
 * 
 * @param addr The address that caused the fault. 
 * @param ecode The error code of the fault. 
@@ -104,6 +143,12 @@ void rodata_fault(void* addr, int ecode)
 {
    char errbuf[ERRBUF_SIZE];
    debug_print("page", ".rodat fault at %p!!!", addr);
+
+   /* The page has not been read in yet. */
+   if(!(ecode & PF_ECODE_NOT_PRESENT) && pagecache_map(addr) == ESUCCESS)
+      return;
+
+
    sprintf(errbuf, 
       "Page Fault: Illegal access to .rodata region at %p.", addr);
    thread_kill(errbuf);
@@ -134,13 +179,7 @@ void bss_fault(void* addr, int ecode)
    char errbuf[ERRBUF_SIZE];
    debug_print("page", "bss fault at %p!!!", addr);
    
-   if(ecode & PF_ECODE_WRITE)
-   {
-      debug_print("page", "Framing ZFOD page!", addr);
-      mm_frame_zfod_page(addr);
-      return;
-   }
-
+   /* Writes to ZFOD pages never make it here. */
    sprintf(errbuf, "Page Fault: Illegal access to .bss region at %p.", addr);
    thread_kill(errbuf);
 }
@@ -157,17 +196,19 @@ void user_fault(void* addr, int ecode)
     *
     *  It is the fault handler for memory that has been new_pages'd. 
     *   Since new_pages'd regions don't overlap with existing regions, 
-    *   and are allocated user r/w, they do not fault. 
+    *   and are allocated user r/w (ZFOD writes are resolved by 
+    *   page_fault_handler), they do not fault. 
     *    (unless things are going wrong.)
     **/
    assert(0);
 }
 
 /** 
-* @brief The fault handler invoked by a page fault in the stack region. 
+* @brief The fault handler invoked by a page fault in the stack region,
+*  or below it when the stack could not grow to cover the address.
 *
-*  Since stack frames are generally user R/W - this is generally impossible
-*   under our currently non-fancy framework.
+*  Since stack frames are generally user R/W, and page_fault_handler 
+*   grows the stack before we are called, this is a stack overflow. 
 *
 * @param addr The address that caused the fault. 
 * @param ecode The error code of the fault. 
@@ -176,7 +217,12 @@ void stack_fault(void* addr, int ecode)
 {
    char errbuf[ERRBUF_SIZE];
    debug_print("page", "stack fault at %p!!!", addr);
-   sprintf(errbuf, "Page Fault: Illegal access to stack region at %p.", addr);
+
+   if(!(ecode & PF_ECODE_NOT_PRESENT))
+      sprintf(errbuf, "Page Fault: Stack overflow at %p.", addr);
+   else
+      sprintf(errbuf, "Page Fault: Illegal access to stack region at %p.", 
+         addr);
    thread_kill(errbuf);
 }
 
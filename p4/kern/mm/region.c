@@ -1,14 +1,24 @@
 /** 
 * @file region.c
-* @brief A simple region list manager. 
+* @brief A simple region manager. 
 *
-* The region list helps with management of user memory. 
+* The regions help with management of user memory. 
 *
-* This region list and this file are responsible for 
-*  - allocating regions (which may overlap)
+* This file is responsible for 
+*  - allocating regions (which never overlap)
 *  - dispatching the correct page fault handler
 *  - checking for allocated memory in new_pages
 *
+* The regions of a process are kept in an AVL tree keyed by their start, 
+*  where each node also records the highest end in its subtree. Since 
+*  regions never overlap, finding the region containing an address is a 
+*  search for the last region starting at or below it, and overlap tests
+*  skip any subtree ending below the range.
+*
+* Each thread remembers the region its last lookup found, which is good as
+*  long as no region has been freed since. pcb->region_gen counts the 
+*  regions freed.
+*
 * @author Justin Scheiner
 * @author Tim Wilson 
 * @date 2010-11-03
@@ -21,28 +31,281 @@
 #include <simics.h>
 #include <malloc.h>
 #include <mutex.h>
+#include <rwlock.h>
 #include <pagefault.h>
 #include <string.h>
 #include <debug.h>
 #include <ecodes.h>
 #include <malloc_wrappers.h>
 #include <thread.h>
+#include <shm.h>
+
+static int region_height(region_t* region);
+static void region_update(region_t* region);
+static region_t* region_rotate_left(region_t* region);
+static region_t* region_rotate_right(region_t* region);
+static region_t* region_balance(region_t* region);
+static region_t* region_insert(region_t* root, region_t* region);
+static region_t* region_remove_min(region_t* root, region_t** min);
+static region_t* region_remove(region_t* root, region_t* region);
+static region_t* region_above(pcb_t* pcb, void* addr);
+static region_t* region_below(pcb_t* pcb, void* addr);
+static boolean_t region_tree_overlaps(region_t* root, char* start, char* end);
+static region_t* region_tree_clone(region_t* root);
+static void region_tree_free(region_t* root);
 
 /** 
-* @brief Allocates a new region in the address space in PCB.
+* @brief The height of a subtree of regions.
+*/
+static int region_height(region_t* region)
+{
+   return region ? region->height : 0;
+}
+
+/** 
+* @brief Recomputes the height and highest end of a region's subtree from
+*  its children.
+*
+* @param region The root of the subtree.
+*/
+static void region_update(region_t* region)
+{
+   int left = region_height(region->left); 
+   int right = region_height(region->right);
+   
+   region->height = 1 + (left > right ? left : right);
+   region->max_end = region->end;
+   if(region->left && region->left->max_end > region->max_end)
+      region->max_end = region->left->max_end;
+   if(region->right && region->right->max_end > region->max_end)
+      region->max_end = region->right->max_end;
+}
+
+/** 
+* @brief Rotates a subtree left, returning its new root.
+*/
+static region_t* region_rotate_left(region_t* region)
+{
+   region_t* right = region->right;
+   region->right = right->left;
+   right->left = region;
+   region_update(region);
+   region_update(right);
+   return right;
+}
+
+/** 
+* @brief Rotates a subtree right, returning its new root.
+*/
+static region_t* region_rotate_right(region_t* region)
+{
+   region_t* left = region->left;
+   region->left = left->right;
+   left->right = region;
+   region_update(region);
+   region_update(left);
+   return left;
+}
+
+/** 
+* @brief Restores the AVL property at the root of a subtree whose 
+*  children differ in height by at most two.
+*
+* @param region The root of the subtree.
+*
+* @return The new root of the subtree.
+*/
+static region_t* region_balance(region_t* region)
+{
+   int balance;
+
+   region_update(region);
+   balance = region_height(region->left) - region_height(region->right);
+   if(balance > 1)
+   {
+      if(region_height(region->left->left) < 
+            region_height(region->left->right))
+         region->left = region_rotate_left(region->left);
+      return region_rotate_right(region);
+   }
+   if(balance < -1)
+   {
+      if(region_height(region->right->right) < 
+            region_height(region->right->left))
+         region->right = region_rotate_right(region->right);
+      return region_rotate_left(region);
+   }
+   return region;
+}
+
+/** 
+* @brief Inserts a region into a subtree.
+*
+* @return The new root of the subtree.
+*/
+static region_t* region_insert(region_t* root, region_t* region)
+{
+   if(root == NULL)
+   {
+      region->left = region->right = NULL;
+      region_update(region);
+      return region;
+   }
+   if(region->start < root->start)
+      root->left = region_insert(root->left, region);
+   else
+      root->right = region_insert(root->right, region);
+   return region_balance(root);
+}
+
+/** 
+* @brief Unlinks the first region of a subtree.
+*
+* @param root The root of the subtree.
+* @param min Set to the region unlinked.
+*
+* @return The new root of the subtree.
+*/
+static region_t* region_remove_min(region_t* root, region_t** min)
+{
+   if(root->left == NULL)
+   {
+      *min = root;
+      return root->right;
+   }
+   root->left = region_remove_min(root->left, min);
+   return region_balance(root);
+}
+
+/** 
+* @brief Unlinks a region from a subtree containing it.
+*
+* @return The new root of the subtree.
+*/
+static region_t* region_remove(region_t* root, region_t* region)
+{
+   region_t* successor;
+
+   if(region->start < root->start)
+      root->left = region_remove(root->left, region);
+   else if(region->start > root->start)
+      root->right = region_remove(root->right, region);
+   else
+   {
+      assert(root == region);
+      if(root->right == NULL)
+         return root->left;
+      
+      /* Put the region just after us in our place. */
+      root->right = region_remove_min(root->right, &successor);
+      successor->left = root->left;
+      successor->right = root->right;
+      root = successor;
+   }
+   return region_balance(root);
+}
+
+/** 
+* @brief Finds the first region starting above addr. The caller must hold
+*  pcb->region_lock.
+*/
+static region_t* region_above(pcb_t* pcb, void* addr)
+{
+   region_t *iter, *found = NULL;
+   for(iter = pcb->regions; iter != NULL; )
+   {
+      if(iter->start > addr)
+      {
+         found = iter;
+         iter = iter->left;
+      }
+      else iter = iter->right;
+   }
+   return found;
+}
+
+/** 
+* @brief Finds the last region starting below addr. The caller must hold
+*  pcb->region_lock.
+*/
+static region_t* region_below(pcb_t* pcb, void* addr)
+{
+   region_t *iter, *found = NULL;
+   for(iter = pcb->regions; iter != NULL; )
+   {
+      if(iter->start < addr)
+      {
+         found = iter;
+         iter = iter->right;
+      }
+      else iter = iter->left;
+   }
+   return found;
+}
+
+/** 
+* @brief Finds the region containing addr. The caller must hold 
+*  pcb->region_lock.
+*
+* @param pcb The process to search.
+* @param addr The address to look up.
+*
+* @return The region, or NULL if addr is in no region.
+*/
+region_t* region_find(pcb_t* pcb, void* addr)
+{
+   tcb_t* tcb = get_tcb();
+   region_t* region = tcb->last_region;
+
+   if(region && tcb->last_region_gen == pcb->region_gen && 
+         region->start <= addr && addr < region->end)
+      return region;
+   
+   region = region_below(pcb, (char*)addr + 1);
+   if(region == NULL || addr >= region->end)
+      return NULL;
+
+   tcb->last_region = region;
+   tcb->last_region_gen = pcb->region_gen;
+   return region;
+}
+
+/** 
+* @brief Finds the region that would have to grow down to cover addr,
+*  whether or not it can. The caller must hold pcb->region_lock.
+*
+* @param pcb The process to search.
+* @param addr The address to look up.
+*
+* @return The region, or NULL if addr is below no region that grows as 
+*  far as it.
+*/
+region_t* region_grower(pcb_t* pcb, void* addr)
+{
+   region_t* region = region_above(pcb, addr);
+   if(region && region->limit && region->limit <= addr)
+      return region;
+   return NULL;
+}
+
+/** 
+* @brief Allocates a new region in the address space in PCB, which may 
+*  grow down as far as limit.
 * 
 * @param start The starting address of the region. 
 * @param end The ending address of the region.
 * @param access_level The (flags) to give the region. (e.g. PTENT_RW)
 * @param void(*fault)(void*, int), The page fault handler for this region.
+* @param limit The lowest address the region may grow to, or NULL.
 * 
 * @return 0 on success. ENOVM or ENOMEM on failure. 
 */
-int allocate_region( 
+static int insert_region( 
    void *start,   
    void *end, 
    int access_level, 
    void (*fault)(void*, int), 
+   void *limit,
    pcb_t* pcb
 ) 
 {
@@ -53,6 +316,7 @@ int allocate_region(
    region->fault = fault;
    region->start = start;
    region->end = end;
+   region->limit = limit;
    
    int ret;
    if((ret = mm_alloc(pcb, (void*)start, end - start, access_level)) < 0)
@@ -63,112 +327,269 @@ int allocate_region(
    }
    debug_print("region", "Allocated new region [%p, %p] at %p", start, end, region);
 
-   /* Insert the region into the list. */
-   mutex_lock(&pcb->region_lock);
-   assert(pcb->regions != region);
-   region->next = pcb->regions;
-   pcb->regions = region;
-   mutex_unlock(&pcb->region_lock);
+   /* Insert the region into the tree. */
+   rwlock_lock_write(&pcb->region_lock);
+   pcb->regions = region_insert(pcb->regions, region);
+   rwlock_unlock_write(&pcb->region_lock);
    
    return ESUCCESS;
 }
 
-void free_region_list_helper(region_t* regions)
+/** 
+* @brief Allocates a new region in the address space in PCB.
+* 
+* @param start The starting address of the region. 
+* @param end The ending address of the region.
+* @param access_level The (flags) to give the region. (e.g. PTENT_RW)
+* @param void(*fault)(void*, int), The page fault handler for this region.
+* 
+* @return 0 on success. ENOVM or ENOMEM on failure. 
+*/
+int allocate_region( 
+   void *start,   
+   void *end, 
+   int access_level, 
+   void (*fault)(void*, int), 
+   pcb_t* pcb
+) 
 {
-   region_t *iter, *next; 
-   for(iter = regions; iter != NULL; iter = next)
+   return insert_region(start, end, access_level, fault, NULL, pcb);
+}
+
+/** 
+* @brief Maps a shared memory segment at start in pcb, as a region that 
+*  remove_pages can free like any other. The caller must have attached 
+*  the segment, and the region keeps that reference.
+* 
+* @param start The page aligned address to map the segment at. 
+* @param shm The segment to map.
+* @param pcb The process to map the segment in, which must be current.
+* 
+* @return 0 on success. ENOVM or ENOMEM on failure. 
+*/
+int allocate_shared_region(void* start, shm_segment_t* shm, pcb_t* pcb)
+{
+   region_t* region;
+   int ret;
+
+   if((region = (region_t*)scalloc(1, sizeof(region_t))) == NULL)
+      return ENOMEM;
+   
+   region->fault = user_fault;
+   region->start = start;
+   region->end = (char*)start + shm->n_pages * PAGE_SIZE;
+   region->shm = shm;
+   
+   if((ret = mm_map_shared(pcb, start, shm->frames, shm->n_pages)) < 0)
    {
-      debug_print("region", "Freeing region [%p, %p]", iter->start, iter->end);
-      next = iter->next;
-      sfree(iter, sizeof(region_t));
+      sfree(region, sizeof(region_t));
+      return ret;
    }
+   debug_print("region", "Mapped segment %d at [%p, %p]", shm->id, 
+      region->start, region->end);
+
+   rwlock_lock_write(&pcb->region_lock);
+   pcb->regions = region_insert(pcb->regions, region);
+   rwlock_unlock_write(&pcb->region_lock);
+   return ESUCCESS;
+}
+
+/** 
+* @brief Allocates the stack region of a new program, which is zero 
+*  filled on demand, and grows down on fault as far as USER_STACK_RLIMIT 
+*  below USER_STACK_BASE.
+* 
+* @param pcb The process to allocate the stack for. 
+* 
+* @return 0 on success. ENOVM or ENOMEM on failure. 
+*/
+int allocate_stack_region(pcb_t* pcb)
+{
+   return insert_region(
+      (char*)USER_STACK_BASE - USER_STACK_SIZE, (char*)USER_STACK_BASE, 
+      PTENT_RW | PTENT_USER | PTENT_ZFOD, stack_fault, 
+      (char*)USER_STACK_BASE - USER_STACK_RLIMIT, pcb);
 }
 
 /** 
-* @brief Duplicates the region list in pcb and returns a pointer
-*  to the copied region list.
+* @brief Grows the region just above addr down to cover it. 
 *
-* @param pcb The process to copy the region list from.
+*  The region grows by USER_STACK_STEP bytes at a time where it can, 
+*   but never below its limit, or to within USER_STACK_GUARD bytes of the 
+*   region below it. The new pages are zero filled on demand, and their 
+*   frames are requested before the region changes, so touching them 
+*   never fails for want of memory.
+*
+*  The caller must hold pcb->new_pages_lock for reading, so that 
+*   new_pages can not claim the space we grow into. Other threads may grow
+*   the same region at once, in which case mapping the same pages twice 
+*   is harmless, and the region keeps the lowest start.
+* 
+* @param pcb The process whose region to grow. 
+* @param addr The address the region must cover. 
 * 
-* @return A pointer to the new region list.
+* @return 0 on success. EARGS if no region may grow to addr, ENOVM if 
+*  the frames could not be requested.
 */
-region_t* duplicate_region_list(pcb_t* pcb)
+int region_grow(pcb_t* pcb, void* addr)
 {
-   region_t *iter0, *iter1;
-   region_t *head0, *head1;
+   region_t *region, *below;
+   char *start, *end, *floor;
+   int ret;
 
-   assert(pcb->regions);
-   
-   mutex_lock(&pcb->region_lock);
-   
-   head0 = pcb->regions;
-   head1 = scalloc(1, sizeof(region_t));
-   if(head1 == NULL)
+   rwlock_lock_read(&pcb->region_lock);
+   if((region = region_grower(pcb, addr)) == NULL)
    {
-      mutex_unlock(&pcb->region_lock);
-      return NULL;
+      rwlock_unlock_read(&pcb->region_lock);
+      return EARGS;
    }
-   iter0 = head0; 
-   iter1 = head1;
 
-   for(;;)
+   /* Find the lowest address we may grow to. */
+   end = region->start;
+   floor = region->limit;
+   below = region_below(pcb, end);
+   if(below && (char*)below->end + USER_STACK_GUARD > floor)
+      floor = (char*)below->end + USER_STACK_GUARD;
+   rwlock_unlock_read(&pcb->region_lock);
+
+   start = (char*)PAGE_OF(addr);
+   if(start < floor)
    {
-      memcpy(iter1, iter0, sizeof(region_t));
-      debug_print("region", "Duplicated region [%p, %p] at %p", 
-         iter0->start, iter0->end, iter1);
-      
-      if(iter0->next) 
-      {
-         iter1->next = scalloc(1, sizeof(region_t));
-         if(iter1->next == NULL)
-         {
-            mutex_unlock(&pcb->region_lock);
-            free_region_list_helper(head1);
-            return NULL;
-         }
-         iter0 = iter0->next; 
-         iter1 = iter1->next;
-      }
-      else
-      {
-         iter1->next = NULL;
-         break;
-      }
+      debug_print("region", "Can not grow [%p, %p] to %p", end, 
+         region->end, addr);
+      return EARGS;
    }
+   if(end - start < USER_STACK_STEP)
+      start = (end - USER_STACK_STEP < floor) ? floor : end - USER_STACK_STEP;
+
+   if((ret = mm_alloc(pcb, start, end - start, 
+         PTENT_RW | PTENT_USER | PTENT_ZFOD)) < 0)
+      return ret;
+   
+   debug_print("region", "Grew region [%p, %p] down to %p", end, 
+      region->end, start);
+   /* Another thread may have grown the region further meanwhile. */
+   rwlock_lock_write(&pcb->region_lock);
+   if(start < (char*)region->start)
+      region->start = start;
+   rwlock_unlock_write(&pcb->region_lock);
+   return ESUCCESS;
+}
+
+/** 
+* @brief Frees every region in a subtree.
+*/
+static void region_tree_free(region_t* root)
+{
+   if(root == NULL)
+      return;
+   region_tree_free(root->left);
+   region_tree_free(root->right);
+   debug_print("region", "Freeing region [%p, %p]", root->start, root->end);
+   if(root->shm)
+      shm_detach(root->shm);
+   sfree(root, sizeof(region_t));
+}
+
+/** 
+* @brief Copies a subtree node for node, so the copy needs no rebalancing.
+*
+* @return The root of the copy, or NULL if we ran out of memory. 
+*/
+static region_t* region_tree_clone(region_t* root)
+{
+   region_t* copy;
 
-   mutex_unlock(&pcb->region_lock);
-   return head1;
+   if((copy = smalloc(sizeof(region_t))) == NULL)
+      return NULL;
+   memcpy(copy, root, sizeof(region_t));
+   debug_print("region", "Duplicated region [%p, %p] at %p", 
+      root->start, root->end, copy);
+   
+   /* The copy detaches from the segment when it is freed, even if we 
+    *  fail below. */
+   copy->left = copy->right = NULL;
+   if(copy->shm)
+      shm_attach(copy->shm);
+   if(root->left && (copy->left = region_tree_clone(root->left)) == NULL)
+      goto fail;
+   if(root->right && (copy->right = region_tree_clone(root->right)) == NULL)
+      goto fail;
+   return copy;
+
+fail:
+   region_tree_free(copy);
+   return NULL;
 }
 
 /** 
-* @brief Frees the region list in the given PCB. 
+* @brief Duplicates the regions in pcb and returns a pointer
+*  to the copied tree.
+*
+* @param pcb The process to copy the regions from.
 * 
-* @param pcb The pcb to free the region list for. 
+* @return A pointer to the new tree, or NULL if we ran out of memory.
+*/
+region_t* duplicate_region_list(pcb_t* pcb)
+{
+   region_t* copy;
+
+   assert(pcb->regions);
+   
+   rwlock_lock_read(&pcb->region_lock);
+   copy = region_tree_clone(pcb->regions);
+   rwlock_unlock_read(&pcb->region_lock);
+   return copy;
+}
+
+/** 
+* @brief Frees the regions in the given PCB. 
+* 
+* @param pcb The pcb to free the regions for. 
 */
 void free_region_list(pcb_t* pcb)
 {
-   mutex_lock(&pcb->region_lock);
-   free_region_list_helper(pcb->regions);
+   rwlock_lock_write(&pcb->region_lock);
+   region_tree_free(pcb->regions);
    pcb->regions = NULL;
-   mutex_unlock(&pcb->region_lock);
+   pcb->region_gen++;
+   rwlock_unlock_write(&pcb->region_lock);
 }
 
 /** 
 * @brief A utility function for region_overlaps.
 */
-inline boolean_t region_overlaps_helper(void* start0, void* end0, void* start1, void* end1)
+static boolean_t region_tree_overlaps(region_t* root, char* start, char* end)
 {
-   return ((start0 <= start1 && start1 < end0) ||
-           (start1 <= start0 && start0 < end1));
+   int guard;
+
+   /* Nothing in this subtree reaches start. */
+   if(root == NULL || (char*)root->max_end <= start)
+      return FALSE;
+
+   assert((void*)root < (void*)USER_MEM_START);
+   guard = root->limit ? USER_STACK_GUARD : 0;
+   if((char*)root->start - guard < end && start < (char*)root->end)
+      return TRUE;
+   
+   if(region_tree_overlaps(root->left, start, end))
+      return TRUE;
+   
+   /* Everything to the right starts above us, so once we are a guard gap
+    *  beyond end, nothing there can reach back to it. */
+   if((char*)root->start - USER_STACK_GUARD >= end)
+      return FALSE;
+   return region_tree_overlaps(root->right, start, end);
 }
 
 /** 
 * @brief Returns true if the address range specifies overlaps 
-*  with an existing region. 
+*  with an existing region, or with the guard gap below a region that 
+*  grows down.
 *   
 *   A utility function for new_pages. 
 * 
-* @param pcb The pcb containing the region list. 
+* @param pcb The pcb containing the regions. 
 * @param start The starting address of the "proposed" region. 
 * @param end The ending address of the "proposed" region. 
 * 
@@ -176,54 +597,50 @@ inline boolean_t region_overlaps_helper(void* start0, void* end0, void* start1,
 */
 boolean_t region_overlaps(pcb_t* pcb, void* start, void* end)
 {
-   region_t *iter;
+   boolean_t overlaps;
 
-   mutex_lock(&pcb->region_lock);
-   for(iter = pcb->regions; iter != NULL; iter = iter->next)
-   {
-      assert((void*)iter < (void*)USER_MEM_START);
-      if(region_overlaps_helper(iter->start, iter->end, start, end))
-      {
-         mutex_unlock(&pcb->region_lock);
-         return TRUE;
-      }
-   }
-   mutex_unlock(&pcb->region_lock);
-   return FALSE;
+   rwlock_lock_read(&pcb->region_lock);
+   overlaps = region_tree_overlaps(pcb->regions, start, end);
+   rwlock_unlock_read(&pcb->region_lock);
+   return overlaps;
 }
 
+/** 
+* @brief Frees the new_pages or shm_map region starting at start. 
+* 
+* @param pcb The process to free the region from. 
+* @param start The start of the region. 
+* 
+* @return 0 on success, -1 if no such region starts at start.
+*/
 int free_region(pcb_t* pcb, void* start)
 {
-   region_t *region, *last_region = NULL;
+   region_t *region;
+   shm_segment_t* shm;
    void* end;
 
-   mutex_lock(&pcb->region_lock);
-   for(region = pcb->regions; region; region = region->next)
+   rwlock_lock_write(&pcb->region_lock);
+   region = region_below(pcb, (char*)start + 1);
+   if(region == NULL || region->start != start || region->fault != user_fault)
    {
-      if(region->start == start && (region->fault == user_fault))
-      {
-         /* Remove the region from the region list. */
-         if(last_region == NULL)
-            pcb->regions = region->next;
-         else
-            last_region->next = region->next;
-         
-         end = region->end;
-         sfree(region, sizeof(region_t));
-         mutex_unlock(&pcb->region_lock);
-
-         /* Free the memory associated with the region. 
-          *  (Note we are the only thread that knows about it) */
-         debug_print("region", " Removing region [%p, %p]", start, end);
-         mm_remove_pages(pcb, start, end);
-         return 0;
-      }
-      else last_region = region;
+      /* The region wasn't found. */
+      rwlock_unlock_write(&pcb->region_lock);
+      return -1;
    }
    
-   /* The region wasn't found. */
-   mutex_unlock(&pcb->region_lock);
-   return -1;
-}
-
+   /* Remove the region from the tree. */
+   pcb->regions = region_remove(pcb->regions, region);
+   pcb->region_gen++;
+   end = region->end;
+   shm = region->shm;
+   sfree(region, sizeof(region_t));
+   rwlock_unlock_write(&pcb->region_lock);
 
+   /* Free the memory associated with the region. 
+    *  (Note we are the only thread that knows about it) */
+   debug_print("region", " Removing region [%p, %p]", start, end);
+   mm_remove_pages(pcb, start, end);
+   if(shm)
+      shm_detach(shm);
+   return 0;
+}
@@ -0,0 +1,80 @@
+/** 
+* @file tlb.c
+*
+* @brief Batched TLB invalidation.
+*
+* Unmapping a page leaves its translation in the TLB until the page is 
+*  invalidated, so the frame behind it must not be freed before then. 
+*  Callers add each page they unmap to a batch, and flush the batch before
+*  they free any frame or table the pages used. Up to TLB_FLUSH_THRESHOLD
+*  pages are invalidated one invlpg at a time, and anything more with a 
+*  single reload of cr3, which drops every translation that is not global.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#include <tlb.h>
+#include <mm_internal.h>
+#include <cr.h>
+#include <assert.h>
+
+/** 
+* @brief Starts an empty batch for unmapping pages of an address space.
+*
+* @param tlb The batch.
+* @param pcb The process whose pages will be unmapped, or NULL for global
+*  kernel pages.
+*/
+void tlb_batch_init(tlb_batch_t* tlb, pcb_t* pcb)
+{
+   tlb->n = 0;
+   tlb->reload = FALSE;
+   tlb->global = (pcb == NULL);
+   tlb->skip = !tlb->global && get_cr3() != (unsigned long)pcb->dir_p;
+}
+
+/** 
+* @brief Adds a page that was just unmapped to a batch.
+*
+* @param tlb The batch.
+* @param page The page.
+*/
+void tlb_batch_add(tlb_batch_t* tlb, void* page)
+{
+   if(tlb->skip || tlb->reload)
+      return;
+
+   if(tlb->n == TLB_FLUSH_THRESHOLD)
+   {
+      /* Global pages survive a reload, so they are flushed as we go. */
+      if(tlb->global)
+         tlb_batch_flush(tlb);
+      else
+      {
+         tlb->reload = TRUE;
+         return;
+      }
+   }
+   tlb->pages[tlb->n++] = page;
+}
+
+/** 
+* @brief Invalidates every page in a batch, and empties it.
+*
+* @param tlb The batch.
+*/
+void tlb_batch_flush(tlb_batch_t* tlb)
+{
+   int i;
+
+   if(tlb->reload)
+      set_cr3(get_cr3());
+   else 
+   {
+      for(i = 0; i < tlb->n; i++)
+         invalidate_page(tlb->pages[i]);
+   }
+   tlb->n = 0;
+   tlb->reload = FALSE;
+}
@@ -0,0 +1,159 @@
+/**
+* @file futex.c
+*
+* @brief Implements the futex_wait and futex_wake system calls.
+*
+* Sleeping threads are kept in a fixed hash of wait queues keyed by the
+*  (process, user address) pair they are waiting on. futex_wait reads the
+*  user's word while holding the bucket lock, and futex_wake must take the
+*  same lock, so a wake can never slip in between the value check and the
+*  waiter going to sleep.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#include <futex.h>
+#include <thread.h>
+#include <process.h>
+#include <scheduler.h>
+#include <vstring.h>
+#include <ecodes.h>
+#include <mutex.h>
+#include <debug.h>
+#include <common_kern.h>
+
+/** @brief The futex wait queues. */
+static futex_bucket_t futex_table[FUTEX_BUCKETS];
+
+/**
+* @brief Initialize the futex wait queues.
+*/
+void futex_init()
+{
+   int i;
+   for(i = 0; i < FUTEX_BUCKETS; i++)
+   {
+      mutex_init(&futex_table[i].lock);
+      LIST_INIT_EMPTY(futex_table[i].waiters);
+   }
+}
+
+/**
+* @brief Check that a user address can name a futex.
+*
+* @param addr The user address.
+*
+* @return TRUE if addr is a word aligned user address.
+*/
+static boolean_t futex_addr_valid(int *addr)
+{
+   return ((unsigned int)addr & (sizeof(int) - 1)) == 0
+      && (char*)addr >= (char*)USER_MEM_START;
+}
+
+/**
+* @brief Block the invoking thread until a futex_wake on addr, provided
+*  *addr still equals expected.
+*
+*  %esi holds a pointer to the packet {int *addr, int expected}.
+*
+*  Returns zero in %eax after being woken, ESTATE if *addr did not hold
+*  expected, and EARGS if the packet or addr can not be read.
+*
+* @param reg The register state on entry and exit of the handler.
+*/
+void futex_wait_handler(ureg_t *reg)
+{
+   char *arg_addr = (char *)SYSCALL_ARG(reg);
+   int *addr;
+   int expected, value;
+   futex_waiter_t waiter;
+   futex_bucket_t *bucket;
+
+   if(v_copy_in_intptr(&addr, arg_addr) < 0)
+      RETURN(reg, EARGS);
+   if(v_copy_in_int(&expected, arg_addr + sizeof(int*)) < 0)
+      RETURN(reg, EARGS);
+   if(!futex_addr_valid(addr))
+      RETURN(reg, EARGS);
+
+   waiter.tcb = get_tcb();
+   waiter.pcb = get_pcb();
+   waiter.addr = addr;
+   LIST_INIT_NODE(&waiter, node);
+   bucket = &futex_table[FUTEX_HASH(waiter.pcb, addr)];
+
+   mutex_lock(&bucket->lock);
+   if(v_copy_in_int(&value, (char*)addr) < 0)
+   {
+      mutex_unlock(&bucket->lock);
+      RETURN(reg, EARGS);
+   }
+   if(value != expected)
+   {
+      mutex_unlock(&bucket->lock);
+      RETURN(reg, ESTATE);
+   }
+
+   LIST_INSERT_BEFORE(bucket->waiters, &waiter, node);
+   debug_print("futex", "%d waiting on %p", waiter.tcb->tid, addr);
+
+   /* The waker unlinks us before unblocking us, so there is nothing to
+    * clean up once we run again. */
+   quick_lock();
+   mutex_unlock(&bucket->lock);
+   scheduler_block();
+   RETURN(reg, ESUCCESS);
+}
+
+/**
+* @brief Wake up to count threads of the invoking task sleeping on addr,
+*  in the order in which they went to sleep.
+*
+*  %esi holds a pointer to the packet {int *addr, int count}.
+*
+*  Returns the number of threads woken in %eax, or EARGS if the packet can
+*  not be read or addr is not a valid futex address.
+*
+* @param reg The register state on entry and exit of the handler.
+*/
+void futex_wake_handler(ureg_t *reg)
+{
+   char *arg_addr = (char *)SYSCALL_ARG(reg);
+   int *addr;
+   int count, woken;
+   pcb_t *pcb = get_pcb();
+   futex_bucket_t *bucket;
+   futex_waiter_t *waiter, *next;
+
+   if(v_copy_in_intptr(&addr, arg_addr) < 0)
+      RETURN(reg, EARGS);
+   if(v_copy_in_int(&count, arg_addr + sizeof(int*)) < 0)
+      RETURN(reg, EARGS);
+   if(!futex_addr_valid(addr) || count < 0)
+      RETURN(reg, EARGS);
+
+   bucket = &futex_table[FUTEX_HASH(pcb, addr)];
+   woken = 0;
+
+   mutex_lock(&bucket->lock);
+   waiter = bucket->waiters;
+   while(waiter && woken < count)
+   {
+      /* Capture our successor before unlinking, and stop once we wrap. */
+      next = LIST_NEXT(waiter, node);
+      if(next == bucket->waiters) next = NULL;
+
+      if(waiter->pcb == pcb && waiter->addr == addr)
+      {
+         debug_print("futex", "Waking %d on %p", waiter->tcb->tid, addr);
+         LIST_REMOVE(bucket->waiters, waiter, node);
+         scheduler_unblock(waiter->tcb);
+         woken++;
+      }
+      waiter = next;
+   }
+   mutex_unlock(&bucket->lock);
+   RETURN(reg, woken);
+}
@@ -41,6 +41,8 @@
 #include <hashtable.h>
 #include <common_kern.h>
 #include <swexn.h>
+#include <context_switch.h>
+#include <fpu.h>
 
 void *zombie_stack = NULL;
 mutex_t zombie_stack_lock;
@@ -55,50 +57,44 @@ void lifecycle_init() {
 }
 
 /**
- * @brief Handle the exec system call.
+ * @brief Copy the {execname, argvec} packet of exec or spawn into kernel 
+ * buffers.
  *
- * @param reg The register state of the user upon calling exec.
+ * @param arg_addr The user address of the packet.
+ * @param execname_buf A buffer of MAX_NAME_LENGTH bytes for the name.
+ * @param execargs_buf A buffer of MAX_TOTAL_LENGTH bytes for the \0 
+ *  separated arguments.
+ * @param argc Set to the number of arguments.
+ *
+ * @return The total number of bytes in execargs_buf, or a negative error 
+ *  code.
  */
-void exec_handler(ureg_t *reg) {
-   quick_assert_unlocked();
-   char *arg_addr = (char *)SYSCALL_ARG(reg);
+static int copy_in_exec_args(char *arg_addr, char *execname_buf, 
+      char *execargs_buf, int *argc) {
    char* execname;
    char** argvec;
-   char execname_buf[MAX_NAME_LENGTH];
-   char execargs_buf[MAX_TOTAL_LENGTH];
    char *args_ptr = execargs_buf;
    int total_bytes = 0;
-   int argc;
-
-   tcb_t* tcb;
 
    /* Verify that the arguments lie in valid memory. */
    if(v_copy_in_ptr(&execname, arg_addr) < 0)
-      RETURN(reg, EARGS);
+      return EARGS;
    
    if(v_copy_in_dptr(&argvec, arg_addr + sizeof(char*)) < 0)
-      RETURN(reg, EARGS);
-   
-   pcb_t* pcb = get_pcb();
-
-   /* If we pass this every other thread has exited or is exiting. */
-   if(pcb->thread_count > 1)
-      RETURN(reg, EMULTHR);
+      return EARGS;
    
    if(v_strcpy((char*)execname_buf, execname, MAX_NAME_LENGTH, TRUE) < 0) 
-      RETURN(reg, ENAME);
-
-   debug_print("exec", "Called with program %s", execname_buf);
+      return ENAME;
 
    /* Loop over every argument, copying it to the kernel stack. */
-   for(argc = 0 ;; argc++, argvec++)
+   for(*argc = 0 ;; (*argc)++, argvec++)
    {
       char* arg;
       if (total_bytes == MAX_TOTAL_LENGTH) 
-         RETURN(reg, EBUF);
+         return EBUF;
       
       if(v_copy_in_ptr(&arg, (char*)argvec) < 0)
-         RETURN(reg, EARGS);
+         return EARGS;
       
       if(arg == NULL)
          break;
@@ -106,12 +102,61 @@ void exec_handler(ureg_t *reg) {
       int arg_len = v_strcpy(args_ptr, arg, MAX_TOTAL_LENGTH - total_bytes, TRUE);
       
       if (arg_len < 0) 
-         RETURN(reg, EARGS);
+         return EARGS;
       
-      debug_print("exec", "Arg %d is %s", argc, args_ptr);
+      debug_print("exec", "Arg %d is %s", *argc, args_ptr);
       total_bytes += arg_len;
       args_ptr += arg_len;
    }
+   return total_bytes;
+}
+
+/**
+ * @brief Record new_pcb as a child of pcb, so that pcb may wait on it.
+ *
+ * @param pcb The parent process.
+ * @param new_pcb The new child process.
+ */
+static void add_child(pcb_t *pcb, pcb_t *new_pcb) {
+   debug_print("children", "%p has %d children before incrementing",
+         pcb, pcb->unclaimed_children);
+   atomic_add(&pcb->unclaimed_children, 1);
+   debug_print("children", "%p has %d children after incrementing",
+         pcb, pcb->unclaimed_children);
+   mutex_lock(&pcb->child_lock);
+   
+   if (pcb != init_process)
+      LIST_INSERT_AFTER(pcb->children, new_pcb, child_node);
+
+   mutex_unlock(&pcb->child_lock);
+}
+
+/**
+ * @brief Handle the exec system call.
+ *
+ * @param reg The register state of the user upon calling exec.
+ */
+void exec_handler(ureg_t *reg) {
+   quick_assert_unlocked();
+   char *arg_addr = (char *)SYSCALL_ARG(reg);
+   char execname_buf[MAX_NAME_LENGTH];
+   char execargs_buf[MAX_TOTAL_LENGTH];
+   int total_bytes;
+   int argc;
+
+   tcb_t* tcb;
+   pcb_t* pcb = get_pcb();
+
+   /* If we pass this every other thread has exited or is exiting. */
+   if(pcb->thread_count > 1)
+      RETURN(reg, EMULTHR);
+   
+   total_bytes = copy_in_exec_args(arg_addr, execname_buf, execargs_buf, 
+      &argc);
+   if(total_bytes < 0)
+      RETURN(reg, total_bytes);
+
+   debug_print("exec", "Called with program %s", execname_buf);
    
    int err;
    simple_elf_t elf_hdr;
@@ -137,6 +182,9 @@ void exec_handler(ureg_t *reg) {
    unlock_swexn_stack();
    memset(&tcb->handler, 0, sizeof(handler_t));
 
+   /* The new program starts with a clean FPU. */
+   fpu_release(tcb);
+
    switch_to_user(tcb, execname_buf, stack, 
          (void *)elf_hdr.e_entry);
    
@@ -144,6 +192,94 @@ void exec_handler(ureg_t *reg) {
    assert(0);
 }
 
+/**
+ * @brief Handle the spawn system call. Starts execname with argvec in a
+ *  new child process, without first copying the caller's address space.
+ *
+ *  %esi holds a pointer to the packet {char *execname, char **argvec}, 
+ *  as for exec. Returns the tid of the child's first thread, or a 
+ *  negative error code.
+ *
+ * @param reg The register state of the user upon calling spawn.
+ */
+void spawn_handler(ureg_t *reg) {
+   quick_assert_unlocked();
+   char *arg_addr = (char *)SYSCALL_ARG(reg);
+   char execname_buf[MAX_NAME_LENGTH];
+   char execargs_buf[MAX_TOTAL_LENGTH];
+   int total_bytes, argc, err;
+   simple_elf_t elf_hdr;
+   ureg_t new_reg;
+   void *stack = NULL;
+   pcb_t *new_pcb;
+   tcb_t *new_tcb;
+   
+   tcb_t *tcb = get_tcb();
+   pcb_t *pcb = tcb->pcb;
+
+   total_bytes = copy_in_exec_args(arg_addr, execname_buf, execargs_buf, 
+      &argc);
+   if(total_bytes < 0)
+      RETURN(reg, total_bytes);
+
+   debug_print("spawn", "Called with program %s", execname_buf);
+   
+   if ((err = get_elf(execname_buf, &elf_hdr)) != ELF_SUCCESS)
+      RETURN(reg, err);
+
+   new_pcb = initialize_process(FALSE);
+   if(new_pcb == NULL)
+      RETURN(reg, ENOMEM);
+
+   /* The loader fills the child's memory through its own addresses, so we
+    *  borrow its directory. Setting our dir_p first means a context switch
+    *  can not drop us back into the parent's address space. */
+   tcb->dir_p = new_pcb->dir_p;
+   set_cr3((int)new_pcb->dir_p);
+   err = initialize_memory(execname_buf, elf_hdr, new_pcb);
+   if(err == ESUCCESS)
+      stack = copy_to_stack(argc, execargs_buf, total_bytes);
+   tcb->dir_p = pcb->dir_p;
+   set_cr3((int)pcb->dir_p);
+
+   if(err < 0)
+   {
+      debug_print("spawn", "Failed to initialize memory");
+      goto spawn_fail;
+   }
+
+   new_tcb = initialize_thread(new_pcb);
+   if(new_tcb == NULL)
+   {
+      debug_print("spawn", "Failed to intialize thread");
+      err = ENOMEM;
+      goto spawn_fail;
+   }
+   
+   /* Enter user mode at the entry point, as if returning from a fork. */
+   memset(&new_reg, 0, sizeof(ureg_t));
+   new_reg.ds = new_reg.es = new_reg.fs = new_reg.gs = SEGSEL_USER_DS;
+   new_reg.ss = SEGSEL_USER_DS;
+   new_reg.cs = SEGSEL_USER_CS;
+   new_reg.eip = elf_hdr.e_entry;
+   new_reg.esp = (unsigned int)stack;
+   new_reg.eflags = get_user_eflags();
+   
+   new_tcb->esp = arrange_fork_context(
+      new_tcb->kstack, &new_reg, new_pcb->dir_p);
+
+   add_child(pcb, new_pcb);
+   
+   sim_reg_process(new_pcb->dir_p, execname_buf);
+   scheduler_register(new_tcb);
+   RETURN(reg, new_tcb->tid);
+
+spawn_fail:
+   sfree(new_pcb->status, sizeof(status_t));
+   free_process_resources(new_pcb, FALSE);
+   RETURN(reg, err);
+}
+
 /** 
 * @brief Generates a new thread in the current address space. 
 *  Explicitly:
@@ -235,6 +371,7 @@ void fork_handler(ureg_t *reg)
    debug_print("fork", "New pcb %p, tcb %p", new_pcb, new_tcb);
    
    newpid = new_pcb->pid;
+   new_pcb->elf = current_pcb->elf;
   
    /* Duplicate the current address space in the new process. */
    if(mm_duplicate_address_space(new_pcb) < 0)
@@ -243,23 +380,20 @@ void fork_handler(ureg_t *reg)
       goto fork_fail_dup;
    }
    
+   /* Give the new thread a copy of our FPU state. */
+   if(fpu_copy(current_tcb, new_tcb) < 0)
+   {
+      debug_print("fork", "Failed to copy fpu state. ");
+      goto fork_fail_dup;
+   }
+   
    /* Arrange the new processes context for it's first context switch. */
    assert(new_tcb->kstack != NULL);
 
    new_tcb->esp = arrange_fork_context(
       new_tcb->kstack, reg, new_pcb->dir_p);
   
-   debug_print("children", "%p has %d children before incrementing",
-         current_pcb, current_pcb->unclaimed_children);
-   atomic_add(&current_pcb->unclaimed_children, 1);
-   debug_print("children", "%p has %d children after incrementing",
-         current_pcb, current_pcb->unclaimed_children);
-   mutex_lock(&current_pcb->child_lock);
-   
-   if (current_pcb != init_process)
-      LIST_INSERT_AFTER(current_pcb->children, new_pcb, child_node);
-
-   mutex_unlock(&current_pcb->child_lock);
+   add_child(current_pcb, new_pcb);
    
    /* Duplicate software exception handlers into the new thread. */
    memcpy((char*)(&new_tcb->handler), (char*)(&current_tcb->handler),
@@ -331,11 +465,9 @@ void arrange_global_context()
    ret_site = esp;
    (*ret_site) = (pop_stub);
    
-   /* Set up the context context_switch will popa off the stack. */
-   esp -= sizeof(pusha_t);
-   esp -= sizeof(int);
-   int* cr2 = (int*)esp;
-   *cr2 = get_cr2();
+   /* Set up the context context_switch will pop off the stack. */
+   esp -= sizeof(switch_frame_t);
+   memset(esp, 0, sizeof(switch_frame_t));
    
    tcb->esp = esp;
 }
@@ -372,13 +504,9 @@ void* arrange_fork_context(void* esp, ureg_t* reg, void* dir)
 
    (*ret_site) = (pop_stub);
    
-   /* Set up the context context_switch will popa off the stack. */
-   esp -= sizeof(pusha_t);
-   pusha_t* pusha = (pusha_t*)esp;
-   pusha->eax = (unsigned long)dir;
-   esp -= 4;
-   int* cr2 = (int*)esp;
-   *cr2 = get_cr2();
+   /* Set up the context context_switch will pop off the stack. */
+   esp -= sizeof(switch_frame_t);
+   memset(esp, 0, sizeof(switch_frame_t));
    
    return esp;
 }
@@ -524,6 +652,10 @@ void vanish_handler()
          quick_unlock();
       }
 
+      /* We may still block and will switch away after our pcb is freed,
+       * so stop charging our time to it first. */
+      scheduler_orphan(tcb);
+
       /* Jump to the global directory and free our process resources. */
       set_cr3((int)tcb->dir_p);
       free_process_resources(pcb, TRUE);
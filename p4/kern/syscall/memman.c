@@ -14,6 +14,7 @@
 #include <pagefault.h>
 #include <process.h>
 #include <mutex.h>
+#include <rwlock.h>
 #include <vstring.h>
 #include <region.h>
 #include <common_kern.h>
@@ -72,25 +73,28 @@ void new_pages_handler(ureg_t *reg)
     * already allocated. */
    
    assert((get_eflags() & EFL_IF) != 0);
-   mutex_lock(&pcb->new_pages_lock);
+   rwlock_lock_write(&pcb->new_pages_lock);
    if(region_overlaps(pcb, start, end))
    {
-      mutex_unlock(&pcb->new_pages_lock);
+      rwlock_unlock_write(&pcb->new_pages_lock);
       RETURN(reg, ESTATE);
    }
    
    debug_print("memman", " Allocating new region [%p, %p] for new_pages", 
       start, end);
    
+   /* Frames are requested now, but only allocated as pages are written,
+    *  unless mm_alloc can back whole 4 MB directory entries with large 
+    *  pages. */
    if((ret = allocate_region(start, 
-      end, PTENT_USER | PTENT_RW, user_fault, get_pcb())) < 0)
+      end, PTENT_USER | PTENT_RW | PTENT_ZFOD, user_fault, get_pcb())) < 0)
    {
       debug_print("memman", "new_pages failure");
-      mutex_unlock(&pcb->new_pages_lock);
+      rwlock_unlock_write(&pcb->new_pages_lock);
       RETURN(reg, ret);
    }
    
-   mutex_unlock(&pcb->new_pages_lock);
+   rwlock_unlock_write(&pcb->new_pages_lock);
    RETURN(reg, ESUCCESS);
 }
 
@@ -113,9 +117,9 @@ void remove_pages_handler(ureg_t *reg)
    pcb = get_pcb();
    
    int ret;
-   mutex_lock(&pcb->new_pages_lock);
+   rwlock_lock_write(&pcb->new_pages_lock);
    ret = free_region(pcb, start);
-   mutex_unlock(&pcb->new_pages_lock);
+   rwlock_unlock_write(&pcb->new_pages_lock);
 
    RETURN(reg, ret);
 }
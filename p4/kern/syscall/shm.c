@@ -0,0 +1,281 @@
+/**
+* @file shm.c
+*
+* @brief Implements the shm_create and shm_map system calls.
+*
+* A segment is a fixed set of frames, allocated and zeroed when it is
+*  created, and named by a handle any process may pass to shm_map. The
+*  segment holds a reference to each of its frames, and every page mapping
+*  it holds another, so the frames outlive whichever address spaces map
+*  them. Pages of a segment are shared by fork rather than copied on write,
+*  and the child's copy of the region attaches to the segment as well.
+*
+* The segment itself counts the regions mapping it. Once it has been 
+*  mapped, and the last of them is freed, by remove_pages, exec or exit, 
+*  the segment drops its frames and its handle is no longer valid. A 
+*  segment that has never been mapped is freed instead when the process 
+*  that created it exits.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#include <shm.h>
+#include <region.h>
+#include <process.h>
+#include <mm.h>
+#include <vstring.h>
+#include <ecodes.h>
+#include <mutex.h>
+#include <rwlock.h>
+#include <malloc_wrappers.h>
+#include <debug.h>
+#include <common_kern.h>
+
+/** @brief The segments that have been created and not yet freed. */
+static shm_segment_t* shm_segments;
+
+/** @brief Protects the segment list, and the reference counts. */
+static mutex_t shm_lock;
+
+/** @brief The handle of the next segment created. */
+static int shm_next_id;
+
+/**
+* @brief Initialize the segment list.
+*/
+void shm_init()
+{
+   mutex_init(&shm_lock);
+   shm_segments = NULL;
+   shm_next_id = 1;
+}
+
+/**
+* @brief Adds a reference to a segment on behalf of a new region.
+*
+* @param shm The segment, which must already be referenced.
+*/
+void shm_attach(shm_segment_t* shm)
+{
+   mutex_lock(&shm_lock);
+   assert(shm->refs > 0);
+   shm->refs++;
+   mutex_unlock(&shm_lock);
+}
+
+/**
+* @brief Finds a segment by its handle, and adds a reference to it.
+*
+* @param id The handle.
+*
+* @return The segment, or NULL if no segment has the handle.
+*/
+static shm_segment_t* shm_lookup(int id)
+{
+   shm_segment_t* shm;
+
+   mutex_lock(&shm_lock);
+   for(shm = shm_segments; shm != NULL && shm->id != id; shm = shm->next)
+      continue;
+   if(shm) shm->refs++;
+   mutex_unlock(&shm_lock);
+   return shm;
+}
+
+/**
+* @brief Frees a segment that has been removed from the segment list.
+*
+* @param shm The segment, which no one can find any more.
+*/
+static void shm_free(shm_segment_t* shm)
+{
+   int i;
+
+   debug_print("shm", "Freeing segment %d", shm->id);
+   for(i = 0; i < shm->n_pages; i++)
+      mm_unref_frame(shm->frames[i]);
+   sfree(shm->frames, shm->n_pages * sizeof(unsigned long));
+   sfree(shm, sizeof(shm_segment_t));
+}
+
+/**
+* @brief Drops a reference to a segment, freeing it with the last one if
+*  it has ever been mapped, or its creator has exited.
+*
+* @param shm The segment.
+*/
+void shm_detach(shm_segment_t* shm)
+{
+   shm_segment_t** link;
+
+   mutex_lock(&shm_lock);
+   assert(shm->refs > 0);
+   if(--shm->refs > 0 || (!shm->mapped && shm->owner))
+   {
+      mutex_unlock(&shm_lock);
+      return;
+   }
+   for(link = &shm_segments; *link != shm; link = &(*link)->next)
+      continue;
+   *link = shm->next;
+   mutex_unlock(&shm_lock);
+
+   shm_free(shm);
+}
+
+/**
+* @brief Disowns the segments an exiting process created, and frees those
+*  that nothing has mapped or is about to map.
+*
+* @param pcb The exiting process.
+*/
+void shm_release(pcb_t* pcb)
+{
+   shm_segment_t** link;
+   shm_segment_t* shm;
+   shm_segment_t* dead = NULL;
+
+   mutex_lock(&shm_lock);
+   link = &shm_segments;
+   while((shm = *link) != NULL)
+   {
+      if(shm->owner != pcb)
+      {
+         link = &shm->next;
+         continue;
+      }
+      
+      /* Anyone still mapping the segment frees it with shm_detach. */
+      shm->owner = NULL;
+      if(shm->refs > 0 || shm->mapped)
+      {
+         link = &shm->next;
+         continue;
+      }
+      *link = shm->next;
+      shm->next = dead;
+      dead = shm;
+   }
+   mutex_unlock(&shm_lock);
+
+   while((shm = dead) != NULL)
+   {
+      dead = shm->next;
+      shm_free(shm);
+   }
+}
+
+/**
+* @brief Creates a zero filled shared memory segment.
+*
+*  %esi holds the length of the segment in bytes, which must be a positive
+*   multiple of the page size.
+*
+*  Returns the segment's handle in %eax, EARGS if the length is invalid,
+*   ENOMEM if the kernel is out of memory, and ENOVM if there are not
+*   enough frames for the segment.
+*
+* @param reg The register state on entry and exit of the handler.
+*/
+void shm_create_handler(ureg_t* reg)
+{
+   int len = (int)SYSCALL_ARG(reg);
+   int i, n_pages;
+   shm_segment_t* shm;
+
+   if(len <= 0 || len % PAGE_SIZE != 0)
+      RETURN(reg, EARGS);
+   n_pages = len / PAGE_SIZE;
+
+   if((shm = (shm_segment_t*)smalloc(sizeof(shm_segment_t))) == NULL)
+      RETURN(reg, ENOMEM);
+   if((shm->frames =
+      (unsigned long*)smalloc(n_pages * sizeof(unsigned long))) == NULL)
+   {
+      sfree(shm, sizeof(shm_segment_t));
+      RETURN(reg, ENOMEM);
+   }
+   if(mm_request_frames(n_pages) < 0)
+   {
+      sfree(shm->frames, n_pages * sizeof(unsigned long));
+      sfree(shm, sizeof(shm_segment_t));
+      RETURN(reg, ENOVM);
+   }
+
+   shm->n_pages = n_pages;
+   for(i = 0; i < n_pages; i++)
+      shm->frames[i] = mm_new_shared_frame();
+
+   /* Nothing maps the segment yet. The first shm_map attaches to it, and
+    * until then we free it when we exit. */
+   mutex_lock(&shm_lock);
+   shm->id = shm_next_id++;
+   shm->refs = 0;
+   shm->mapped = FALSE;
+   shm->owner = get_pcb();
+   shm->next = shm_segments;
+   shm_segments = shm;
+   mutex_unlock(&shm_lock);
+
+   debug_print("shm", "Created segment %d of %d pages", shm->id, n_pages);
+   RETURN(reg, shm->id);
+}
+
+/**
+* @brief Maps a shared memory segment into the invoking task, read/write,
+*  at a page aligned address no region of the task overlaps. The mapping
+*  is freed by remove_pages, like memory from new_pages.
+*
+*  %esi holds a pointer to the packet {void *addr, int shmid}.
+*
+*  Returns zero in %eax on success, EARGS if the packet can not be read,
+*   addr is invalid or no segment has the handle, ESTATE if the segment
+*   would overlap memory the task already has, and ENOVM or ENOMEM if the
+*   kernel is out of resources.
+*
+* @param reg The register state on entry and exit of the handler.
+*/
+void shm_map_handler(ureg_t* reg)
+{
+   char *arg_addr = (char*)SYSCALL_ARG(reg);
+   char *start;
+   unsigned long len;
+   int id, ret;
+   shm_segment_t* shm;
+   pcb_t* pcb = get_pcb();
+
+   if(v_copy_in_ptr(&start, arg_addr) < 0)
+      RETURN(reg, EARGS);
+   if(v_copy_in_int(&id, arg_addr + sizeof(char*)) < 0)
+      RETURN(reg, EARGS);
+   if(PAGE_OFFSET(start) != 0 || start < (char*)USER_MEM_START
+      || start >= (char*)USER_MEM_END)
+      RETURN(reg, EARGS);
+   if((shm = shm_lookup(id)) == NULL)
+      RETURN(reg, EARGS);
+
+   len = shm->n_pages * PAGE_SIZE;
+   if(len > USER_MEM_END - (unsigned long)start)
+   {
+      shm_detach(shm);
+      RETURN(reg, EARGS);
+   }
+
+   /* remove_pages can not free the region before it is marked mapped. */
+   rwlock_lock_write(&pcb->new_pages_lock);
+   if(region_overlaps(pcb, start, start + len))
+      ret = ESTATE;
+   else if((ret = allocate_shared_region(start, shm, pcb)) == ESUCCESS)
+   {
+      mutex_lock(&shm_lock);
+      shm->mapped = TRUE;
+      mutex_unlock(&shm_lock);
+   }
+   rwlock_unlock_write(&pcb->new_pages_lock);
+
+   /* Otherwise the region keeps our reference. */
+   if(ret < 0)
+      shm_detach(shm);
+   RETURN(reg, ret);
+}
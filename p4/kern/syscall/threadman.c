@@ -15,6 +15,10 @@
 #include <hashtable.h>
 #include <vstring.h>
 #include <debug.h>
+#include <asm_helper.h>
+#include <stdint.h>
+#include <limits.h>
+#include <mm.h>
 
 /** 
 * @brief Returns the TID of the current thread in %eax. 
@@ -181,9 +185,6 @@ void get_ticks_handler(ureg_t *reg)
 *
 *  Returns an integer error code less than zero in %eax if ticks is 
 *  negative. Returns zero in %eax otherwise.
-*
-*  In a _very_ exceptional case, we can fail to reallocate the sleep 
-*   heap, and we are required to say no to sleep requests.
 * 
 * @param reg The register state on entry and exit of the handler.
 */
@@ -197,4 +198,192 @@ void sleep_handler(ureg_t *reg)
    RETURN(reg, scheduler_sleep(ticks));
 }
 
+/** 
+* @brief Writes the number of nanoseconds since system boot to the 64 bit
+* integer at the address in %esi. The clock is monotonic, and does not wrap
+* for centuries.
+*
+*  Returns an integer error code less than zero in %eax if the address is
+*  not writable. Returns zero in %eax otherwise.
+* 
+* @param reg The register state on entry and exit of the handler.
+*/
+void get_nanos_handler(ureg_t *reg)
+{
+   uint64_t *nanos = (uint64_t*)SYSCALL_ARG(reg);
+   
+   if(v_copy_out_uint64(nanos, timer_nanos()) < 0) RETURN(reg, EARGS);
+   RETURN(reg, ESUCCESS);
+}
+
+/** 
+* @brief Deschedules the calling thread until at least the 64 bit number of
+* nanoseconds at the address in %esi have passed.
+*
+*  The thread sleeps on the wheel while a whole tick or more remains 
+*  before the deadline, and only yields through the final partial tick, 
+*  so it wakes up with much finer precision than sleep().
+*
+*  Returns an integer error code less than zero in %eax if the argument 
+*  can not be read. Returns zero in %eax otherwise.
+* 
+* @param reg The register state on entry and exit of the handler.
+*/
+void sleep_nanos_handler(ureg_t *reg)
+{
+   uint64_t nanos, deadline, now, ticks;
+   
+   if(v_copy_in_uint64(&nanos, (char*)SYSCALL_ARG(reg)) < 0) 
+      RETURN(reg, EARGS);
+   if(nanos == 0) RETURN(reg, ESUCCESS);
+
+   deadline = timer_nanos() + nanos;
+
+   /* sleep(n) can last up to n + 1 ticks, so sleep one tick short. With 
+    * less than two ticks left that is sleep(0), which parks us until the
+    * next tick. */
+   while((now = timer_nanos()) + NS_PER_TICK <= deadline) {
+      ticks = udiv64(deadline - now, NS_PER_TICK);
+      scheduler_sleep(ticks > LONG_MAX ? LONG_MAX : ticks - 1);
+   }
 
+   /* Less than a tick is left. */
+   while(timer_nanos() < deadline) {
+      quick_lock();
+      scheduler_next();
+   }
+   RETURN(reg, ESUCCESS);
+}
+
+/** 
+* @brief Summarize scheduling times in 32 bit units.
+* 
+* @param times The times to summarize.
+* @param summary The summary to fill in.
+*/
+static void sched_summarize(sched_times_t *times, sched_summary_t *summary)
+{
+   summary->run_ms = (unsigned long)udiv64(times->run_ns, 1000000);
+   summary->ready_ms = (unsigned long)udiv64(times->ready_ns, 1000000);
+   summary->blocked_ms = (unsigned long)udiv64(times->blocked_ns, 1000000);
+   summary->sleep_ms = (unsigned long)udiv64(times->sleep_ns, 1000000);
+   summary->overshoot_us = times->wakeups ? 
+      (unsigned long)udiv64(times->overshoot_ns, times->wakeups) / 1000 : 0;
+}
+
+/** 
+* @brief Copies out the scheduling statistics of the thread with the 
+*  smallest ID that is at least tid, along with those of its process.
+*
+*  %esi holds a pointer to the packet {int tid, sched_stats_t *stats}. 
+*  Passing one more than the last returned ID walks every thread.
+*
+*  Returns the ID of the thread described in %eax, ENAME if there are no
+*  threads with an ID of tid or more, and EARGS if the packet can not be 
+*  read or the record can not be written.
+* 
+* @param reg The register state on entry and exit of the handler.
+*/
+void sched_stats_handler(ureg_t *reg)
+{
+   char *arg_addr = (char *)SYSCALL_ARG(reg);
+   int tid;
+   char *buf;
+   tcb_t *tcb;
+   sched_stats_t stats;
+
+   if(v_copy_in_int(&tid, arg_addr) < 0)
+      RETURN(reg, EARGS);
+   if(v_copy_in_ptr(&buf, arg_addr + sizeof(int)) < 0)
+      RETURN(reg, EARGS);
+
+   /* Hold onto the table lock so the thread cannot disappear. */
+   mutex_lock(&tcb_table()->lock);
+   tcb = hashtable_next(tcb_table(), tid);
+   if (tcb == NULL) {
+      mutex_unlock(&tcb_table()->lock);
+      RETURN(reg, ENAME);
+   }
+   scheduler_thread_stats(tcb, &stats);
+   mutex_unlock(&tcb_table()->lock);
+   sched_summarize(&stats.thread, &stats.thread_summary);
+   sched_summarize(&stats.process, &stats.process_summary);
+
+   if(v_memcpy(buf, (char*)&stats, sizeof(sched_stats_t), FALSE) 
+         < sizeof(sched_stats_t))
+      RETURN(reg, EARGS);
+   RETURN(reg, stats.tid);
+}
+
+/** 
+* @brief Copies out the kernel wide context switch and zeroed frame 
+*  counters to the kern_stats_t at the address in %esi.
+*
+*  Returns zero in %eax on success, and EARGS if the record can not be 
+*  written.
+* 
+* @param reg The register state on entry and exit of the handler.
+*/
+void kern_stats_handler(ureg_t *reg)
+{
+   char *buf = (char *)SYSCALL_ARG(reg);
+   switch_stats_t switches;
+   kern_stats_t stats;
+
+   scheduler_switch_stats(&switches);
+   stats.switches = switches.switches;
+   stats.cr3_loads = switches.cr3_loads;
+   stats.cr3_skips = switches.cr3_skips;
+   stats.sibling_picks = switches.sibling_picks;
+   stats.switch_cycles = switches.timed ? 
+      (unsigned long)udiv64(switches.cycles, switches.timed) : 0;
+   mm_zero_stats(&stats.zero_hits, &stats.zero_misses);
+
+   if(v_memcpy(buf, (char*)&stats, sizeof(kern_stats_t), FALSE) 
+         < sizeof(kern_stats_t))
+      RETURN(reg, EARGS);
+   RETURN(reg, ESUCCESS);
+}
+
+/** 
+* @brief Makes the invoking thread a real time thread, scheduled earliest
+*  deadline first ahead of every other thread, or returns it to the best 
+*  effort class.
+*
+*  %esi holds a pointer to the packet {int period, int budget}, both in 
+*  ticks. A period of zero leaves the real time class.
+*
+*  Returns zero in %eax on success, EARGS if the packet can not be read or
+*  the reservation is malformed, and ESTATE if admitting the reservation
+*  would oversubscribe the processor.
+* 
+* @param reg The register state on entry and exit of the handler.
+*/
+void rt_reserve_handler(ureg_t *reg)
+{
+   char *arg_addr = (char *)SYSCALL_ARG(reg);
+   int period, budget;
+
+   if(v_copy_in_int(&period, arg_addr) < 0)
+      RETURN(reg, EARGS);
+   if(v_copy_in_int(&budget, arg_addr + sizeof(int)) < 0)
+      RETURN(reg, EARGS);
+   if(period < 0 || budget < 0)
+      RETURN(reg, EARGS);
+
+   RETURN(reg, scheduler_reserve(period, budget));
+}
+
+/** 
+* @brief Ends the current job of a real time thread, sleeping until the 
+*  start of its next period.
+*
+*  Returns zero in %eax after the release, or ESTATE if the invoking thread
+*  is not a real time thread.
+* 
+* @param reg The register state on entry and exit of the handler.
+*/
+void rt_next_handler(ureg_t *reg)
+{
+   RETURN(reg, scheduler_rt_next());
+}
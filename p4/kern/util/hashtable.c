@@ -191,3 +191,29 @@ tcb_t *hashtable_remove(hashtable_t *hashtable, int tid)
    return tcb;
 }
 
+/**
+ * @brief Find the tcb with the smallest tid at least as large as the given
+ *    tid, so callers can walk the table in tid order.
+ *
+ * @param hashtable The hashtable to search.
+ * @param tid The smallest tid to return.
+ *
+ * @return The tcb found, or NULL if every tid in the table is smaller.
+ */
+tcb_t *hashtable_next(hashtable_t *hashtable, int tid)
+{
+   size_t i;
+   hashtable_link_t *link, *best = NULL;
+   
+   /* The exact tid is the common case, and needs only one bucket. */
+   tcb_t *tcb = hashtable_get(hashtable, tid);
+   if (tcb != NULL) return tcb;
+
+   for (i = 0; i < prime_hashtable_sizes[hashtable->table_index]; i++) {
+      for (link = hashtable->table[i]; link != NULL; link = link->next) {
+         if (link->tid >= tid && (best == NULL || link->tid < best->tid))
+            best = link;
+      }
+   }
+   return best ? best->tcb : NULL;
+}
@@ -30,6 +30,10 @@ int lock_depth = 1;
  * initialized. */
 boolean_t locks_enabled = FALSE;
 
+static void mutex_acquire(mutex_t *mp, tcb_t *tcb);
+static void mutex_release(mutex_t *mp);
+static int mutex_donation(tcb_t *tcb);
+
 /**
  * @brief Initialize a mutex.
  *
@@ -40,7 +44,8 @@ void mutex_init(mutex_t *mp) {
 
    mp->head = mp->tail = NULL;
    mp->initialized = TRUE;
-   mp->locked = FALSE;
+   mp->owner = NULL;
+   mp->held_next = NULL;
 }
 
 /**
@@ -52,15 +57,73 @@ void mutex_init(mutex_t *mp) {
 void mutex_destroy(mutex_t *mp) {
    assert(mp);
    assert(mp->initialized);
-   assert(mp->locked == FALSE);
+   assert(mp->owner == NULL);
    mp->initialized = FALSE;
 }
 
+/**
+ * @brief Make a thread the owner of a mutex. Interrupts must be disabled.
+ *
+ * @param mp The mutex being acquired.
+ * @param tcb The new owner.
+ */
+static void mutex_acquire(mutex_t *mp, tcb_t *tcb)
+{
+   mp->owner = tcb;
+   mp->held_next = tcb->held;
+   tcb->held = mp;
+}
+
+/**
+ * @brief Remove a mutex from the list of mutexes held by its owner. 
+ *    Interrupts must be disabled.
+ *
+ * @param mp The mutex being released.
+ */
+static void mutex_release(mutex_t *mp)
+{
+   mutex_t **link;
+   for (link = &mp->owner->held; *link != NULL; link = &(*link)->held_next) {
+      if (*link == mp) {
+         *link = mp->held_next;
+         break;
+      }
+   }
+   mp->held_next = NULL;
+   mp->owner = NULL;
+}
+
+/**
+ * @brief Find the highest priority level among the waiters on every mutex
+ *    held by a thread. Interrupts must be disabled.
+ *
+ * @param tcb The thread holding the mutexes.
+ *
+ * @return The level the waiters donate to tcb, or SCHEDULER_LEVELS if 
+ * there are no waiters.
+ */
+static int mutex_donation(tcb_t *tcb)
+{
+   int level = SCHEDULER_LEVELS;
+   mutex_t *held;
+   mutex_node_t *node;
+   
+   for (held = tcb->held; held != NULL; held = held->held_next) {
+      for (node = held->head; node != NULL; node = node->next) {
+         if (scheduler_priority(node->tcb) < level)
+            level = scheduler_priority(node->tcb);
+      }
+   }
+   return level;
+}
+
 /**
  * @brief Lock a mutex to protect a critical section of code.
  *
- * If the lock cannot be obtained immediately, a context switch to the thread
- * holding the lock will be triggered.
+ * If the lock cannot be obtained immediately, we donate our priority to
+ * the owner, and to whoever the owner is waiting for, up to 
+ * MUTEX_DONATION_DEPTH owners down the chain. We then block until the 
+ * owner hands the mutex directly to us.
  *
  * @param mp The mutex to lock.
  */
@@ -71,12 +134,22 @@ void mutex_lock(mutex_t *mp)
    if (!locks_enabled) return;
 
    mutex_node_t node;
+   tcb_t *owner;
+   int level, depth;
+   
    node.tcb = get_tcb();
    node.next = NULL;
    debug_print("mutex", "Thread %p is entering mutex %p", node.tcb, mp);
    if (node.tcb != global_tcb())
       quick_assert_unlocked();
    quick_lock();
+   if (mp->owner == NULL) {
+      mutex_acquire(mp, node.tcb);
+      quick_unlock();
+      debug_print("mutex", "Thread %p has acquired mutex %p", node.tcb, mp);
+      return;
+   }
+   
    if (mp->head == NULL) {
       mp->head = mp->tail = &node;
    }
@@ -84,19 +157,59 @@ void mutex_lock(mutex_t *mp)
       mp->tail->next = &node;
       mp->tail = &node;
    }
-   while (mp->locked || mp->head != &node) {
+   node.tcb->blocked_on = mp;
+
+   level = scheduler_priority(node.tcb);
+   owner = mp->owner;
+   for (depth = 0; depth < MUTEX_DONATION_DEPTH; depth++) {
+      if (scheduler_priority(owner) <= level) break;
+      scheduler_donate(owner, level);
+      if (owner->blocked_on == NULL || owner->blocked_on->owner == NULL) 
+         break;
+      owner = owner->blocked_on->owner;
+   }
+
+   while (mp->owner != node.tcb) {
       scheduler_block();
       quick_lock();
    }
-   mp->locked = TRUE;
-   mp->head = mp->head->next;
+   node.tcb->blocked_on = NULL;
    quick_unlock();
    debug_print("mutex", "Thread %p has acquired mutex %p", node.tcb, mp);
 }
 
+/**
+ * @brief Lock a mutex only if no one holds it. Never blocks, so the idle
+ * thread may use it, but it must not be preempted while it holds the mutex.
+ *
+ * @param mp The mutex to lock.
+ *
+ * @return True if we now hold the mutex.
+ */
+boolean_t mutex_trylock(mutex_t *mp)
+{
+   assert(mp);
+   assert(mp->initialized);
+   if (!locks_enabled) return TRUE;
+
+   quick_lock();
+   if (mp->owner != NULL) {
+      quick_unlock();
+      return FALSE;
+   }
+   mutex_acquire(mp, get_tcb());
+   quick_unlock();
+   debug_print("mutex", "Thread %p has acquired mutex %p", get_tcb(), mp);
+   return TRUE;
+}
+
 /**
  * @brief Unlock a mutex after leaving a critical section.
  *
+ * The first waiter, if there is one, becomes the owner before it is 
+ * woken, and inherits the priority of the waiters behind it. We give up 
+ * whatever priority was donated to us through this mutex.
+ *
  * @param mp The mutex to unlock.
  */
 void mutex_unlock(mutex_t *mp) {
@@ -105,12 +218,27 @@ void mutex_unlock(mutex_t *mp) {
    if (!locks_enabled) 
       return;
 
+   tcb_t *owner, *next = NULL;
    debug_print("mutex", "Releasing mutex %p", mp);
    
-   mp->locked = FALSE;
    quick_lock();
-   if(mp->head) 
-      scheduler_unblock(mp->head->tcb);
+   owner = mp->owner;
+   if (owner != NULL)
+      mutex_release(mp);
+   
+   if (mp->head) {
+      next = mp->head->tcb;
+      mp->head = mp->head->next;
+      if (mp->head == NULL) mp->tail = NULL;
+      mutex_acquire(mp, next);
+   }
+   
+   if (owner != NULL && owner->donated != SCHEDULER_LEVELS)
+      scheduler_donate(owner, mutex_donation(owner));
+   if (next) {
+      scheduler_donate(next, mutex_donation(next));
+      scheduler_unblock(next);
+   }
    quick_unlock();
 }
 
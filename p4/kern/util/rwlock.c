@@ -0,0 +1,199 @@
+/** 
+* @file rwlock.c
+* @brief Implements kernel reader writer locks.
+*
+* Waiters queue in arrival order. When the lock frees up it is handed 
+*  directly to the thread at the head of the queue, along with every reader
+*  queued directly behind it if that thread is a reader, so a steady stream
+*  of readers can not starve a writer.
+*
+* @author Tim Wilson
+* @author Justin Scheiner
+*/
+
+#include <rwlock.h>
+#include <mutex.h>
+#include <assert.h>
+#include <types.h>
+#include <thread.h>
+#include <scheduler.h>
+#include <debug.h>
+#include <global_thread.h>
+
+static void rwlock_wait(rwlock_t *rwp, boolean_t write);
+static void rwlock_handoff(rwlock_t *rwp);
+
+/**
+ * @brief Initialize a reader writer lock.
+ *
+ * @param rwp The lock to initialize.
+ */
+void rwlock_init(rwlock_t *rwp)
+{
+   assert(rwp);
+
+   rwp->head = rwp->tail = NULL;
+   rwp->readers = 0;
+   rwp->writer = NULL;
+   rwp->initialized = TRUE;
+}
+
+/**
+ * @brief Mark a lock as destroyed. Attempts to use a destroyed lock will
+ * cause an assertion to fail.
+ *
+ * @param rwp The lock to destroy.
+ */
+void rwlock_destroy(rwlock_t *rwp)
+{
+   assert(rwp);
+   assert(rwp->initialized);
+   assert(rwp->readers == 0 && rwp->writer == NULL);
+   rwp->initialized = FALSE;
+}
+
+/**
+ * @brief Queue the invoking thread on a lock and block until the lock is 
+ *    handed to it. Must be called with the quick lock held, and returns 
+ *    with it released.
+ *
+ * @param rwp The lock to wait on.
+ * @param write True to wait for the lock to write.
+ */
+static void rwlock_wait(rwlock_t *rwp, boolean_t write)
+{
+   rwlock_node_t node;
+
+   node.tcb = get_tcb();
+   node.write = write;
+   node.granted = FALSE;
+   node.next = NULL;
+   
+   if (rwp->head == NULL) {
+      rwp->head = rwp->tail = &node;
+   }
+   else {
+      rwp->tail->next = &node;
+      rwp->tail = &node;
+   }
+
+   while (!node.granted) {
+      scheduler_block();
+      quick_lock();
+   }
+   quick_unlock();
+}
+
+/**
+ * @brief Hand a free lock to the threads at the head of its queue: a 
+ *    single writer, or every reader up to the next writer. Must be called 
+ *    with the quick lock held.
+ *
+ * @param rwp The lock to hand off.
+ */
+static void rwlock_handoff(rwlock_t *rwp)
+{
+   rwlock_node_t *node = rwp->head;
+   
+   if (node == NULL) return;
+
+   if (node->write) {
+      rwp->head = node->next;
+      rwp->writer = node->tcb;
+      node->granted = TRUE;
+      scheduler_unblock(node->tcb);
+   }
+   else {
+      while (node != NULL && !node->write) {
+         rwp->head = node->next;
+         rwp->readers++;
+         node->granted = TRUE;
+         scheduler_unblock(node->tcb);
+         node = rwp->head;
+      }
+   }
+   if (rwp->head == NULL) rwp->tail = NULL;
+}
+
+/**
+ * @brief Lock for reading. Any number of readers may hold the lock at 
+ *    once, but a reader arriving behind a waiting writer waits its turn.
+ *
+ * @param rwp The lock.
+ */
+void rwlock_lock_read(rwlock_t *rwp)
+{
+   assert(rwp);
+   assert(rwp->initialized);
+   if (!locks_enabled) return;
+   
+   if (get_tcb() != global_tcb())
+      quick_assert_unlocked();
+   quick_lock();
+   if (rwp->writer == NULL && rwp->head == NULL) {
+      rwp->readers++;
+      quick_unlock();
+      return;
+   }
+   debug_print("rwlock", "Thread %p waiting to read %p", get_tcb(), rwp);
+   rwlock_wait(rwp, FALSE);
+}
+
+/**
+ * @brief Release a read lock.
+ *
+ * @param rwp The lock.
+ */
+void rwlock_unlock_read(rwlock_t *rwp)
+{
+   assert(rwp);
+   assert(rwp->initialized);
+   if (!locks_enabled) return;
+   
+   quick_lock();
+   assert(rwp->readers > 0);
+   rwp->readers--;
+   if (rwp->readers == 0) rwlock_handoff(rwp);
+   quick_unlock();
+}
+
+/**
+ * @brief Lock for writing, excluding every other reader and writer.
+ *
+ * @param rwp The lock.
+ */
+void rwlock_lock_write(rwlock_t *rwp)
+{
+   assert(rwp);
+   assert(rwp->initialized);
+   if (!locks_enabled) return;
+   
+   if (get_tcb() != global_tcb())
+      quick_assert_unlocked();
+   quick_lock();
+   if (rwp->writer == NULL && rwp->readers == 0 && rwp->head == NULL) {
+      rwp->writer = get_tcb();
+      quick_unlock();
+      return;
+   }
+   debug_print("rwlock", "Thread %p waiting to write %p", get_tcb(), rwp);
+   rwlock_wait(rwp, TRUE);
+}
+
+/**
+ * @brief Release a write lock.
+ *
+ * @param rwp The lock.
+ */
+void rwlock_unlock_write(rwlock_t *rwp)
+{
+   assert(rwp);
+   assert(rwp->initialized);
+   if (!locks_enabled) return;
+   
+   quick_lock();
+   assert(rwp->writer == get_tcb());
+   rwp->writer = NULL;
+   rwlock_handoff(rwp);
+   quick_unlock();
+}
@@ -9,7 +9,8 @@
 *     interaction between these functions and remove_pages, since that
 *     is the only mechanism for another thread in the same address 
 *     space to mess things up. There is a single lock that protects us
-*     from the effects of remove_pages. 
+*     from the effects of remove_pages. It also keeps new_pages from
+*     racing with the stack growing to cover a user buffer.
 *
 * @author Tim Wilson
 * @author Justin Scheiner
@@ -18,8 +19,11 @@
 #include <vstring.h>
 #include <memman.h>
 #include <mutex.h>
+#include <rwlock.h>
 #include <ecodes.h>
 #include <mm.h>
+#include <pagecache.h>
+#include <region.h>
 
 /**
  * @brief Check that a user has permissions to read from a given address.
@@ -31,6 +35,15 @@
 static boolean_t validate_user_read(void* addr)
 {
    int flags = mm_getflags(addr);
+
+   /* The stack grows to cover addresses just below it. */
+   if(flags <= 0 && region_grow(get_pcb(), addr) == ESUCCESS)
+      flags = mm_getflags(addr);
+
+   /* Pages of the executable are read in the first time they are read. */
+   if(flags > 0 && !(flags & PTENT_PRESENT) && (flags & PTENT_FILE) && 
+         pagecache_map(addr) == ESUCCESS)
+      flags = mm_getflags(addr);
    return (flags == (flags | PTENT_USER | PTENT_PRESENT));
 }
 
@@ -44,6 +57,15 @@ static boolean_t validate_user_read(void* addr)
 static boolean_t validate_user_write(void* addr)
 {
    int flags = mm_getflags(addr);
+
+   /* The stack grows to cover addresses just below it. */
+   if(flags <= 0 && region_grow(get_pcb(), addr) == ESUCCESS)
+      flags = mm_getflags(addr);
+
+   /* The user may write to ZFOD and copy-on-write pages, so frame them. */
+   if(flags > 0 && (flags & (PTENT_ZFOD | PTENT_COW)) && 
+         mm_resolve_write(addr) == ESUCCESS)
+      flags = mm_getflags(addr);
    return (flags == (flags | PTENT_USER | PTENT_PRESENT | PTENT_RW));
 }
 
@@ -102,10 +124,10 @@ int v_cpy(char *dst, char *src, int max_len,
       validate_write = validate_user_write;
    }
 
-   mutex_lock(&pcb->new_pages_lock);
+   rwlock_lock_read(&pcb->new_pages_lock);
    
    if(!validate_read(src) || !validate_write(dst)) {
-      mutex_unlock(&pcb->new_pages_lock);
+      rwlock_unlock_read(&pcb->new_pages_lock);
       return EBUF;
    }
    
@@ -119,7 +141,7 @@ int v_cpy(char *dst, char *src, int max_len,
       
       if (copying_string) {
          if((*dst = *src) == '\0') {
-            mutex_unlock(&pcb->new_pages_lock);
+            rwlock_unlock_read(&pcb->new_pages_lock);
             return n + 1;
          }
       }
@@ -128,7 +150,7 @@ int v_cpy(char *dst, char *src, int max_len,
       }
    }
    
-   mutex_unlock(&pcb->new_pages_lock);
+   rwlock_unlock_read(&pcb->new_pages_lock);
    
    if (!copying_string)
       return n;
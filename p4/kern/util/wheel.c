@@ -0,0 +1,178 @@
+/** 
+* @file wheel.c
+* @brief A hierarchical timing wheel designed for sleeping threads. 
+*  Keys on the wakeup time. 
+*
+*  The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots each. A slot on
+*     level 0 holds the threads waking on a single tick, and a slot on 
+*     level n holds the threads waking in a block of WHEEL_SLOTS^n ticks. 
+*     Whenever the low slots wrap around, the next slot of the level above
+*     is cascaded down into them.
+*
+*  Each slot is a circular list threaded through the scheduler nodes of
+*     the sleeping threads, and each TCB keeps track of the slot it is in, 
+*     so insertion and removal are constant time and never allocate.
+*
+*  All functions must be called with interrupts disabled.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#include <wheel.h>
+#include <kernel_types.h>
+#include <list.h>
+#include <mutex.h>
+#include <assert.h>
+#include <stddef.h>
+
+/** @brief The largest number of ticks a thread can be placed ahead of the
+ * wheel. Longer sleeps are parked in the last slot and cascaded down 
+ * until they are due. */
+#define WHEEL_SPAN ((1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+/** @brief The slot index of a given time on a given level. */
+#define WHEEL_INDEX(time, level) \
+   (((time) >> ((level) * WHEEL_BITS)) & (WHEEL_SLOTS - 1))
+
+/** 
+* @brief Initialize an empty timing wheel.
+* 
+* @param wheel The address of the wheel.
+* @param now The current time. 
+*/
+void wheel_init(timer_wheel_t *wheel, unsigned long now)
+{
+   int level, slot;
+   for (level = 0; level < WHEEL_LEVELS; level++) {
+      for (slot = 0; slot < WHEEL_SLOTS; slot++) {
+         LIST_INIT_EMPTY(wheel->slots[level][slot]);
+      }
+   }
+   wheel->now = now;
+   wheel->count = 0;
+}
+
+/** 
+* @brief Insert a thread into the wheel, keyed on its wakeup time.
+* 
+* @param wheel The wheel to insert into.
+* @param tcb The thread to insert. tcb->wakeup must be set.
+*/
+void wheel_insert(timer_wheel_t *wheel, tcb_t *tcb)
+{
+   quick_assert_locked();
+   unsigned long expires = tcb->wakeup;
+   unsigned long delta;
+   int level;
+
+   /* Threads due in the past go on the next tick we process. */
+   if ((long)(expires - wheel->now) < 0) {
+      expires = wheel->now;
+   }
+   delta = expires - wheel->now;
+   if (delta > WHEEL_SPAN) {
+      expires = wheel->now + WHEEL_SPAN;
+      delta = WHEEL_SPAN;
+   }
+
+   for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+      if (delta < (1UL << ((level + 1) * WHEEL_BITS))) break;
+   }
+
+   tcb->sleep_slot = &wheel->slots[level][WHEEL_INDEX(expires, level)];
+   LIST_INSERT_BEFORE(*tcb->sleep_slot, tcb, scheduler_node);
+   wheel->count++;
+}
+
+/** 
+* @brief Remove a sleeping thread from the wheel before it wakes up.
+* 
+* @param wheel The wheel to remove from.
+* @param tcb The thread to remove.
+*/
+void wheel_remove(timer_wheel_t *wheel, tcb_t *tcb)
+{
+   quick_assert_locked();
+   assert(tcb->sleep_slot);
+   LIST_REMOVE(*tcb->sleep_slot, tcb, scheduler_node);
+   tcb->sleep_slot = NULL;
+   wheel->count--;
+}
+
+/** 
+* @brief Empty a slot on a higher level of the wheel back into the wheel, 
+*  which places each thread on the level below.
+* 
+* @param wheel The wheel.
+* @param level The level of the slot.
+* @param slot The index of the slot.
+*/
+static void wheel_cascade(timer_wheel_t *wheel, int level, int slot)
+{
+   tcb_t *tcb;
+   while ((tcb = wheel->slots[level][slot]) != NULL) {
+      wheel_remove(wheel, tcb);
+      wheel_insert(wheel, tcb);
+   }
+}
+
+/** 
+* @brief Advance the wheel to the given time, removing every thread whose 
+*  wakeup time is before it.
+* 
+* @param wheel The wheel to advance.
+* @param now The current time.
+*
+* @return A circular list of the expired threads, linked through their
+*  scheduler nodes, or NULL if no thread expired. 
+*/
+tcb_t *wheel_expire(timer_wheel_t *wheel, unsigned long now)
+{
+   quick_assert_locked();
+   tcb_t *expired = NULL;
+   tcb_t **slot;
+   tcb_t *tcb;
+   int level;
+
+   while ((long)(now - wheel->now) > 0) {
+      /* When the low slots wrap around, pull the next block of threads 
+       * down from each level above that also wrapped. */
+      for (level = 1; level < WHEEL_LEVELS; level++) {
+         if (WHEEL_INDEX(wheel->now, level - 1) != 0) break;
+         wheel_cascade(wheel, level, WHEEL_INDEX(wheel->now, level));
+      }
+
+      slot = &wheel->slots[0][WHEEL_INDEX(wheel->now, 0)];
+      while ((tcb = *slot) != NULL) {
+         wheel_remove(wheel, tcb);
+         LIST_INSERT_BEFORE(expired, tcb, scheduler_node);
+      }
+      wheel->now++;
+   }
+   return expired;
+}
+
+/** 
+* @brief Find the earliest time at which wheel_expire could release a 
+*  thread. This is exact for threads on level 0, and otherwise the time at
+*  which the next slot is cascaded down to level 0.
+* 
+* @param wheel The wheel.
+*
+* @return The earliest time a thread in the wheel may wake up.
+*/
+unsigned long wheel_next(timer_wheel_t *wheel)
+{
+   unsigned long time = wheel->now;
+
+   /* A cascade is due before the current tick is expired. */
+   if (WHEEL_INDEX(time, 0) == 0) return time + 1;
+
+   do {
+      if (wheel->slots[0][WHEEL_INDEX(time, 0)]) break;
+      time++;
+   } while (WHEEL_INDEX(time, 0) != 0);
+
+   return time + 1;
+}
@@ -0,0 +1,137 @@
+/** 
+* @file sched_stats.h
+* @brief The records returned by the sched_stats system call, describing 
+*  where a thread and its process have spent their time, and by the 
+*  kern_stats system call.
+*
+* @author Justin Scheiner
+* @author Tim Wilson
+*/
+
+#ifndef SCHED_STATS_Q2M7XW4D
+
+#define SCHED_STATS_Q2M7XW4D
+
+/** @brief The thread is on the processor. */
+#define SCHED_RUNNING     0
+
+/** @brief The thread is runnable, but waiting for the processor. */
+#define SCHED_READY       1
+
+/** @brief The thread is blocked in the kernel, or descheduled. */
+#define SCHED_BLOCKED     2
+
+/** @brief The thread is sleeping. */
+#define SCHED_SLEEPING    3
+
+/** @brief Time accounting for a thread or a process. All times are in 
+ * nanoseconds. */
+typedef struct sched_times 
+{
+   /** @brief Time spent running. */
+   unsigned long long run_ns;
+
+   /** @brief Time spent runnable, waiting in the run queue. */
+   unsigned long long ready_ns;
+
+   /** @brief Time spent blocked or descheduled. */
+   unsigned long long blocked_ns;
+
+   /** @brief Time spent sleeping. */
+   unsigned long long sleep_ns;
+
+   /** @brief Total time sleepers were woken after their deadline. */
+   unsigned long long overshoot_ns;
+
+   /** @brief Times the processor was given up by blocking, sleeping, 
+    * descheduling or yielding. */
+   unsigned int voluntary;
+
+   /** @brief Times the processor was taken away by preemption. */
+   unsigned int involuntary;
+
+   /** @brief Completed sleeps. */
+   unsigned int wakeups;
+} sched_times_t;
+
+/** @brief The times of a sched_times_t in 32 bit units, so they can be 
+ * printed without 64 bit division. */
+typedef struct sched_summary
+{
+   /** @brief Milliseconds spent running. */
+   unsigned long run_ms;
+
+   /** @brief Milliseconds spent runnable, waiting in the run queue. */
+   unsigned long ready_ms;
+
+   /** @brief Milliseconds spent blocked or descheduled. */
+   unsigned long blocked_ms;
+
+   /** @brief Milliseconds spent sleeping. */
+   unsigned long sleep_ms;
+
+   /** @brief Average microseconds sleepers were woken after their 
+    * deadline. */
+   unsigned long overshoot_us;
+} sched_summary_t;
+
+/** @brief The record returned by sched_stats. */
+typedef struct sched_stats
+{
+   /** @brief The thread described. */
+   int tid;
+
+   /** @brief The process the thread belongs to. */
+   int pid;
+
+   /** @brief The thread's effective priority level, 0 is the highest. */
+   int level;
+
+   /** @brief SCHED_RUNNING, SCHED_READY, SCHED_BLOCKED or SCHED_SLEEPING. */
+   int state;
+
+   /** @brief Accounting for the thread alone. */
+   sched_times_t thread;
+
+   /** @brief Accounting for every thread the process has ever had. */
+   sched_times_t process;
+
+   /** @brief The thread's times, summarized. */
+   sched_summary_t thread_summary;
+
+   /** @brief The process's times, summarized. */
+   sched_summary_t process_summary;
+} sched_stats_t;
+
+/** @brief The record returned by kern_stats, counting events across the
+ * whole kernel since boot. */
+typedef struct kern_stats
+{
+   /** @brief Context switches. */
+   unsigned long switches;
+
+   /** @brief Switches that loaded a new page directory. */
+   unsigned long cr3_loads;
+
+   /** @brief Switches between threads sharing a page directory, which 
+    * skip the TLB flush. */
+   unsigned long cr3_skips;
+
+   /** @brief Times a sibling of the previous thread was run ahead of its
+    * turn. */
+   unsigned long sibling_picks;
+
+   /** @brief The average number of TSC cycles a switch took, over the 
+    * switches that could be timed. */
+   unsigned long switch_cycles;
+
+   /** @brief Allocations of zeroed frames served from the pool the idle 
+    * thread zeroes ahead of time. */
+   unsigned long zero_hits;
+
+   /** @brief Allocations of zeroed frames that found the pool empty, and 
+    * zeroed a frame themselves. */
+   unsigned long zero_misses;
+} kern_stats_t;
+
+#endif /* end of include guard: SCHED_STATS_Q2M7XW4D */
@@ -9,6 +9,8 @@
 #ifndef _SYSCALL_H
 #define _SYSCALL_H
 
+#include <sched_stats.h>
+
 #define NORETURN __attribute__((__noreturn__))
 
 #define PAGE_SIZE 0x0001000 /* 4096 */
@@ -80,6 +82,19 @@ void misbehave(int mode);
 typedef void (*swexn_handler_t)(void *arg, ureg_t *ureg);
 int swexn(void *esp3, swexn_handler_t eip, void *arg, ureg_t *newureg);
 
+/* Extensions */
+int get_nanos(unsigned long long *nanos);
+int sleep_nanos(unsigned long long nanos);
+int futex_wait(int *addr, int expected);
+int futex_wake(int *addr, int count);
+int sched_stats(int tid, sched_stats_t *stats);
+int rt_reserve(int period, int budget);
+int rt_next(void);
+int spawn(char *execname, char *argvec[]);
+int shm_create(int len);
+int shm_map(void *addr, int shmid);
+int kern_stats(kern_stats_t *stats);
+
 /* Previous API */
 /*
 void exit(int status) NORETURN;
@@ -41,6 +41,17 @@
 /* #define CAS2I_RUNFLAG_INT   0x61 */
 
 #define SWEXN_INT           0x74
+#define GET_NANOS_INT       0x80
+#define SLEEP_NANOS_INT     0x81
+#define FUTEX_WAIT_INT      0x82
+#define FUTEX_WAKE_INT      0x83
+#define SCHED_STATS_INT     0x84
+#define RT_RESERVE_INT      0x85
+#define RT_NEXT_INT         0x86
+#define SPAWN_INT           0x87
+#define SHM_CREATE_INT      0x88
+#define SHM_MAP_INT         0x89
+#define KERN_STATS_INT      0x8A
 
 /* The syscalls in here, INCLUSIVE, are promised not to be
  * probed by any grading scripts; as such you are welcome
@@ -21,6 +21,29 @@
  */
 int atomic_add(int *dest, int src);
 
+/** @brief Atomic exchange.
+ *
+ * @param dest Will be set to src.
+ *
+ * @param src The new value of dest.
+ *
+ * @return The original value of dest.
+ */
+int atomic_xchg(int *dest, int src);
+
+/** @brief Atomic compare and swap.
+ *
+ * @param dest Will be set to src if it is equal to expected.
+ *
+ * @param expected The value dest must hold for the swap to take place.
+ *
+ * @param src The new value of dest.
+ *
+ * @return The original value of dest. The swap happened iff this is
+ *         equal to expected.
+ */
+int atomic_cas(int *dest, int expected, int src);
+
 #endif /* end of include guard: ATOMIC_XEF37AV5 */
 
 
@@ -5,7 +5,6 @@
 #ifndef _COND_TYPE_H
 #define _COND_TYPE_H
 
-#include <queue.h>
 #include <mutex_type.h>
 #include <types.h>
 
@@ -18,38 +17,21 @@
  * initialization. */
 #define COND_INIT -12
 
-/** Structures for condition variables **/
-typedef struct cond_link
-{
-   /** @brief Tid of the thread that created this link. */
-   int tid;
-
-   /** @brief True iff the this link has been signaled. */
-   boolean_t ready;
-
-   /** @brief The next cond_link. */
-   struct cond_link* next;
-
-   /** @brief The previous cond_link. */
-   struct cond_link* prev;
-} cond_link_t;
-
-/* A queue of links waiting to be signaled. */
-DEFINE_QUEUE(cond_queue_t, cond_link_t*);
-
 /** @brief A condition variable structure. */
 typedef struct 
 {
    /** @brief True iff the condition variable has been initialized. */
    boolean_t initialized;
 
-   /** @brief A queue of waiting threads. */
-   cond_queue_t q;
+   /** @brief The futex word. Bumped by every signal and broadcast, so a 
+    * waiter that samples it before releasing its mutex can not miss a 
+    * wakeup. */
+   int seq;
 
-   /** @brief A mutual exclusion lock. */
-   mutex_t qlock;
+   /** @brief The number of threads in cond_wait, letting signals skip the
+    * futex_wake trap when no one is waiting. */
+   int waiting;
 
 } cond_t;
 
 #endif /* _COND_TYPE_H */
-
@@ -19,17 +19,26 @@
  * locked (like trying to destroy it). */
 #define MUTEX_IN_USE -3
 
+/** @brief The mutex is free. */
+#define MUTEX_UNLOCKED 0
+
+/** @brief The mutex is held, and no thread is sleeping on it. */
+#define MUTEX_LOCKED 1
+
+/** @brief The mutex is held, and threads may be sleeping on it. */
+#define MUTEX_CONTENDED 2
+
 /** @brief A mutex structure */
 typedef struct mutex {
 
-   /** @brief The ticket counter, each thread is guaranteed a unique ticket. */
-   int ticket;
-   
-   /** @brief The ticket of the thread that owns the mutex. */
-   int now_serving;
+   /** @brief The futex word: MUTEX_UNLOCKED, MUTEX_LOCKED, or 
+    * MUTEX_CONTENDED if threads may be sleeping on it. 
+    * mutex_unlock_and_vanish.S depends on this being the first field. */
+   int state;
    
    /** @brief The tid of the mutex owner, or NULL_TID if no one holds the 
-    * mutex. */
+    * mutex. mutex_unlock_and_vanish.S depends on this being the second
+    * field. */
    int active_tid;
    
    /** @brief Unique identifier for this mutex. */
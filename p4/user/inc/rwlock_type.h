@@ -20,14 +20,12 @@
 
 typedef struct rwlock 
 {
-   /* @brief The active mode of the reader writer lock. RWLOCK_READ or RWLOCK_WRITE*/
+   /* @brief The active mode of the reader writer lock. RWLOCK_WRITE iff a 
+    *    writer is in the critical section. */
    int mode;
 
-   /* @brief The number of waiting writers */
+   /* @brief The number of waiting and active writers */
    int writers;
-   
-   /* @brief The number of writers cond_waiting, to ensure the right person acquires the lock.*/
-   int waiting_writers;
 
    /* @brief The number of active readers in the critical section*/
    int readers;
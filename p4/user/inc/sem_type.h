@@ -5,8 +5,7 @@
 #ifndef _SEM_TYPE_H
 #define _SEM_TYPE_H
 
-#include <cond.h>
-#include <mutex.h>
+#include <types.h>
 
 /* Semaphore error codes */
 
@@ -20,16 +19,12 @@
 /** @brief A semaphore structure */
 typedef struct sem {
 
-   /** @brief The number of open slots in the semaphore. */
+   /** @brief The number of open slots in the semaphore. This is the futex
+    * word waiters sleep on while it is zero. */
    int open_slots;
 
-   /** @brief A mutual exclusion lock for the semaphore. */
-   mutex_t lock;
-
-   /** @brief A condition variable used to signal an open slot in the semaphore. */
-   cond_t nonzero;
-
-   /** @brief The number of threads waiting to use the semaphore. */
+   /** @brief The number of threads sleeping, or about to sleep, on 
+    * open_slots. */
    int waiting;
 
    /** @brief A unique id for the semaphore. */
@@ -1,7 +1,8 @@
 /** 
 * @file cond.c
 * @brief Condition variable library.
-*  Maintains a locked queue of waiting threads.
+*  Waiters sleep in the kernel on a sequence counter, which every signal 
+*  and broadcast advances.
 *
 * @author Justin Scheiner 
 * @date 2010-09-21
@@ -13,11 +14,12 @@
 #include <thread.h>
 #include <syscall.h>
 #include <thr_internals.h>
+#include <atomic.h>
+#include <limits.h>
 #include <simics.h>
 
 /** 
-* @brief Initializes the internal queue and 
-*  it's associated mutex. 
+* @brief Initializes the sequence counter. 
 * 
 * @param cv The condition variable to initialize.
 * 
@@ -32,8 +34,8 @@ int cond_init( cond_t* cv)
 
    cv->initialized = TRUE;
    
-   mutex_init(&cv->qlock);
-   STATIC_INIT_QUEUE(cv->q);
+   cv->seq = 0;
+   cv->waiting = 0;
    return 0;
 }
 
@@ -52,17 +54,20 @@ int cond_destroy( cond_t* cv)
    if(!cv->initialized) return COND_INIT;
    
    cv->initialized = FALSE;
-   mutex_destroy(&cv->qlock);
    
    return 0;
 }
 
 /** 
 * @brief Blocks until a cond_signal or cond_broadcast awakens the thread.
-*  1. Adds this thread to the run queue.
+*  1. Samples the sequence counter while still holding the lock.
 *  2. Releases the associated lock.
-*  3. Safely deschedules.
+*  3. Sleeps until the counter moves. If a signal already moved it, 
+*     futex_wait returns immediately.
 *  4. Upon waking up, reaquires the associated lock.
+*
+*  As with any condition variable, the caller must recheck its condition, 
+*  since a signal racing with step 2 may wake more than one thread.
 *   
 * @param cv The condition variable to wait on.
 * @param mp The associated mutex.
@@ -76,32 +81,27 @@ int cond_destroy( cond_t* cv)
 */
 int cond_wait( cond_t* cv, mutex_t* mp )
 {
-   int ret;
+   int ret, seq;
 
    if(!cv) return COND_NULL;
    if(!mp) return MUTEX_NULL;
    
    if(!cv->initialized) return COND_INIT;
    if(!mp->initialized) return MUTEX_INIT;
-      
-   cond_link_t link;
-   link.tid = thr_getid();
-   link.ready = FALSE;
    
-   /* Add ourself to the end of the waiting list. */
-   mutex_lock(&cv->qlock);
-   ENQUEUE_LAST(cv->q, &link);
-   mutex_unlock(&cv->qlock);
+   /* Announce ourselves before sampling seq, so a signaller either sees 
+    * us waiting or has already moved seq past our sample. */
+   atomic_add(&cv->waiting, 1);
+   seq = cv->seq;
    
    if((ret = mutex_unlock(mp)) != 0)
    {
+      atomic_add(&cv->waiting, -1);
       return ret;
    }
 
-   /* Deschedule ourselves until we are woken up. */
-   while (link.ready == FALSE) {
-      deschedule((int*)&link.ready);
-   }
+   futex_wait(&cv->seq, seq);
+   atomic_add(&cv->waiting, -1);
 
    if ((ret = mutex_lock(mp)) != 0)
    {
@@ -113,7 +113,7 @@ int cond_wait( cond_t* cv, mutex_t* mp )
 
 /** 
 * @brief Signals one thread waiting on the condition to continue.
-*  Finds the first person in the run queue, and lets him run.
+*  Advances the sequence counter, and wakes the longest sleeper.
 * 
 * @param cv The condition variable to signal.
 * 
@@ -126,25 +126,16 @@ int cond_signal( cond_t* cv )
    if(!cv) return COND_NULL;
    if(!cv->initialized) return COND_INIT;
    
-   cond_link_t* link;
-   
-   /* Get the first waiting thread and wake them up. */
-   mutex_lock(&cv->qlock);
-   DEQUEUE_FIRST(cv->q, link);
-   mutex_unlock(&cv->qlock);
-   
-   if(link)
-   {
-      link->ready = TRUE;
-      make_runnable(link->tid);
-   }
+   atomic_add(&cv->seq, 1);
+   if(cv->waiting > 0)
+      futex_wake(&cv->seq, 1);
    
    return 0;
 }
 
 /** 
 * @brief Signals all threads waiting on the condition to continue.
-*  Locks and dequeues all of the the threads on the run queue.
+*  Advances the sequence counter, and wakes every sleeper.
 * 
 * @param cv The condition variable to broadcast for.
 * 
@@ -157,22 +148,10 @@ int cond_broadcast( cond_t* cv)
    if(!cv) return COND_NULL;
    if(!cv->initialized) return COND_INIT;
 
-   cond_link_t* link;
-
-   mutex_lock(&cv->qlock);
-
-   /* Iterate through all waiting threads and wake them up. */
-   FOREACH(cv->q, link)
-   {
-      lprintf("Releasing %d", link->tid);
-      link->ready = TRUE;
-      make_runnable(link->tid);
-   }
-
-   EMPTY_QUEUE(cv->q);
-   mutex_unlock(&cv->qlock);
+   atomic_add(&cv->seq, 1);
+   if(cv->waiting > 0)
+      futex_wake(&cv->seq, INT_MAX);
    
    return 0;
 }
 
-
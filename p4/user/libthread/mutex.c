@@ -36,8 +36,7 @@ int mutex_init(mutex_t *mp)
    mp->id = atomic_add(&mutex_id, 1);
    mutex_debug_print("   .....Initialized mutex %d at address %p", mp->id, mp);
    mp->active_tid = NULL_TID;
-   mp->ticket = 0;
-   mp->now_serving = 0;
+   mp->state = MUTEX_UNLOCKED;
    mp->initialized = TRUE;
    
    return 0;
@@ -58,16 +57,21 @@ int mutex_destroy(mutex_t *mp)
 {
    if(!mp) return MUTEX_NULL;
    if(mp->initialized == FALSE) return MUTEX_INIT;
-   if(mp->ticket != mp->now_serving) return MUTEX_IN_USE;
+   if(mp->state != MUTEX_UNLOCKED) return MUTEX_IN_USE;
    
    mp->initialized = FALSE;
    return 0;
 }
 
 /** 
-* @brief Straightforward implementation of the bakery algorithm. 
-*        Atomically take a ticket (enforces bounded waiting), 
-*        then wait for "now_serving" to match your ticket. 
+* @brief Lock the mutex, sleeping in the kernel while it is held.
+*
+*        An uncontended acquire is a single compare and swap from 
+*        MUTEX_UNLOCKED to MUTEX_LOCKED. Otherwise we mark the mutex 
+*        MUTEX_CONTENDED, so the holder knows to wake someone, and 
+*        futex_wait until we are the one to swap it out of 
+*        MUTEX_UNLOCKED. Since we can't tell whether other sleepers 
+*        remain, we conservatively take it as MUTEX_CONTENDED.
 *
 * @param mp The mutex to lock.
 * 
@@ -77,15 +81,22 @@ int mutex_destroy(mutex_t *mp)
 */
 int mutex_lock( mutex_t *mp )
 {
+   int state;
    if(!mp) return MUTEX_NULL;
    if(mp->initialized == FALSE) return MUTEX_INIT;
    
    int tid = thr_getid();
-   int ticket = atomic_add(&mp->ticket, 1);
-
-   while(ticket != mp->now_serving)
+   state = atomic_cas(&mp->state, MUTEX_UNLOCKED, MUTEX_LOCKED);
+   if(state != MUTEX_UNLOCKED)
    {
-      thr_yield(mp->active_tid);
+      if(state != MUTEX_CONTENDED)
+         state = atomic_xchg(&mp->state, MUTEX_CONTENDED);
+
+      while(state != MUTEX_UNLOCKED)
+      {
+         futex_wait(&mp->state, MUTEX_CONTENDED);
+         state = atomic_xchg(&mp->state, MUTEX_CONTENDED);
+      }
    }
    
    mp->active_tid = tid;
@@ -93,7 +104,7 @@ int mutex_lock( mutex_t *mp )
 }
 
 /** 
-* @brief Increment now_serving to unlock the mutex, and leave.
+* @brief Release the mutex, and wake one sleeper if there might be any.
 * 
 * @param mp The mutex to unlock
 * 
@@ -103,12 +114,12 @@ int mutex_lock( mutex_t *mp )
 */
 int mutex_unlock( mutex_t *mp )
 {
-   if(!mp) return -1;
-   if(mp->initialized == FALSE) return -2;
+   if(!mp) return MUTEX_NULL;
+   if(mp->initialized == FALSE) return MUTEX_INIT;
    
-   /* Make sure the scheduler yields to people other than me. */
    mp->active_tid = NULL_TID;
-   mp->now_serving++;
+   if(atomic_xchg(&mp->state, MUTEX_UNLOCKED) == MUTEX_CONTENDED)
+      futex_wake(&mp->state, 1);
    return 0;
 }
 
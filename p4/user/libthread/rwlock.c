@@ -1,15 +1,16 @@
 /** 
-* @file rwlock2.c
+* @file rwlock.c
 * @brief Rules for rwlocks: 
 *  1. The last reader is obligated to signal the first writer.
 *  2. Only the last writer can let the readers read.
-*     - Subsequent writers have to be on the list before they can block readers.
+*     - Subsequent writers have to be counted before they can block readers.
+*  3. Every wait rechecks its condition, since the futex based condition 
+*     variables may wake more threads than were signalled.
 */
 
 #include <rwlock.h>
 #include <atomic.h>
 #include <thr_internals.h>
-#include <simics.h>
 #include <thread.h>
 
 /** 
@@ -29,11 +30,10 @@ int rwlock_init( rwlock_t *rwlock )
    if(!rwlock) return RWLOCK_NULL;
    if(rwlock->initialized) return RWLOCK_INIT;
    
-   // This value doesn't matter, since clear will be true.
+   // No writer holds the lock.
    rwlock->mode = RWLOCK_READ;
    
    rwlock->writers = 0;
-   rwlock->waiting_writers = 0;
    rwlock->readers = 0;
    rwlock->initialized = TRUE;
    mutex_init(&rwlock->rw_count_lock);
@@ -68,8 +68,8 @@ int rwlock_destroy( rwlock_t *rwlock )
 * @brief Attempts to lock a reader writer lock for reading or writing.
 *
 * Writers block readers, unless a read is already happening. 
-* Both types wait on a condition variable that can be signalled when appropriate.
-* There is also an atomic "reader" count that will signal writers when it drops to zero.
+* Both types wait on a condition variable that can be signalled when appropriate,
+* and all of the counts are protected by rw_count_lock.
 * 
 * @param rwlock The reader writer lock.
 * @param type RWLOCK_READ for reading, RWLOCK_WRITE for writing.
@@ -87,39 +87,40 @@ int rwlock_lock( rwlock_t *rwlock, int type )
    switch(type)
    {
       case RWLOCK_READ: 
-         lprintf("[%d] Trying to acquire reader lock.", thr_getid());
-         
-         // Wait for clearance to read from the active readers / writer
+         // Wait for clearance to read from the waiting / active writers.
          mutex_lock(&rwlock->rw_count_lock);
          while(rwlock->writers > 0)
-            cond_wait(&rwlock->wait_read, &rwlock->rw_count_lock);
-         
-         //Atomically increment the number of readers.
-         atomic_add(&rwlock->readers, 1);
-         rwlock->mode = RWLOCK_READ;
+         {
+            if((ret = cond_wait(&rwlock->wait_read, &rwlock->rw_count_lock)) != 0)
+            {
+               mutex_unlock(&rwlock->rw_count_lock);
+               return ret;
+            }
+         }
          
-         //Let other readers into the critical section if possible.
+         rwlock->readers++;
          mutex_unlock(&rwlock->rw_count_lock);
-         
          break;   
       
       case RWLOCK_WRITE: 
-         lprintf("[%d] Trying to acquire writer lock.", thr_getid());
-         
-         // Wait for clearance to write from the active writer / readers.
-         atomic_add(&rwlock->writers, 1);
-         
+         // Count ourselves first, so no new readers get in ahead of us.
          mutex_lock(&rwlock->rw_count_lock);
-         if(rwlock->waiting_writers > 0 || rwlock->readers > 0)
+         rwlock->writers++;
+         while(rwlock->readers > 0 || rwlock->mode == RWLOCK_WRITE)
          {
-            rwlock->waiting_writers++;
             if((ret = cond_wait(&rwlock->wait_write, &rwlock->rw_count_lock)) != 0)
+            {
+               // Stop holding off readers that only we were waiting for.
+               rwlock->writers--;
+               if(rwlock->writers == 0)
+                  cond_broadcast(&rwlock->wait_read);
+               mutex_unlock(&rwlock->rw_count_lock);
                return ret;
-            rwlock->waiting_writers--;
+            }
          }
 
-         //Writers hold onto the clear lock until they exit.
          rwlock->mode = RWLOCK_WRITE;
+         mutex_unlock(&rwlock->rw_count_lock);
          break;   
       
       default: return RWLOCK_INVALID_TYPE;
@@ -132,7 +133,7 @@ int rwlock_lock( rwlock_t *rwlock, int type )
 /** 
 * @brief Unlocks a reader writer lock.
 *  If we are in read mode, 
-*   Decrement the number of readers and signal a writer if there is one.
+*   Decrement the number of readers and signal a writer if we were the last.
 *
 *  If we are in write mode, 
 *   Signal a waiting writer if there is one, otherwise broadcast to readers
@@ -146,62 +147,35 @@ int rwlock_lock( rwlock_t *rwlock, int type )
 */
 int rwlock_unlock( rwlock_t *rwlock )
 {
-   int readers, writers;
    if(!rwlock) return RWLOCK_NULL;
    if(!rwlock->initialized) return RWLOCK_INIT;
 
+   mutex_lock(&rwlock->rw_count_lock);
    switch(rwlock->mode)
    {
       case RWLOCK_WRITE: 
-
-         //Decrement the number of writers.
-         writers = atomic_add(&rwlock->writers, -1);
+         rwlock->mode = RWLOCK_READ;
+         rwlock->writers--;
          
-         // If the next writer doesn't beat us here, he doesn't get to run 
-         //    until the readers are done.
-         if(writers > 1)
-         {
-            lprintf("[%d] Releasing writer lock to next writer.", thr_getid());
+         if(rwlock->writers > 0)
             cond_signal(&rwlock->wait_write);
-         }
          else
-         {
-            lprintf("[%d] Releasing writer lock to all readers.", thr_getid());
             cond_broadcast(&rwlock->wait_read);
-         }
-         
-         //We still own the "clear" lock.
-         mutex_unlock(&rwlock->rw_count_lock);
-
          break;
       
       case RWLOCK_READ:
-         
-         // Grab the clear lock.
-         mutex_lock(&rwlock->rw_count_lock);
-
-         //Decrement the number of active readers.
-         readers = atomic_add(&rwlock->readers, -1);
+         rwlock->readers--;
 
-         //If we are the last reader to decrement,
-         if(readers == 1 && rwlock->writers)
-         {
-            lprintf("[%d] Releasing reader lock to next writer.", thr_getid());
-            //Let the first writer go if one is ready.
+         //If we are the last reader, let the first writer go.
+         if(rwlock->readers == 0 && rwlock->writers > 0)
             cond_signal(&rwlock->wait_write);
-         } 
-         else
-         {
-            lprintf("[%d] Decrementing readers to %d - writers = %d.", 
-               thr_getid(), readers - 1, rwlock->writers);
-         }
-         mutex_unlock(&rwlock->rw_count_lock);
-
          break;
 
-      default: return RWLOCK_INVALID_TYPE;
+      default: 
+         mutex_unlock(&rwlock->rw_count_lock);
+         return RWLOCK_INVALID_TYPE;
    }
+   mutex_unlock(&rwlock->rw_count_lock);
    return 0;
 }
 
-
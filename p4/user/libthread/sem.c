@@ -1,6 +1,6 @@
 /** 
 * @file sem.c
-* @brief Basic implementation of semaphores using one condition variable, and one mutex.
+* @brief Implementation of semaphores on a single futex word.
 * @author Justin Scheiner
 * @date 2010-09-27
 */
@@ -8,7 +8,7 @@
 #include <thr_internals.h>
 #include <sem.h>
 #include <atomic.h>
-#include <mutex.h>
+#include <syscall.h>
 #include <types.h>
 
 /** @brief An id counter. */
@@ -23,8 +23,6 @@ static int sem_id = 0;
 * @return 0 on success. 
 *         SEM_NULL if the semaphore is NULL.
 *         SEM_INIT if the semaphore is already initialized.
-*         MUTEX_INIT if we cannot initialize a new mutex.
-*         COND_INIT if we cannot initialize a new condition variable.
 */
 int sem_init(sem_t* sem, int count)
 {
@@ -36,9 +34,6 @@ int sem_init(sem_t* sem, int count)
 
    sem->id = atomic_add(&sem_id, 1);
    sem->waiting = 0;
-   
-   if(mutex_init(&sem->lock) != 0) return MUTEX_INIT;
-   if(cond_init(&sem->nonzero) != 0) return COND_INIT;
 
    return 0;
 }
@@ -51,60 +46,70 @@ int sem_init(sem_t* sem, int count)
 * @return 0 on success.
 *         SEM_NULL if the semaphore is NULL.
 *         SEM_INIT if the semaphore wasn't initialized.
-*         MUTEX_INIT if we cannot destroy the mutex.
-*         COND_INIT if we cannot destroy the condition.
 */
 int sem_destroy( sem_t* sem )
 {
    if(!sem) return SEM_NULL;
    if(!sem->initialized) return SEM_INIT;
    sem->initialized = FALSE;
-   if(mutex_destroy(&sem->lock) != 0) return MUTEX_INIT;
-   if(cond_destroy(&sem->nonzero) != 0) return COND_INIT;
    return 0;
 }
 
 /** 
 * @brief Attempts to decrement the semaphores count. 
 *  
-* If the semaphores count is zero, then blocks until it becomes nonzero.
+* If the semaphores count is zero, then sleeps in the kernel until it 
+*  becomes nonzero, and tries again.
 * 
 * @param sem The semaphore to decrement.
 * 
 * @return 0 on success.
-*           < 0 on failure. Failure may occur if the semaphore's mutex or
-*           condition variable fails.
+*         SEM_NULL if the semaphore is NULL.
+*         SEM_INIT if the semaphore isn't initialized.
 */
 int sem_wait(sem_t* sem)
 {
-   int ret;
-   if ((ret = mutex_lock(&sem->lock)) != 0)
-      return ret;
+   int count;
+   if(!sem) return SEM_NULL;
+   if(!sem->initialized) return SEM_INIT;
    
-   if (sem->waiting > 0 || sem->open_slots == 0) {
-      sem->waiting++;
-      if ((ret = cond_wait(&sem->nonzero, &sem->lock)) != 0)
-         return ret;
-      sem->waiting--;
+   while(1)
+   {
+      count = sem->open_slots;
+      if(count > 0)
+      {
+         if(atomic_cas(&sem->open_slots, count, count - 1) == count)
+            return 0;
+      }
+      else
+      {
+         /* Announce ourselves before the kernel samples open_slots, so 
+          * sem_signal either sees us or we see its increment. */
+         atomic_add(&sem->waiting, 1);
+         futex_wait(&sem->open_slots, count);
+         atomic_add(&sem->waiting, -1);
+      }
    }
-   atomic_add(&sem->open_slots, -1);
-   return mutex_unlock(&sem->lock);
 }
 
 /** 
-* @brief Increments the semaphores count, and signals the next waiting thread.
+* @brief Increments the semaphores count, and wakes a sleeping thread if
+*  there are any.
 * 
 * @param sem The semaphore to increment.
 * 
 * @return 0 on success.
-*         < 0 on failure. Failure may occur if the semaphore's condition
-*         variable fails.
+*         SEM_NULL if the semaphore is NULL.
+*         SEM_INIT if the semaphore isn't initialized.
 */
 int sem_signal(sem_t* sem)
 {
+   if(!sem) return SEM_NULL;
+   if(!sem->initialized) return SEM_INIT;
+   
    atomic_add(&sem->open_slots, 1);
-   return cond_signal(&sem->nonzero);
+   if(sem->waiting > 0)
+      futex_wake(&sem->open_slots, 1);
+   return 0;
 }
 
-
-
@@ -0,0 +1,77 @@
+/** 
+* @file cow_test.c
+* @brief Checks that pages shared copy-on-write by fork stay private to
+*  each process, whether they are written by the user or by the kernel
+*  on the user's behalf.
+*/
+#include <syscall.h>
+#include <simics.h>
+
+#define PAGES 4
+#define PAGE 4096
+
+/** @brief Writable data that fork will share copy-on-write. */
+static char data[PAGES * PAGE];
+
+/** 
+* @brief Fill every page of data with value.
+*/
+static void fill(char value)
+{
+   int i;
+   for (i = 0; i < PAGES * PAGE; i += PAGE)
+      data[i] = value;
+}
+
+/** 
+* @brief Check that every page of data holds value.
+*/
+static int check(char value)
+{
+   int i;
+   for (i = 0; i < PAGES * PAGE; i += PAGE)
+      if (data[i] != value)
+         return -1;
+   return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+   int status, *status_addr;
+   fill('p');
+
+   if (fork() == 0)
+   {
+      if (check('p') < 0)
+         return 1;
+      fill('c');
+      return check('c') < 0 ? 2 : 0;
+   }
+
+   /* Let wait write into a shared page, then fork again so the page we 
+    *  wrote from the kernel is shared with a second child. */
+   status_addr = (int *)&data[PAGE];
+   if (wait(status_addr) < 0 || *status_addr != 0)
+   {
+      lprintf("cow_test: first child failed");
+      return -1;
+   }
+
+   if (fork() == 0)
+   {
+      *status_addr = 42;
+      return 0;
+   }
+   if (wait(&status) < 0 || status != 0 || *status_addr != 0)
+   {
+      lprintf("cow_test: second child changed our page");
+      return -1;
+   }
+
+   fill('q');
+   if (check('q') < 0)
+      return -1;
+
+   lprintf("cow_test: success");
+   return 0;
+}
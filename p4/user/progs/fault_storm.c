@@ -0,0 +1,75 @@
+/** 
+* @file fault_storm.c
+* @brief Checks that threads of one task can fault in pages of the same 
+*  region at once, while another thread keeps adding and removing a region
+*  of its own and copying arguments into the kernel.
+*/
+#include <syscall.h>
+#include <thread.h>
+#include <simics.h>
+
+/* Not 4 MB aligned, so the region is faulted in a page at a time. */
+#define BASE ((char *)0x10001000)
+#define SCRATCH ((char *)0x20000000)
+#define PAGE 4096
+#define NTHREADS 8
+#define PAGES_EACH 64
+
+/** @brief Write, then check, every page in one thread's stripe. */
+void *toucher(void *arg)
+{
+   int id = (int)arg;
+   int i;
+   char *page;
+
+   for (i = 0; i < PAGES_EACH; i++)
+   {
+      page = BASE + (i * NTHREADS + id) * PAGE;
+      page[id] = (char)(id + 1);
+   }
+   for (i = 0; i < PAGES_EACH; i++)
+   {
+      page = BASE + (i * NTHREADS + id) * PAGE;
+      if (page[id] != (char)(id + 1))
+         return (void *)-1;
+   }
+   return (void *)0;
+}
+
+int main(int argc, const char *argv[])
+{
+   int tids[NTHREADS];
+   int i, status, failed = 0;
+
+   thr_init(4096);
+   if (new_pages(BASE, NTHREADS * PAGES_EACH * PAGE) < 0)
+   {
+      lprintf("fault_storm: new_pages failed");
+      return -1;
+   }
+
+   for (i = 0; i < NTHREADS; i++)
+      tids[i] = thr_create(toucher, (void *)i);
+
+   /* Change the layout of the address space while the others fault. */
+   for (i = 0; i < 32; i++)
+   {
+      if (new_pages(SCRATCH, PAGE) < 0 || remove_pages(SCRATCH) < 0)
+         failed = 1;
+      print(12, "fault_storm");
+   }
+
+   for (i = 0; i < NTHREADS; i++)
+   {
+      if (tids[i] < 0 || thr_join(tids[i], (void **)&status) < 0 || status)
+         failed = 1;
+   }
+
+   if (failed)
+   {
+      lprintf("fault_storm: failed");
+      return -1;
+   }
+   lprintf("fault_storm: success");
+   return 0;
+}
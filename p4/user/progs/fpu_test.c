@@ -0,0 +1,36 @@
+/** 
+* @file fpu_test.c
+* @brief Checks that floating point state survives context switches, by
+*  running the same floating point computation in two processes that 
+*  keep yielding to each other.
+*/
+#include <syscall.h>
+#include <simics.h>
+
+#define ITERATIONS 1000
+
+double accumulate(double step)
+{
+   double sum = 0.0;
+   int i;
+   for (i = 0; i < ITERATIONS; i++)
+   {
+      sum += step * i;
+      yield(-1);
+   }
+   return sum;
+}
+
+int main(int argc, const char *argv[])
+{
+   double step = (fork() == 0) ? 0.25 : 0.5;
+   double expected = step * ITERATIONS * (ITERATIONS - 1) / 2;
+   double sum = accumulate(step);
+
+   if (sum != expected) {
+      lprintf("Expected %d, got %d", (int)expected, (int)sum);
+      return -1;
+   }
+   lprintf("FPU state preserved for step %d/4", (int)(step * 4));
+   return 0;
+}
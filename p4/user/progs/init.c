@@ -3,7 +3,7 @@
  *  @brief Initial program.
  *  @public yes
  *  @for p2 p3
- *  @covers fork exec wait print
+ *  @covers spawn wait print
  *  @status done
  */
 
@@ -17,9 +17,11 @@ int main()
   char * args[] = {shell, 0};
 
   while(1) {
-    pid = fork();
-    if (!pid)
-      exec(shell, args);
+    pid = spawn(shell, args);
+    if (pid < 0) {
+      printf("Cannot spawn the shell (%d); retrying...", pid);
+      continue;
+    }
     
     while (pid != wait(&exitstatus));
   
@@ -0,0 +1,36 @@
+/** 
+* @file nanos_test.c
+* @brief Checks that the nanosecond clock is monotonic, and that 
+*  sleep_nanos wakes up close to its deadline.
+*/
+#include <syscall.h>
+#include <simics.h>
+
+#define TRIALS 8
+
+int main(int argc, const char *argv[])
+{
+   unsigned long long before, after, last = 0;
+   unsigned long long nanos = 1500000;
+   int i;
+   
+   for (i = 0; i < TRIALS; i++)
+   {
+      get_nanos(&before);
+      if (before < last) {
+         lprintf("Clock went backwards!");
+         return -1;
+      }
+      sleep_nanos(nanos);
+      get_nanos(&after);
+      lprintf("Asked for %lu ns, slept %lu ns", (unsigned long)nanos, 
+            (unsigned long)(after - before));
+      if (after - before < nanos) {
+         lprintf("Woke up early!");
+         return -1;
+      }
+      last = after;
+      nanos *= 2;
+   }
+   return 0;
+}
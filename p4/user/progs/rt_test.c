@@ -0,0 +1,55 @@
+/** 
+* @file rt_test.c
+* @brief Checks real time admission control, and that a real time thread 
+*  is released once per period while a best effort thread spins.
+*/
+#include <syscall.h>
+#include <simics.h>
+
+#define PERIOD 10
+#define BUDGET 3
+#define JOBS 10
+
+int main(int argc, const char *argv[])
+{
+   int i, start, release;
+
+   if (rt_reserve(PERIOD, PERIOD + 1) >= 0) {
+      lprintf("Accepted a budget longer than its period!");
+      return -1;
+   }
+
+   if (fork() == 0) {
+      /* A best effort thread that would crowd a round robin loop. */
+      start = get_ticks();
+      while (get_ticks() - start < 2 * JOBS * PERIOD) continue;
+      return 0;
+   }
+
+   if (rt_reserve(PERIOD, BUDGET) < 0) {
+      lprintf("Reservation rejected!");
+      return -1;
+   }
+   if (fork() == 0) {
+      /* Together with our parent this needs more than the processor. */
+      if (rt_reserve(PERIOD, PERIOD - BUDGET + 1) >= 0) {
+         lprintf("Admitted an overloaded reservation set!");
+         return -1;
+      }
+      lprintf("Overloaded reservation rejected");
+      return 0;
+   }
+
+   start = get_ticks();
+   for (i = 1; i <= JOBS; i++) {
+      rt_next();
+      release = get_ticks() - start;
+      lprintf("Job %d released at tick %d", i, release);
+      if (release < i * PERIOD - PERIOD || release > i * PERIOD + 1) {
+         lprintf("Missed a release!");
+         return -1;
+      }
+   }
+   lprintf("All releases on time");
+   return 0;
+}
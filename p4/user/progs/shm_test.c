@@ -0,0 +1,77 @@
+/**
+* @file shm_test.c
+* @brief Checks that a shared memory segment is shared, rather than copied,
+*  across fork, that segments can not be mapped over memory the task
+*  already has or outside of user memory, and that remove_pages unmaps them.
+*/
+#include <syscall.h>
+#include <simics.h>
+
+#define BASE ((char *)0x30000000)
+#define PAGE 4096
+#define PAGES 4
+
+int main(int argc, const char *argv[])
+{
+   int shmid, status, i;
+
+   if (shm_create(PAGE + 1) >= 0 || shm_create(0) >= 0)
+   {
+      lprintf("shm_test: created a bad segment");
+      return -1;
+   }
+
+   if ((shmid = shm_create(PAGES * PAGE)) < 0 || shm_map(BASE, shmid) < 0)
+   {
+      lprintf("shm_test: could not map a segment");
+      return -1;
+   }
+   if (shm_map(BASE + PAGE, shmid) >= 0 || shm_map(BASE + 1, shmid) >= 0)
+   {
+      lprintf("shm_test: mapped a segment over itself");
+      return -1;
+   }
+   if (shm_map((char *)0xF0000000, shmid) >= 0)
+   {
+      lprintf("shm_test: mapped a segment over the kernel");
+      return -1;
+   }
+   for (i = 0; i < PAGES; i++)
+   {
+      if (BASE[i * PAGE] != 0)
+      {
+         lprintf("shm_test: new segment is not zeroed");
+         return -1;
+      }
+   }
+
+   /* The child's writes must show up in our copy. */
+   if (fork() == 0)
+   {
+      for (i = 0; i < PAGES; i++)
+         BASE[i * PAGE] = (char)(i + 1);
+      return 0;
+   }
+   if (wait(&status) < 0 || status != 0)
+   {
+      lprintf("shm_test: child failed");
+      return -1;
+   }
+   for (i = 0; i < PAGES; i++)
+   {
+      if (BASE[i * PAGE] != (char)(i + 1))
+      {
+         lprintf("shm_test: child's writes were not shared");
+         return -1;
+      }
+   }
+
+   /* Unmapping the last mapping frees the segment. */
+   if (remove_pages(BASE) < 0 || shm_map(BASE, shmid) >= 0)
+   {
+      lprintf("shm_test: remove_pages failed");
+      return -1;
+   }
+   lprintf("shm_test: success");
+   return 0;
+}
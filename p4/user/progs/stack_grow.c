@@ -0,0 +1,52 @@
+/** 
+* @file stack_grow.c
+* @brief Checks that the stack grows on demand: deep recursion succeeds, 
+*  the kernel can write to stack it has never touched, and new_pages can 
+*  not claim the guard gap below the stack.
+*/
+#include <syscall.h>
+#include <simics.h>
+
+#define STACK_TOP ((char *)0xc0000000)
+#define PAGE 4096
+#define DEPTH 2000
+
+/** @brief Recurse with a large frame, about 400k of stack in all. */
+static int recurse(int depth)
+{
+   volatile char frame[200];
+   frame[0] = (char)depth;
+   if (depth == 0)
+      return 0;
+   return recurse(depth - 1) + (frame[0] == (char)depth);
+}
+
+int main(int argc, const char *argv[])
+{
+   char buf[16 * PAGE];
+   unsigned long long *nanos;
+
+   /* Just below the initial stack region lies its guard. */
+   if (new_pages(STACK_TOP - 5 * PAGE, PAGE) == 0)
+   {
+      lprintf("stack_grow: new_pages claimed the guard");
+      return -1;
+   }
+
+   /* The kernel writes to the far end of a buffer we never touched. */
+   nanos = (unsigned long long *)buf;
+   if (get_nanos(nanos) < 0 || *nanos == 0)
+   {
+      lprintf("stack_grow: kernel write failed");
+      return -1;
+   }
+
+   if (recurse(DEPTH) != DEPTH)
+   {
+      lprintf("stack_grow: recursion saw the wrong stack");
+      return -1;
+   }
+
+   lprintf("stack_grow: success");
+   return 0;
+}
@@ -0,0 +1,93 @@
+/**
+* @file top.c
+* @brief Periodically prints where every thread and process has spent its
+*  time, using sched_stats, followed by the kernel's context switch and
+*  zeroed frame counters from kern_stats.
+*
+*  Usage: top [refreshes] [ticks between refreshes]
+*/
+#include <syscall.h>
+#include <sched_stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** @brief The most processes summarized in one refresh. */
+#define MAX_PROCESSES 64
+
+/** @brief One letter per scheduler state, indexed by state. */
+static const char states[] = "RrBS";
+
+/**
+* @brief Print one row of the table.
+*
+* @param id The thread or process ID.
+* @param stats The thread's record.
+* @param times The times to print the counts of.
+* @param summary The summary of the same times.
+*/
+static void print_row(int id, sched_stats_t *stats, sched_times_t *times,
+   sched_summary_t *summary)
+{
+   printf("%5d %5d %3d %c %9lu %9lu %9lu %9lu %6u %6u %7lu\n", id,
+      stats->pid, stats->level, states[stats->state & 3],
+      summary->run_ms, summary->ready_ms, summary->blocked_ms, 
+      summary->sleep_ms, times->voluntary, times->involuntary,
+      summary->overshoot_us);
+}
+
+/**
+* @brief Print the header of a table.
+*
+* @param id The name of the ID column.
+*/
+static void print_header(const char *id)
+{
+   printf("%5s   PID LVL S    RUN ms  READY ms  BLOCK ms  SLEEP ms", id);
+   printf("    VOL  INVOL  OVR us\n");
+}
+
+int main(int argc, const char *argv[])
+{
+   int refreshes = argc > 1 ? atoi(argv[1]) : 10;
+   int interval = argc > 2 ? atoi(argv[2]) : 100;
+   sched_stats_t procs[MAX_PROCESSES];
+   sched_stats_t stats;
+   kern_stats_t kstats;
+   int i, j, tid, processes;
+
+   for (i = 0; i < refreshes; i++)
+   {
+      print_header("TID");
+      processes = 0;
+      for (tid = sched_stats(0, &stats); tid >= 0;
+            tid = sched_stats(tid + 1, &stats))
+      {
+         print_row(tid, &stats, &stats.thread, &stats.thread_summary);
+
+         /* Keep the first record we see for each process, to summarize 
+          * it below. */
+         for (j = 0; j < processes && procs[j].pid != stats.pid; j++)
+            continue;
+         if (j == processes && processes < MAX_PROCESSES)
+            procs[processes++] = stats;
+      }
+
+      print_header("PID");
+      for (j = 0; j < processes; j++)
+         print_row(procs[j].pid, &procs[j], &procs[j].process, 
+            &procs[j].process_summary);
+
+      if (kern_stats(&kstats) == 0)
+      {
+         printf("SWITCHES %lu  CR3 LOADS %lu  CR3 SKIPS %lu  SIBLINGS %lu", 
+            kstats.switches, kstats.cr3_loads, kstats.cr3_skips, 
+            kstats.sibling_picks);
+         printf("  CYCLES/SWITCH %lu\n", kstats.switch_cycles);
+         printf("ZEROED FRAMES: %lu FROM POOL, %lu BY HAND\n", 
+            kstats.zero_hits, kstats.zero_misses);
+      }
+      printf("\n");
+      sleep(interval);
+   }
+   return 0;
+}
@@ -0,0 +1,58 @@
+/** 
+* @file zfod_pages.c
+* @brief Checks that new_pages memory is zero filled on demand: it reads as
+*  zero, can be written by the user and by the kernel before it is ever 
+*  touched, and survives a fork.
+*/
+#include <syscall.h>
+#include <simics.h>
+
+#define BASE ((char *)0x10000000)
+#define LEN (4 * 1024 * 1024)
+#define PAGE 4096
+
+int main(int argc, const char *argv[])
+{
+   unsigned long long *nanos;
+   int i, pid, status;
+
+   if (new_pages(BASE, LEN) < 0)
+   {
+      lprintf("zfod_pages: new_pages failed");
+      return -1;
+   }
+
+   for (i = 0; i < LEN; i += 16 * PAGE)
+      if (BASE[i] != 0)
+         return -1;
+
+   /* The kernel writes into a page we have never touched. */
+   nanos = (unsigned long long *)(BASE + LEN - PAGE);
+   if (get_nanos(nanos) < 0 || *nanos == 0)
+   {
+      lprintf("zfod_pages: kernel write failed");
+      return -1;
+   }
+
+   for (i = 0; i < LEN; i += 16 * PAGE)
+      BASE[i] = (char)(i / PAGE);
+
+   if ((pid = fork()) == 0)
+   {
+      for (i = 0; i < LEN; i += 16 * PAGE)
+         if (BASE[i] != (char)(i / PAGE) || BASE[i + PAGE] != 0)
+            return 1;
+      return 0;
+   }
+   if (pid < 0 || wait(&status) != pid || status != 0)
+   {
+      lprintf("zfod_pages: child saw the wrong memory");
+      return -1;
+   }
+
+   if (remove_pages(BASE) < 0)
+      return -1;
+
+   lprintf("zfod_pages: success");
+   return 0;
+}